@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -7,11 +8,15 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <sched.h>
+#include <omp.h>
+#include "crc64.h"
 #include "cpubench.h"
 
 static struct option long_options[] = {
-    {"seed", required_argument, 0, 's'},
-    {"help", no_argument,       0, 'h'},
+    {"seed",   required_argument, 0, 's'},
+    {"window", required_argument, 0, 'w'},
+    {"help",   no_argument,       0, 'h'},
     {0, 0, 0, 0}
 };
 
@@ -24,6 +29,19 @@ typedef struct benchmark_t {
 
 } benchmark_t;
 
+#define WINDOW_DEFAULT_MS   1000
+#define WINDOW_BATCH        (64 * 1024)   // steps between two clock reads
+#define CORE_SLOW_RATIO     0.85          // of the median core score
+
+// one point of the scaling curve, threads run on the first cpus
+// of the topology
+typedef struct run_t {
+    size_t threads;
+    double *scores;   // per thread, in topology order
+    double total;
+
+} run_t;
+
 void diep(char *str) {
     perror(str);
     exit(EXIT_FAILURE);
@@ -77,7 +95,7 @@ benchmark_t *benchmark(benchmark_t *source) {
     source->length = values * sizeof(seed);
 
     for(size_t offset = 0; offset < values; offset++) {
-        seed = crc64((uint8_t *) &seed, sizeof(seed));
+        seed = crc64_u64(seed);
     }
 
     source->final = seed;
@@ -87,9 +105,94 @@ benchmark_t *benchmark(benchmark_t *source) {
     return source;
 }
 
+static double time_now() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    return now.tv_sec + (now.tv_usec / 1000000.0);
+}
+
+//
+// scaling run
+//
+// each thread is pinned to its cpu, they all wait on a barrier and
+// start on the same clock, then chain crc64 steps until the same
+// deadline. scores are measured over the same window, their sum is
+// the throughput of the whole set of cpus
+//
+static void benchmark_window(topology_t *topology, run_t *run, uint64_t seed, double window) {
+    double begin = 0;
+    double deadline = 0;
+
+    #pragma omp parallel num_threads(run->threads)
+    {
+        int thread = omp_get_thread_num();
+        uint64_t value = seed + thread;
+        size_t steps = 0;
+
+        if(!topology_pin(&topology->cpus[thread]))
+            perror("sched_setaffinity");
+
+        // every thread pinned and ready, the window opens
+        #pragma omp barrier
+
+        #pragma omp single
+        {
+            begin = time_now();
+            deadline = begin + window;
+        }
+
+        double now = begin;
+
+        while(now < deadline) {
+            for(size_t i = 0; i < WINDOW_BATCH; i++)
+                value = crc64_u64(value);
+
+            steps += WINDOW_BATCH;
+            now = time_now();
+        }
+
+        // last batch can overrun the deadline a little, each thread
+        // is measured up to its own end
+        run->scores[thread] = speed(steps * sizeof(value), now - begin);
+    }
+
+    run->total = 0;
+
+    for(size_t i = 0; i < run->threads; i++)
+        run->total += run->scores[i];
+}
+
+// thread counts of the curve: doubling up to the physical cores,
+// then one more thread per core up to every cpu
+static size_t scaling_points(topology_t *topology, size_t *counts) {
+    size_t points = 0;
+
+    for(size_t threads = 1; threads < topology->cores; threads *= 2)
+        counts[points++] = threads;
+
+    counts[points++] = topology->cores;
+
+    for(size_t threads = topology->cores * 2; threads < topology->count; threads += topology->cores)
+        counts[points++] = threads;
+
+    if(topology->count > topology->cores)
+        counts[points++] = topology->count;
+
+    return points;
+}
+
+static int score_compare(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
 int main(int argc, char *argv[]) {
     int option_index = 0;
     char *seeds = NULL;
+    double window = WINDOW_DEFAULT_MS / 1000.0;
 
     printf(COLOR_CYAN "[+] initializing grid-cpu-benchmark client" COLOR_RESET "\n");
 
@@ -104,8 +207,15 @@ int main(int argc, char *argv[]) {
                 seeds = optarg;
                 break;
 
+            case 'w':
+                if((window = strtoul(optarg, NULL, 10) / 1000.0) <= 0) {
+                    fprintf(stderr, "[-] measurement window needs to be at least 1 ms\n");
+                    return 1;
+                }
+                break;
+
             case 'h':
-                printf("help\n");
+                printf("usage: %s --seed 0x................ [--window MS]\n", argv[0]);
                 return 1;
 
             case '?':
@@ -133,6 +243,8 @@ int main(int argc, char *argv[]) {
     printf("[+] cpu model name: " COLOR_GREEN "%s" COLOR_RESET "\n", cpumodel);
     free(cpumodel);
 
+    printf("[+] crc64 implementation: %s\n", crc64_impl->name);
+
     benchmark_t cpubench = {
         .seed = seed,
     };
@@ -150,31 +262,84 @@ int main(int argc, char *argv[]) {
     }
 
     // multi-thread
-    long cpucount = sysconf(_SC_NPROCESSORS_ONLN);
-    double totalspeed = 0;
+    topology_t topology;
+
+    if(!topology_probe(&topology))
+        diep("topology");
+
+    printf("[+] topology: %lu cpus, %lu physical cores, %lu threads per core, %lu packages, %lu numa nodes\n",
+            topology.count, topology.cores, topology.smt, topology.packages, topology.nodes);
 
-    printf("[+] testing multi-threads (%ld threads)\n", cpucount);
+    size_t counts[CPU_SETSIZE];
+    size_t points = scaling_points(&topology, counts);
+    run_t runs[CPU_SETSIZE];
+    run_t *physical = NULL;
 
-    #pragma omp parallel for num_threads(cpucount)
-    for(long a = 0; a < cpucount; a++) {
-        benchmark_t cpubench = {
-            .seed = seed,
-        };
+    printf("[+] scaling curve: %lu runs, %.1f seconds window each\n", points, window);
 
-        benchmark(&cpubench);
+    // every run needs exactly the threads it asks for
+    omp_set_dynamic(0);
 
-        printf("[+] seed 0x%lx: 0x%lx\n", cpubench.seed, cpubench.final);
+    for(size_t i = 0; i < points; i++) {
+        run_t *run = &runs[i];
 
-        double timed = time_spent(&cpubench.time_end) - time_spent(&cpubench.time_begin);
-        double cspeed = speed(cpubench.length, timed);
+        if(!(run->scores = calloc(sizeof(double), counts[i])))
+            diep("calloc");
 
-        #pragma omp atomic
-        totalspeed += cspeed;
+        run->threads = counts[i];
+        benchmark_window(&topology, run, seed, window);
 
-        // printf("\r[+] single thread score: %.0f MB/s\n", cspeed);
+        if(run->threads == topology.cores)
+            physical = run;
+
+        double single = runs[0].total;
+        double efficiency = run->total / (single * run->threads);
+
+        printf("[+] %4lu threads %-9s score: %10.0f  [%5.2fx, %3.0f %% per thread]\n", run->threads,
+                run->threads > topology.cores ? "(+ smt)" : "(cores)", run->total, run->total / single, efficiency * 100);
     }
 
-    printf("\r[+] multi-threads score: %.0f\n", totalspeed);
+    // every physical core loaded at once: throttled or busy cores
+    // stand out against the others
+    if(physical) {
+        double *sorted = malloc(sizeof(double) * physical->threads);
+        memcpy(sorted, physical->scores, sizeof(double) * physical->threads);
+        qsort(sorted, physical->threads, sizeof(double), score_compare);
+
+        double median = sorted[physical->threads / 2];
+
+        printf("[+] per-core scores (%lu cores loaded): min %.0f, median %.0f, max %.0f\n",
+                physical->threads, sorted[0], median, sorted[physical->threads - 1]);
+
+        for(size_t i = 0; i < physical->threads; i++) {
+            cpu_t *cpu = &topology.cpus[i];
+            int slow = physical->scores[i] < median * CORE_SLOW_RATIO;
+
+            if(slow)
+                printf("[-] cpu %3d (package %d, core %3d, node %d): " COLOR_RED "%10.0f" COLOR_RESET " (slow core, throttled or busy)\n",
+                        cpu->id, cpu->package, cpu->core, cpu->node, physical->scores[i]);
+            else
+                printf("[+] cpu %3d (package %d, core %3d, node %d): %10.0f\n", cpu->id, cpu->package, cpu->core, cpu->node, physical->scores[i]);
+        }
+
+        free(sorted);
+    }
+
+    run_t *all = &runs[points - 1];
+
+    if(physical && all != physical)
+        printf("[+] smt gain: %+.0f %% over physical cores only\n", ((all->total / physical->total) - 1) * 100);
+
+    if(physical && physical->total < runs[0].total * physical->threads * CORE_SLOW_RATIO)
+        printf("[-] " COLOR_YELLOW "physical cores don't scale (%.0f %% per core), host throttled or oversubscribed" COLOR_RESET "\n",
+                (physical->total / (runs[0].total * physical->threads)) * 100);
+
+    printf("[+] multi-threads score: %.0f\n", all->total);
+
+    for(size_t i = 0; i < points; i++)
+        free(runs[i].scores);
+
+    topology_free(&topology);
 
     return 0;
 }
@@ -1,7 +1,37 @@
 #ifndef CPUBENCH_H
     #define CPUBENCH_H
 
-    uint64_t crc64(const uint8_t *data, size_t length);
+    #include <stddef.h>
+
+    //
+    // cpu topology, from sysfs, limited to the cpus we are allowed
+    // to run on. cpus are ordered the way threads are added: one per
+    // physical core first (spread over numa nodes), smt siblings after
+    //
+    #define TOPOLOGY_SYSFS  "/sys/devices/system"
+
+    typedef struct cpu_t {
+        int id;
+        int core;      // core_id, unique within a package
+        int package;
+        int node;      // numa
+        int sibling;   // 0 for the first thread of its core
+
+    } cpu_t;
+
+    typedef struct topology_t {
+        cpu_t *cpus;
+        size_t count;
+        size_t cores;     // physical, the first cpus of the list
+        size_t packages;
+        size_t nodes;
+        size_t smt;       // threads per core, at most
+
+    } topology_t;
+
+    int topology_probe(topology_t *topology);
+    int topology_pin(cpu_t *cpu);
+    void topology_free(topology_t *topology);
 
     #define MB(x)   (x / (1024 * 1024.0))
     #define GB(x)   (x / (1024 * 1024 * 1024.0))
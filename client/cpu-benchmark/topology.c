@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include "cpubench.h"
+
+//
+// cpu topology
+//
+// sysfs describes every cpu: its core and package, the threads
+// sharing the core (smt siblings), and which numa node it belongs to.
+// anything missing (old kernels, restricted containers) falls back
+// to one core per cpu on a single node
+//
+static int sysfs_read(char *path, char *buffer, size_t length) {
+    FILE *fp;
+
+    if(!(fp = fopen(path, "r")))
+        return 0;
+
+    if(!fgets(buffer, length, fp)) {
+        fclose(fp);
+        return 0;
+    }
+
+    fclose(fp);
+    buffer[strcspn(buffer, "\n")] = '\0';
+
+    return 1;
+}
+
+static int sysfs_integer(char *path, int fallback) {
+    char buffer[64];
+
+    if(!sysfs_read(path, buffer, sizeof(buffer)))
+        return fallback;
+
+    return atoi(buffer);
+}
+
+// "0-3,8,10-11" cpu lists, into a cpu set
+static void cpulist_parse(char *list, cpu_set_t *set) {
+    char *token = list;
+
+    CPU_ZERO(set);
+
+    while(*token) {
+        char *end;
+        long first = strtol(token, &end, 10);
+        long last = first;
+
+        if(end == token)
+            break;
+
+        if(*end == '-')
+            last = strtol(end + 1, &end, 10);
+
+        for(long id = first; id <= last && id < CPU_SETSIZE; id++)
+            CPU_SET(id, set);
+
+        token = (*end == ',') ? end + 1 : end;
+    }
+}
+
+// threads are added core after core, round robin over the numa
+// nodes, then the same way over the siblings
+static size_t *topology_ranks;
+
+static int topology_compare(const void *a, const void *b) {
+    const cpu_t *x = a;
+    const cpu_t *y = b;
+
+    if(x->sibling != y->sibling)
+        return x->sibling - y->sibling;
+
+    if(topology_ranks[x->id] != topology_ranks[y->id])
+        return topology_ranks[x->id] < topology_ranks[y->id] ? -1 : 1;
+
+    if(x->node != y->node)
+        return x->node - y->node;
+
+    return x->id - y->id;
+}
+
+int topology_probe(topology_t *topology) {
+    cpu_set_t allowed, online, siblings, nodes;
+    size_t perlevel[CPU_SETSIZE] = {0};
+    size_t ranks[CPU_SETSIZE];
+    char path[512], buffer[4096];
+
+    memset(topology, 0, sizeof(topology_t));
+
+    if(sysfs_read(TOPOLOGY_SYSFS "/cpu/online", buffer, sizeof(buffer))) {
+        cpulist_parse(buffer, &online);
+
+    } else {
+        CPU_ZERO(&online);
+
+        for(long id = 0; id < sysconf(_SC_NPROCESSORS_ONLN) && id < CPU_SETSIZE; id++)
+            CPU_SET(id, &online);
+    }
+
+    // cpuset of a container, taskset, ...
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+        CPU_AND(&online, &online, &allowed);
+
+    if(!(topology->cpus = calloc(sizeof(cpu_t), CPU_COUNT(&online))))
+        return 0;
+
+    for(int id = 0; id < CPU_SETSIZE; id++) {
+        if(!CPU_ISSET(id, &online))
+            continue;
+
+        cpu_t *cpu = &topology->cpus[topology->count++];
+
+        cpu->id = id;
+
+        sprintf(path, TOPOLOGY_SYSFS "/cpu/cpu%d/topology/core_id", id);
+        cpu->core = sysfs_integer(path, id);
+
+        sprintf(path, TOPOLOGY_SYSFS "/cpu/cpu%d/topology/physical_package_id", id);
+        cpu->package = sysfs_integer(path, 0);
+
+        // position among the siblings we can use
+        sprintf(path, TOPOLOGY_SYSFS "/cpu/cpu%d/topology/thread_siblings_list", id);
+
+        if(sysfs_read(path, buffer, sizeof(buffer))) {
+            cpulist_parse(buffer, &siblings);
+
+            for(int other = 0; other < id; other++)
+                if(CPU_ISSET(other, &siblings) && CPU_ISSET(other, &online))
+                    cpu->sibling += 1;
+        }
+
+        if(cpu->sibling == 0)
+            topology->cores += 1;
+
+        if((size_t) cpu->sibling + 1 > topology->smt)
+            topology->smt = cpu->sibling + 1;
+
+        if((size_t) cpu->package + 1 > topology->packages)
+            topology->packages = cpu->package + 1;
+    }
+
+    // numa nodes list their cpus
+    if(sysfs_read(TOPOLOGY_SYSFS "/node/online", buffer, sizeof(buffer)))
+        cpulist_parse(buffer, &nodes);
+    else
+        CPU_ZERO(&nodes);
+
+    for(int node = 0; node < CPU_SETSIZE; node++) {
+        if(!CPU_ISSET(node, &nodes))
+            continue;
+
+        sprintf(path, TOPOLOGY_SYSFS "/node/node%d/cpulist", node);
+
+        if(!sysfs_read(path, buffer, sizeof(buffer)))
+            continue;
+
+        cpulist_parse(buffer, &siblings);
+
+        for(size_t i = 0; i < topology->count; i++)
+            if(CPU_ISSET(topology->cpus[i].id, &siblings))
+                topology->cpus[i].node = node;
+
+        topology->nodes = node + 1;
+    }
+
+    if(topology->nodes == 0)
+        topology->nodes = 1;
+
+    // rank of each cpu among the ones of its node, at its sibling level
+    for(size_t i = 0; i < topology->count; i++) {
+        cpu_t *cpu = &topology->cpus[i];
+        size_t level = (cpu->node * topology->smt) + cpu->sibling;
+
+        ranks[cpu->id] = perlevel[level % CPU_SETSIZE]++;
+    }
+
+    topology_ranks = ranks;
+    qsort(topology->cpus, topology->count, sizeof(cpu_t), topology_compare);
+    topology_ranks = NULL;
+
+    return topology->count > 0;
+}
+
+// calling thread only runs on 'cpu' from now on
+int topology_pin(cpu_t *cpu) {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu->id, &set);
+
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+void topology_free(topology_t *topology) {
+    free(topology->cpus);
+}
@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include "uring.h"
+#include "storage.h"
+
+//
+// device write engines
+//
+// uring: O_DIRECT writes from registered buffers on a registered file,
+//        up to 'depth' requests in flight
+//
+// sync:  pwritev, when io_uring is not available. without O_DIRECT,
+//        writeback of each chunk is started right away and pages of
+//        the previous one are dropped once on disk, so the build never
+//        fills the page cache with dirty pages
+//
+// with O_DIRECT, the unaligned end of a write (last chunk of a device
+// whose size is not a multiple of the sector) goes through the page
+// cache on a second descriptor
+//
+#define ENGINE_HUGEPAGE  (2 * 1024 * 1024)
+
+static size_t align_up(size_t value, size_t alignment) {
+    return ((value + alignment - 1) / alignment) * alignment;
+}
+
+// one contiguous area split in 'count' buffers, hugepages backed
+// if requested (and available), page aligned otherwise
+static int engine_buffers(engine_t *engine, size_t count, size_t length, int hugepages) {
+    size_t total = align_up(count * length, ENGINE_HUGEPAGE);
+    char *area = MAP_FAILED;
+
+    if(hugepages) {
+        area = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        if(area == MAP_FAILED)
+            fprintf(stderr, "[-] hugepages not available, using regular pages\n");
+    }
+
+    if(area == MAP_FAILED) {
+        area = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if(area == MAP_FAILED)
+            return 0;
+
+        hugepages = 0;
+    }
+
+    engine->area = area;
+    engine->arealen = total;
+    engine->hugepages = hugepages;
+    engine->count = count;
+    engine->length = length;
+
+    if(!(engine->buffers = calloc(sizeof(char *), count)))
+        return 0;
+
+    for(size_t i = 0; i < count; i++)
+        engine->buffers[i] = area + (i * length);
+
+    return 1;
+}
+
+static int engine_uring_setup(engine_t *engine) {
+    struct iovec *iovecs;
+
+    if(!uring_init(&engine->ring, engine->depth))
+        return 0;
+
+    if(!(iovecs = calloc(sizeof(struct iovec), engine->count)))
+        return 0;
+
+    for(size_t i = 0; i < engine->count; i++) {
+        iovecs[i].iov_base = engine->buffers[i];
+        iovecs[i].iov_len = engine->length;
+    }
+
+    // both are optimizations only, plain requests work without
+    engine->fixedbuf = uring_register_buffers(&engine->ring, iovecs, engine->count);
+    engine->fixedfile = uring_register_files(&engine->ring, &engine->fd, 1);
+
+    if(!engine->fixedbuf)
+        fprintf(stderr, "[-] io_uring: could not register buffers (memlock limit?)\n");
+
+    free(iovecs);
+
+    return 1;
+}
+
+int engine_open(engine_t *engine, char *target, int kind, size_t depth, size_t count, size_t length, int hugepages) {
+    memset(engine, 0, sizeof(engine_t));
+
+    engine->kind = kind;
+    engine->depth = depth;
+    engine->direct = 1;
+    engine->alignment = 4096;
+    engine->tailfd = -1;
+
+    if((engine->fd = open(target, O_RDWR | O_DIRECT)) < 0) {
+        // some filesystems (tmpfs, ...) refuse direct access
+        if(errno != EINVAL)
+            return 0;
+
+        fprintf(stderr, "[-] O_DIRECT not supported by target, using page cache\n");
+
+        if((engine->fd = open(target, O_RDWR)) < 0)
+            return 0;
+
+        engine->direct = 0;
+    }
+
+    if(engine->direct && (engine->tailfd = open(target, O_RDWR)) < 0)
+        return 0;
+
+    if(!engine_buffers(engine, count, length, hugepages))
+        return 0;
+
+    if(engine->kind == ENGINE_AUTO || engine->kind == ENGINE_URING) {
+        if(engine_uring_setup(engine)) {
+            engine->kind = ENGINE_URING;
+            return 1;
+        }
+
+        if(engine->kind == ENGINE_URING) {
+            fprintf(stderr, "[-] io_uring not available\n");
+            return 0;
+        }
+    }
+
+    engine->kind = ENGINE_SYNC;
+    engine->depth = 1;
+
+    return 1;
+}
+
+const char *engine_name(engine_t *engine) {
+    return engine->kind == ENGINE_URING ? "io_uring" : "pwritev";
+}
+
+static int engine_sync_write(engine_t *engine, size_t slot, size_t length, off_t offset) {
+    struct iovec iov = {
+        .iov_base = engine->buffers[slot],
+        .iov_len = length,
+    };
+
+    if(pwritev(engine->fd, &iov, 1, offset) != (ssize_t) length)
+        return 0;
+
+    if(!engine->direct) {
+        // start writeback of this chunk, then wait for the previous
+        // one (usually already done) and drop it from the cache
+        sync_file_range(engine->fd, offset, length, SYNC_FILE_RANGE_WRITE);
+
+        if(engine->written) {
+            off_t previous = engine->lastoffset;
+            size_t prevlen = engine->lastlength;
+
+            sync_file_range(engine->fd, previous, prevlen, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(engine->fd, previous, prevlen, POSIX_FADV_DONTNEED);
+        }
+
+        engine->lastoffset = offset;
+        engine->lastlength = length;
+        engine->written = 1;
+    }
+
+    // completed right away
+    engine->done = slot;
+
+    return 1;
+}
+
+// one read or write request on a registered buffer (when possible)
+static int engine_uring_request(engine_t *engine, int opcode, int fixed, size_t slot, size_t length, off_t offset) {
+    struct io_uring_sqe *sqe = uring_sqe(&engine->ring);
+
+    if(!sqe)
+        return 0;
+
+    // nothing left once the tail is done, completion is still expected
+    if(length == 0) {
+        sqe->opcode = IORING_OP_NOP;
+        sqe->user_data = slot << 32;
+        return uring_submit(&engine->ring, 0) >= 0;
+    }
+
+    sqe->opcode = engine->fixedbuf ? fixed : opcode;
+    sqe->fd = engine->fixedfile ? 0 : engine->fd;
+    sqe->flags = engine->fixedfile ? IOSQE_FIXED_FILE : 0;
+    sqe->addr = (uintptr_t) engine->buffers[slot];
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->buf_index = engine->fixedbuf ? slot : 0;
+    sqe->user_data = (slot << 32) | length;
+
+    return uring_submit(&engine->ring, 0) >= 0;
+}
+
+// queue a buffer write, the slot must not be reused before reaped
+int engine_write(engine_t *engine, size_t slot, size_t length, off_t offset) {
+    size_t tail = engine->direct ? length % engine->alignment : 0;
+
+    if(tail) {
+        length -= tail;
+
+        if(pwrite(engine->tailfd, engine->buffers[slot] + length, tail, offset + length) != (ssize_t) tail)
+            return 0;
+    }
+
+    if(engine->kind == ENGINE_URING)
+        return engine_uring_request(engine, IORING_OP_WRITE, IORING_OP_WRITE_FIXED, slot, length, offset);
+
+    return engine_sync_write(engine, slot, length, offset);
+}
+
+static int engine_sync_read(engine_t *engine, size_t slot, size_t length, off_t offset) {
+    struct iovec iov = {
+        .iov_base = engine->buffers[slot],
+        .iov_len = length,
+    };
+
+    if(preadv(engine->fd, &iov, 1, offset) != (ssize_t) length)
+        return 0;
+
+    engine->done = slot;
+
+    return 1;
+}
+
+// queue a buffer read, completions are reaped like writes
+int engine_read(engine_t *engine, size_t slot, size_t length, off_t offset) {
+    size_t tail = engine->direct ? length % engine->alignment : 0;
+
+    if(tail) {
+        length -= tail;
+
+        if(pread(engine->tailfd, engine->buffers[slot] + length, tail, offset + length) != (ssize_t) tail)
+            return 0;
+    }
+
+    if(engine->kind == ENGINE_URING)
+        return engine_uring_request(engine, IORING_OP_READ, IORING_OP_READ_FIXED, slot, length, offset);
+
+    return engine_sync_read(engine, slot, length, offset);
+}
+
+// wait for one request to complete, returns 1 and its slot on success,
+// 0 on failure (or short transfer)
+int engine_reap(engine_t *engine, size_t *slot) {
+    if(engine->kind == ENGINE_SYNC) {
+        *slot = engine->done;
+        return 1;
+    }
+
+    uint64_t userdata;
+    int32_t result;
+
+    if(uring_reap(&engine->ring, &userdata, &result, 1) <= 0)
+        return 0;
+
+    *slot = userdata >> 32;
+
+    if(result != (int32_t)(userdata & 0xffffffff)) {
+        errno = result < 0 ? -result : EIO;
+        return 0;
+    }
+
+    return 1;
+}
+
+// flush everything to stable storage
+int engine_sync(engine_t *engine) {
+    if(engine->tailfd >= 0 && fdatasync(engine->tailfd) != 0)
+        return 0;
+
+    return fdatasync(engine->fd) == 0;
+}
+
+void engine_close(engine_t *engine) {
+    if(engine->kind == ENGINE_URING)
+        uring_free(&engine->ring);
+
+    if(engine->area)
+        munmap(engine->area, engine->arealen);
+
+    free(engine->buffers);
+
+    if(engine->fd >= 0)
+        close(engine->fd);
+
+    if(engine->tailfd >= 0)
+        close(engine->tailfd);
+}
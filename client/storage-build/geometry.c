@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <sys/time.h>
+#include "storage.h"
+
+//
+// device geometry and chunk size calibration
+//
+// block devices report their sector sizes and preferred i/o sizes,
+// regular files (debug) only have their length and filesystem block.
+// chunk sizes are always a multiple of the physical sector, of the
+// minimum i/o size and of the optimal i/o size when one is reported
+//
+#define GEOMETRY_PAGE       4096
+#define CALIBRATE_LENGTH    (128 * 1024 * 1024)
+#define CALIBRATE_MIN       (1024 * 1024)
+#define CALIBRATE_MAX       (32 * 1024 * 1024)
+
+static double time_now() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    return now.tv_sec + (now.tv_usec / 1000000.0);
+}
+
+static size_t align_up(size_t value, size_t alignment) {
+    return ((value + alignment - 1) / alignment) * alignment;
+}
+
+int geometry_probe(int fd, geometry_t *geometry) {
+    struct stat sb;
+
+    memset(geometry, 0, sizeof(geometry_t));
+
+    if(fstat(fd, &sb) < 0)
+        return 0;
+
+    if(S_ISBLK(sb.st_mode)) {
+        uint64_t size;
+        int logical = 0;
+        unsigned int physical = 0, iomin = 0, ioopt = 0;
+
+        if(ioctl(fd, BLKGETSIZE64, &size) < 0)
+            return 0;
+
+        // older kernels or odd drivers can miss some of them
+        ioctl(fd, BLKSSZGET, &logical);
+        ioctl(fd, BLKPBSZGET, &physical);
+        ioctl(fd, BLKIOMIN, &iomin);
+        ioctl(fd, BLKIOOPT, &ioopt);
+
+        geometry->blockdev = 1;
+        geometry->size = size;
+        geometry->logical = logical > 0 ? logical : 512;
+        geometry->physical = physical ? physical : geometry->logical;
+        geometry->iomin = iomin;
+        geometry->ioopt = ioopt;
+
+    } else {
+        geometry->size = sb.st_size;
+        geometry->logical = GEOMETRY_PAGE;
+        geometry->physical = sb.st_blksize > 0 ? (size_t) sb.st_blksize : GEOMETRY_PAGE;
+    }
+
+    // buffers are page aligned anyway, keeping chunks a multiple
+    // of a page keeps every buffer of the ring aligned as well
+    geometry->alignment = GEOMETRY_PAGE;
+
+    if(geometry->physical > geometry->alignment)
+        geometry->alignment = geometry->physical;
+
+    if(geometry->iomin > geometry->alignment)
+        geometry->alignment = align_up(geometry->iomin, geometry->alignment);
+
+    return 1;
+}
+
+// nearest valid chunk size not smaller than 'length'
+size_t geometry_chunk(geometry_t *geometry, size_t length) {
+    size_t chunk = align_up(length, geometry->alignment);
+
+    if(geometry->ioopt && geometry->ioopt % geometry->alignment == 0)
+        chunk = align_up(chunk, geometry->ioopt);
+
+    return chunk;
+}
+
+// largest chunk size calibration can pick on this device
+size_t geometry_chunk_max(geometry_t *geometry) {
+    return geometry_chunk(geometry, CALIBRATE_MAX);
+}
+
+//
+// write the first CALIBRATE_LENGTH bytes of the device with each
+// candidate chunk size (the real chain content, nothing is lost even
+// when resuming) and keep the fastest one. a bigger chunk needs to be
+// at least 5% faster to be chosen, no need to waste memory otherwise
+//
+size_t geometry_calibrate(geometry_t *geometry, char *target, int kind, size_t depth, uint64_t seed) {
+    size_t length = CALIBRATE_LENGTH;
+    size_t best = 0;
+    size_t previous = 0;
+    double bestspeed = 0;
+    uint64_t *chain;
+
+    if(geometry->size < length * 2)
+        return 0;
+
+    if(!(chain = malloc(length)))
+        return 0;
+
+    for(size_t i = 0; i < length / sizeof(uint64_t); i++) {
+        chain[i] = seed;
+        seed = crc64_u64(seed);
+    }
+
+    for(size_t candidate = CALIBRATE_MIN; candidate <= CALIBRATE_MAX; candidate *= 2) {
+        size_t chunk = geometry_chunk(geometry, candidate);
+        size_t chunks = length / chunk;
+        size_t submitted = 0, inflight = 0, slot;
+        size_t *available, unused;
+        engine_t engine;
+        int failed = 0;
+
+        // same size after alignment
+        if(chunks < 2 || chunk == previous)
+            continue;
+
+        previous = chunk;
+
+        if(!engine_open(&engine, target, kind, depth, depth, chunk, 0)) {
+            engine_close(&engine);
+            break;
+        }
+
+        // completions come in any order, slots are reused as they come back
+        if(!(available = calloc(sizeof(size_t), engine.count))) {
+            engine_close(&engine);
+            break;
+        }
+
+        for(unused = 0; unused < engine.count; unused++)
+            available[unused] = unused;
+
+        double begin = time_now();
+
+        while(submitted < chunks || inflight) {
+            if(submitted < chunks && inflight < engine.depth && unused) {
+                slot = available[--unused];
+
+                memcpy(engine.buffers[slot], (char *) chain + (submitted * chunk), chunk);
+
+                if(!engine_write(&engine, slot, chunk, submitted * chunk)) {
+                    failed = 1;
+                    break;
+                }
+
+                submitted += 1;
+                inflight += 1;
+                continue;
+            }
+
+            if(!engine_reap(&engine, &slot)) {
+                failed = 1;
+                break;
+            }
+
+            available[unused++] = slot;
+            inflight -= 1;
+        }
+
+        // requests still in flight reference the buffers
+        for(; inflight; inflight--)
+            engine_reap(&engine, &slot);
+
+        if(!failed)
+            failed = !engine_sync(&engine);
+
+        double speed = (chunks * chunk) / (time_now() - begin);
+
+        engine_close(&engine);
+        free(available);
+
+        if(failed)
+            break;
+
+        printf("[+] calibration: %5.1f MB chunks: %.0f MB/s\n", MB(chunk), MB(speed));
+
+        if(speed > bestspeed * 1.05) {
+            bestspeed = speed;
+            best = chunk;
+        }
+    }
+
+    free(chain);
+
+    return best;
+}
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "crc64.h"
+#include "storage.h"
+
+//
+// pipelined device build
+//
+// compute workers fill a ring of preallocated chunks with the chain
+// while the writer (calling thread) drains them to the device. workers
+// wait when every chunk is full (device is the bottleneck), the writer
+// waits when every chunk is empty (chain is the bottleneck), both
+// waits are accounted separately
+//
+// with N workers, worker w computes chunks w, w + N, w + 2N, ... its
+// first value is reached by jumping ahead in the chain, then it jumps
+// over the (N - 1) chunks computed by the others after each chunk.
+// chunks are handed to the writer in order, the device is still
+// written sequentially
+//
+static double time_now() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    return now.tv_sec + (now.tv_usec / 1000000.0);
+}
+
+// every chunk is full but the last one, which holds the tail
+static size_t pipeline_chunk_length(pipeline_t *pipeline, size_t index) {
+    size_t remaining = (pipeline->size - pipeline->offset) - (index * pipeline->chunksize);
+
+    return remaining < pipeline->chunksize ? remaining : pipeline->chunksize;
+}
+
+static void *pipeline_compute(void *args) {
+    pipeline_worker_t *worker = args;
+    pipeline_t *pipeline = worker->pipeline;
+    size_t chunkvalues = pipeline->chunksize / sizeof(uint64_t);
+    uint64_t seed = crc64_jump(pipeline->seed, worker->id * chunkvalues);
+
+    for(size_t index = worker->id; index < pipeline->chunks; index += pipeline->workers) {
+        double begin = time_now();
+
+        pthread_mutex_lock(&pipeline->lock);
+
+        while(index - pipeline->consumed >= pipeline->slots && !pipeline->failed)
+            pthread_cond_wait(&pipeline->drained, &pipeline->lock);
+
+        int failed = pipeline->failed;
+
+        pthread_mutex_unlock(&pipeline->lock);
+
+        worker->stall += time_now() - begin;
+
+        if(failed)
+            break;
+
+        uint64_t *buffer = (uint64_t *) pipeline->ring[index % pipeline->slots];
+        size_t values = pipeline_chunk_length(pipeline, index) / sizeof(uint64_t);
+
+        if(pipeline->tokens)
+            while(sem_wait(pipeline->tokens) < 0);
+
+        for(size_t i = 0; i < values; i++) {
+            buffer[i] = seed;
+            seed = crc64_u64(seed);
+        }
+
+        if(pipeline->tokens)
+            sem_post(pipeline->tokens);
+
+        seed = crc64_affine_apply(&pipeline->stride, seed);
+
+        // publish every contiguous chunk ready from the writer position
+        pthread_mutex_lock(&pipeline->lock);
+
+        pipeline->ready[index % pipeline->slots] = 1;
+
+        while(pipeline->produced < pipeline->chunks && pipeline->ready[pipeline->produced % pipeline->slots]) {
+            pipeline->ready[pipeline->produced % pipeline->slots] = 0;
+            pipeline->produced += 1;
+        }
+
+        pthread_cond_signal(&pipeline->filled);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+
+    return NULL;
+}
+
+// build [offset, size) of the device, 'seed' being the chain
+// value expected at 'offset' (chunk aligned)
+int pipeline_init(pipeline_t *pipeline, engine_t *engine, size_t workers, uint64_t seed, size_t offset, size_t size) {
+    memset(pipeline, 0, sizeof(pipeline_t));
+
+    pipeline->engine = engine;
+    pipeline->seed = seed;
+    pipeline->size = size;
+    pipeline->offset = offset;
+    pipeline->ring = engine->buffers;
+    pipeline->slots = engine->count;
+    pipeline->chunksize = engine->length;
+    pipeline->chunks = ((size - offset) + engine->length - 1) / engine->length;
+    pipeline->workers = workers;
+
+    if(!(pipeline->completed = calloc(sizeof(int), pipeline->slots)))
+        return 0;
+
+    if(!(pipeline->ready = calloc(sizeof(int), pipeline->slots)))
+        return 0;
+
+    if(!(pipeline->threads = calloc(sizeof(pipeline_worker_t), workers)))
+        return 0;
+
+    // chunks computed by the other workers, skipped after each chunk
+    crc64_affine_steps(&pipeline->stride, (workers - 1) * (pipeline->chunksize / sizeof(uint64_t)));
+
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->filled, NULL);
+    pthread_cond_init(&pipeline->drained, NULL);
+
+    return 1;
+}
+
+void pipeline_free(pipeline_t *pipeline) {
+    free(pipeline->completed);
+    free(pipeline->ready);
+    free(pipeline->threads);
+
+    pthread_mutex_destroy(&pipeline->lock);
+    pthread_cond_destroy(&pipeline->filled);
+    pthread_cond_destroy(&pipeline->drained);
+}
+
+static void pipeline_fail(pipeline_t *pipeline) {
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->failed = 1;
+    pthread_cond_broadcast(&pipeline->drained);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+// run the whole build, returns 0 on write failure. progress is
+// published in 'written' (chunks) for the caller to report. chunks are
+// submitted as soon as computed (up to engine depth in flight),
+// completions can come in any order but slots are handed back
+// to the workers in ring order
+int pipeline_run(pipeline_t *pipeline) {
+    engine_t *engine = pipeline->engine;
+    double begin = time_now();
+    size_t submitted = 0;
+    size_t inflight = 0;
+    size_t written = 0;
+    size_t started;
+
+    for(started = 0; started < pipeline->workers; started++) {
+        pipeline_worker_t *worker = &pipeline->threads[started];
+
+        worker->pipeline = pipeline;
+        worker->id = started;
+
+        if(pthread_create(&worker->thread, NULL, pipeline_compute, worker)) {
+            perror("pthread_create");
+            pipeline_fail(pipeline);
+            break;
+        }
+    }
+
+    while(written < pipeline->chunks && !pipeline->failed) {
+        pthread_mutex_lock(&pipeline->lock);
+        size_t produced = pipeline->produced;
+        pthread_mutex_unlock(&pipeline->lock);
+
+        if(submitted < produced && inflight < engine->depth) {
+            size_t slot = submitted % pipeline->slots;
+
+            size_t length = pipeline_chunk_length(pipeline, submitted);
+
+            if(!engine_write(engine, slot, length, pipeline->offset + (submitted * pipeline->chunksize))) {
+                perror("write");
+                pipeline_fail(pipeline);
+                break;
+            }
+
+            submitted += 1;
+            inflight += 1;
+            continue;
+        }
+
+        if(inflight) {
+            size_t slot;
+
+            if(!engine_reap(engine, &slot)) {
+                perror("write");
+                pipeline_fail(pipeline);
+                break;
+            }
+
+            inflight -= 1;
+            written += 1;
+
+            pthread_mutex_lock(&pipeline->lock);
+
+            pipeline->completed[slot] = 1;
+            pipeline->written = written;
+
+            while(pipeline->consumed < submitted && pipeline->completed[pipeline->consumed % pipeline->slots]) {
+                pipeline->completed[pipeline->consumed % pipeline->slots] = 0;
+                pipeline->consumed += 1;
+            }
+
+            pthread_cond_broadcast(&pipeline->drained);
+            pthread_mutex_unlock(&pipeline->lock);
+
+            // bounds what a power cut can lose, see resume back-off
+            if(written % PIPELINE_SYNC_CHUNKS == 0 && !engine_sync(engine)) {
+                perror("sync");
+                pipeline_fail(pipeline);
+                break;
+            }
+
+            continue;
+        }
+
+        // nothing in flight, nothing computed: device is idle
+        double waiting = time_now();
+
+        pthread_mutex_lock(&pipeline->lock);
+
+        while(pipeline->produced == submitted)
+            pthread_cond_wait(&pipeline->filled, &pipeline->lock);
+
+        pthread_mutex_unlock(&pipeline->lock);
+
+        pipeline->write_stall += time_now() - waiting;
+    }
+
+    // requests still in flight reference our buffers
+    for(size_t slot; inflight; inflight--)
+        engine_reap(engine, &slot);
+
+    for(size_t i = 0; i < started; i++) {
+        pthread_join(pipeline->threads[i].thread, NULL);
+        pipeline->compute_stall += pipeline->threads[i].stall;
+    }
+
+    if(!pipeline->failed && !engine_sync(engine)) {
+        perror("sync");
+        pipeline->failed = 1;
+    }
+
+    pipeline->elapsed = time_now() - begin;
+
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->finished = 1;
+    pthread_mutex_unlock(&pipeline->lock);
+
+    return !pipeline->failed;
+}
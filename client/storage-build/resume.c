@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "crc64.h"
+#include "storage.h"
+
+//
+// resume an interrupted build
+//
+// the device holds a valid chain prefix followed by whatever was there
+// before. a block is valid when its first value is the one expected at
+// its position (jumping ahead from the seed) and each following value
+// is the crc64 of the previous one, so the end of the prefix is found
+// with a binary search on blocks
+//
+// writes can complete out of order (up to the queue depth), the search
+// result is moved back by 'backoff' bytes to rewrite any possible hole
+//
+#define RESUME_BLOCK  4096
+
+static int resume_block_valid(int fd, uint64_t seed, size_t block, size_t values) {
+    uint64_t buffer[RESUME_BLOCK / sizeof(uint64_t)];
+    size_t first = block * (RESUME_BLOCK / sizeof(uint64_t));
+    size_t length = RESUME_BLOCK / sizeof(uint64_t);
+
+    if(first + length > values)
+        length = values - first;
+
+    ssize_t expected = length * sizeof(uint64_t);
+
+    if(pread(fd, buffer, expected, first * sizeof(uint64_t)) != expected)
+        return 0;
+
+    if(buffer[0] != crc64_jump(seed, first))
+        return 0;
+
+    for(size_t i = 1; i < length; i++)
+        if(buffer[i] != crc64_u64(buffer[i - 1]))
+            return 0;
+
+    return 1;
+}
+
+// returns the index (in values) where writing needs to resume and
+// sets 'value' to the chain value expected at that index
+size_t resume_locate(int fd, uint64_t seed, size_t size, size_t chunksize, size_t backoff, uint64_t *value) {
+    size_t values = size / sizeof(uint64_t);
+    size_t blocks = (size + RESUME_BLOCK - 1) / RESUME_BLOCK;
+    size_t low = 0;
+    size_t high = blocks;
+
+    // find the amount of leading valid blocks
+    while(low < high) {
+        size_t middle = low + ((high - low + 1) / 2);
+
+        if(resume_block_valid(fd, seed, middle - 1, values))
+            low = middle;
+        else
+            high = middle - 1;
+    }
+
+    size_t valid = low * (RESUME_BLOCK / sizeof(uint64_t));
+
+    if(valid > values)
+        valid = values;
+
+    printf("[+] resume: chain valid up to %.2f GB (%lu values)\n", GB(valid * sizeof(uint64_t)), valid);
+
+    // restart on a chunk boundary, behind any possible hole
+    size_t resume = valid * sizeof(uint64_t);
+    resume = resume > backoff ? resume - backoff : 0;
+    resume -= resume % chunksize;
+
+    size_t index = resume / sizeof(uint64_t);
+
+    *value = crc64_jump(seed, index);
+
+    return index;
+}
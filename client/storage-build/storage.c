@@ -7,32 +7,294 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <getopt.h>
+#include "crc64.h"
 #include "storage.h"
 
 static struct option long_options[] = {
     {"disk", required_argument, 0, 'd'},
     {"seed", required_argument, 0, 's'},
+    {"buffers", required_argument, 0, 'b'},
+    {"chunk", required_argument, 0, 'c'},
+    {"engine", required_argument, 0, 'e'},
+    {"depth", required_argument, 0, 'q'},
+    {"threads", required_argument, 0, 't'},
+    {"hugepages", no_argument, 0, 'H'},
+    {"resume", no_argument, 0, 'r'},
+    {"verify", no_argument, 0, 'v'},
     {"help", no_argument,       0, 'h'},
     {0, 0, 0, 0}
 };
 
+#define BUILD_MAX_DEVICES  128
+#define BUILD_DEFAULT_CHUNK  (8 * 1024 * 1024)
+
+typedef struct device_t {
+    char *target;
+    char *seeds;
+    uint64_t origin;
+    uint64_t seed;
+    size_t fullsize;
+    size_t offset;
+
+    geometry_t geometry;
+    size_t chunksize;
+    int calibrated;
+
+    engine_t engine;
+    pipeline_t pipeline;
+    verify_t verify;
+    pthread_t thread;
+    int success;
+
+} device_t;
+
+typedef struct settings_t {
+    size_t bufsize;
+    size_t slots;
+    size_t depth;
+    size_t workers;
+    int kind;
+    int hugepages;
+    int resume;
+    int verify;
+
+} settings_t;
+
 void diep(char *str) {
     perror(str);
     exit(EXIT_FAILURE);
 }
 
-static double time_spent(struct timeval *timer) {
-    return (((size_t) timer->tv_sec * 1000000) + timer->tv_usec) / 1000000.0;
-}
-
 static double speed(size_t size, double timed) {
     return (size / timed) / (1024 * 1024);
 }
 
+static double time_now() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    return now.tv_sec + (now.tv_usec / 1000000.0);
+}
+
+static int device_seed(device_t *device) {
+    if(strlen(device->seeds) != 18 || strncmp(device->seeds, "0x", 2) != 0) {
+        fprintf(stderr, "[-] malformed seed (expected: 0x................)\n");
+        return 0;
+    }
+
+    device->seed = strtoull(device->seeds, NULL, 16);
+    device->origin = device->seed;
+
+    return 1;
+}
+
+// open the device and prepare its pipeline, exits on failure
+static void device_prepare(device_t *device, settings_t *settings) {
+    printf("[+] target device: %s\n", device->target);
+    printf("[+] parsed seed: 0x%016lx\n", device->seed);
+
+    struct stat sb;
+    if(lstat(device->target, &sb) < 0)
+        diep(device->target);
+
+    if(sb.st_mode & S_IFBLK) {
+        printf(COLOR_GREEN "[+] running on block device" COLOR_RESET "\n");
+    }
+
+    if(sb.st_mode & S_IFREG) {
+        printf(COLOR_YELLOW "[+] running on regular file (debug only)" COLOR_RESET "\n");
+    }
+
+    int fd;
+
+    // buffered read access, the engine may be using direct i/o
+    if((fd = open(device->target, O_RDONLY)) < 0)
+        diep(device->target);
+
+    geometry_t *geometry = &device->geometry;
+
+    if(!geometry_probe(fd, geometry))
+        diep(device->target);
+
+    size_t fullsize = geometry->size;
+
+    printf("[+] target size: " COLOR_GREEN "%.0f GB" COLOR_RESET " [%lu bytes]\n", GB(fullsize), fullsize);
+    printf("[+] geometry: logical %lu, physical %lu, minimum i/o %lu, optimal i/o %lu\n",
+            geometry->logical, geometry->physical, geometry->iomin, geometry->ioopt);
+
+    if(fullsize % 8 != 0) {
+        fprintf(stderr, "[-] target length not correctly aligned\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t values = fullsize / sizeof(uint64_t);
+
+    printf("[+] generating crc length: %lu\n", values);
+
+    // fixed chunk size, or the fastest one on this device
+    device->chunksize = 0;
+
+    if(settings->bufsize)
+        device->chunksize = geometry_chunk(geometry, settings->bufsize);
+
+    if(!device->chunksize) {
+        device->chunksize = geometry_calibrate(geometry, device->target, settings->kind, settings->depth, device->seed);
+        device->calibrated = (device->chunksize != 0);
+    }
+
+    if(!device->chunksize)
+        device->chunksize = geometry_chunk(geometry, BUILD_DEFAULT_CHUNK);
+
+    engine_t *engine = &device->engine;
+
+    if(!engine_open(engine, device->target, settings->kind, settings->depth, settings->slots, device->chunksize, settings->hugepages))
+        diep(device->target);
+
+    engine->alignment = geometry->logical;
+
+    device->fullsize = fullsize;
+    device->offset = 0;
+
+    if(settings->resume) {
+        // everything before the last flush is on disk. after it, the
+        // chunks written since (up to PIPELINE_SYNC_CHUNKS) and the ones
+        // in flight on both sides of it (up to ENGINE_DEPTH_MAX each) may
+        // be missing behind the last valid position. the interrupted run
+        // may have used another depth or calibrated (or defaulted to)
+        // another chunk size, back off by the largest ones it could use
+        size_t inflight = geometry_chunk_max(geometry);
+
+        if(inflight < geometry_chunk(geometry, BUILD_DEFAULT_CHUNK))
+            inflight = geometry_chunk(geometry, BUILD_DEFAULT_CHUNK);
+
+        if(inflight < device->chunksize)
+            inflight = device->chunksize;
+
+        device->offset = resume_locate(fd, device->seed, fullsize, device->chunksize, (PIPELINE_SYNC_CHUNKS + 2 * ENGINE_DEPTH_MAX) * inflight, &device->seed) * sizeof(uint64_t);
+
+        printf("[+] resume: skipping " COLOR_GREEN "%.2f GB" COLOR_RESET " [%lu bytes], next value 0x%016lx\n", GB(device->offset), device->offset, device->seed);
+    }
+
+    close(fd);
+
+    printf("[+] write engine: %s, queue depth %lu, %s%s\n", engine_name(engine), engine->depth,
+            engine->direct ? "direct i/o" : "page cache", engine->fixedbuf ? ", registered buffers" : "");
+    printf("[+] pipeline: %lu buffers of %.1f MB%s, %lu compute workers\n", settings->slots, MB(device->chunksize),
+            engine->hugepages ? " (hugepages)" : "", settings->workers);
+
+    if(!pipeline_init(&device->pipeline, engine, settings->workers, device->seed, device->offset, fullsize))
+        diep("pipeline");
+}
+
+static void *device_build(void *args) {
+    device_t *device = args;
+
+    device->success = pipeline_run(&device->pipeline);
+
+    return NULL;
+}
+
+// bytes written so far on one device, 'finished' set when done
+static size_t device_progress(device_t *device, int *finished) {
+    pipeline_t *pipeline = &device->pipeline;
+
+    pthread_mutex_lock(&pipeline->lock);
+    size_t written = pipeline->written;
+    *finished = pipeline->finished;
+    pthread_mutex_unlock(&pipeline->lock);
+
+    // last chunk can be partial
+    written *= pipeline->chunksize;
+
+    return written < device->fullsize - device->offset ? written : device->fullsize - device->offset;
+}
+
+static void *device_verify(void *args) {
+    device_t *device = args;
+
+    device->success = verify_run(&device->verify);
+
+    return NULL;
+}
+
+// bytes verified so far on one device, 'finished' set when done
+static size_t device_verified(device_t *device, int *finished) {
+    verify_t *verify = &device->verify;
+
+    pthread_mutex_lock(&verify->lock);
+    size_t checked = verify->released;
+    *finished = verify->finished;
+    pthread_mutex_unlock(&verify->lock);
+
+    checked *= verify->chunksize;
+
+    return checked < device->fullsize ? checked : device->fullsize;
+}
+
+// one progress line for all devices, until every device is done
+static double devices_monitor(device_t *devices, size_t targets, size_t total, char *stage, size_t (*progress)(device_t *, int *)) {
+    double begin = time_now();
+    double last = begin;
+    size_t previous = 0;
+
+    printf("[+] %s: initializing...", stage);
+    fflush(stdout);
+
+    while(1) {
+        size_t current = 0;
+        size_t finished = 0;
+
+        usleep(250000);
+
+        for(size_t i = 0; i < targets; i++) {
+            int done;
+
+            current += progress(&devices[i], &done);
+            finished += done;
+        }
+
+        double now = time_now();
+        double percent = total ? (current / (double) total) * 100 : 100;
+        size_t delta = current - previous;
+
+        printf("\r[+] %s: %.2f %% [%.0f MB/s]", stage, percent, MB(delta) / (now - last));
+
+        if(targets > 1)
+            printf(", %lu/%lu devices done", finished, targets);
+
+        printf("\033[0K");
+        fflush(stdout);
+
+        previous = current;
+        last = now;
+
+        if(finished == targets)
+            break;
+    }
+
+    printf("\n");
+
+    return time_now() - begin;
+}
+
 int main(int argc, char *argv[]) {
     int option_index = 0;
-    char *target = NULL;
-    char *seeds = NULL;
+    device_t devices[BUILD_MAX_DEVICES];
+    size_t targets = 0;
+    size_t seeded = 0;
+    size_t threads = 0;
+
+    settings_t settings = {
+        .bufsize = 0,
+        .slots = 0,
+        .depth = 4,
+        .workers = 1,
+        .kind = ENGINE_AUTO,
+        .hugepages = 0,
+        .resume = 0,
+    };
+
+    memset(devices, 0, sizeof(devices));
 
     printf(COLOR_CYAN "[+] initializing storage-proof client" COLOR_RESET "\n");
 
@@ -44,15 +306,79 @@ int main(int argc, char *argv[]) {
 
         switch(i) {
             case 'd':
-                target = optarg;
+                if(targets == BUILD_MAX_DEVICES) {
+                    fprintf(stderr, "[-] too many devices (max %d)\n", BUILD_MAX_DEVICES);
+                    return 1;
+                }
+
+                devices[targets++].target = optarg;
                 break;
 
             case 's':
-                seeds = optarg;
+                if(seeded == BUILD_MAX_DEVICES) {
+                    fprintf(stderr, "[-] too many seeds (max %d)\n", BUILD_MAX_DEVICES);
+                    return 1;
+                }
+
+                devices[seeded++].seeds = optarg;
+                break;
+
+            case 'b':
+                if((settings.slots = strtoul(optarg, NULL, 10)) < 2) {
+                    fprintf(stderr, "[-] at least 2 buffers are needed\n");
+                    return 1;
+                }
+                break;
+
+            case 'c':
+                if((settings.bufsize = strtoul(optarg, NULL, 10) * 1024 * 1024) == 0) {
+                    fprintf(stderr, "[-] chunk size needs to be at least 1 MB\n");
+                    return 1;
+                }
+                break;
+
+            case 'e':
+                if(strcmp(optarg, "uring") == 0)
+                    settings.kind = ENGINE_URING;
+                else if(strcmp(optarg, "sync") == 0)
+                    settings.kind = ENGINE_SYNC;
+                else if(strcmp(optarg, "auto") == 0)
+                    settings.kind = ENGINE_AUTO;
+                else {
+                    fprintf(stderr, "[-] unknown engine: %s (expected: auto, uring, sync)\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'q':
+                if((settings.depth = strtoul(optarg, NULL, 10)) < 1 || settings.depth > ENGINE_DEPTH_MAX) {
+                    fprintf(stderr, "[-] queue depth needs to be between 1 and %d\n", ENGINE_DEPTH_MAX);
+                    return 1;
+                }
+                break;
+
+            case 't':
+                if((threads = strtoul(optarg, NULL, 10)) < 1) {
+                    fprintf(stderr, "[-] at least 1 compute thread is needed\n");
+                    return 1;
+                }
+                break;
+
+            case 'H':
+                settings.hugepages = 1;
+                break;
+
+            case 'r':
+                settings.resume = 1;
+                break;
+
+            case 'v':
+                settings.verify = 1;
                 break;
 
             case 'h':
-                printf("help\n");
+                printf("usage: %s --disk DEVICE --seed 0xSEED [--disk DEVICE --seed 0xSEED ...]\n", argv[0]);
+                printf("       [--engine auto|uring|sync] [--depth N] [--buffers N] [--chunk MB] [--threads N] [--hugepages] [--resume] [--verify]\n");
                 return 1;
 
             case '?':
@@ -62,105 +388,142 @@ int main(int argc, char *argv[]) {
 
     }
 
-    if(target == NULL) {
+    if(targets == 0) {
         fprintf(stderr, "[-] missing target device\n");
         return 1;
     }
 
-    if(seeds == NULL) {
+    if(seeded < targets) {
         fprintf(stderr, "[-] missing original seed\n");
         return 1;
     }
 
-    if(strlen(seeds) != 18 || strncmp(seeds, "0x", 2) != 0) {
-        fprintf(stderr, "[-] malformed seed (expected: 0x................)\n");
+    if(seeded > targets) {
+        fprintf(stderr, "[-] more seeds than devices (one seed per device expected)\n");
         return 1;
     }
 
-    uint64_t seed = strtoull(seeds, NULL, 16);
+    for(size_t i = 0; i < targets; i++)
+        if(!device_seed(&devices[i]))
+            return 1;
 
-    printf("[+] target device: %s\n", target);
-    printf("[+] parsed seed: 0x%016lx\n", seed);
+    // each device computes its own chain, split over workers jumping
+    // ahead in the chain, but no more chunks than cores are computed
+    // at the same time
+    if(threads == 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
 
-    struct stat sb;
-    if(lstat(target, &sb) < 0)
-        diep(target);
+    settings.workers = (threads + targets - 1) / targets;
 
-    if(sb.st_mode & S_IFBLK) {
-        printf(COLOR_GREEN "[+] running on block device" COLOR_RESET "\n");
-    }
+    sem_t tokens;
+    sem_init(&tokens, 0, threads);
 
-    if(sb.st_mode & S_IFREG) {
-        printf(COLOR_YELLOW "[+] running on regular file (debug only)" COLOR_RESET "\n");
-    }
+    printf("[+] crc64 implementation: %s\n", crc64_impl->name);
+    printf("[+] devices: %lu, compute threads: %lu\n", targets, threads);
 
-    int fd;
-    if((fd = open(target, O_RDWR)) < 0)
-        diep("open");
+    // enough buffers to keep the queue full while every worker computes
+    if(settings.slots == 0)
+        settings.slots = (settings.depth * 2) + settings.workers;
 
-    off_t fullsize = lseek(fd, 0, SEEK_END);
-    lseek(fd, 0, SEEK_SET);
+    size_t total = 0;
+    size_t skipped = 0;
 
-    printf("[+] target size: " COLOR_GREEN "%.0f GB" COLOR_RESET " [%lu bytes]\n", GB(fullsize), fullsize);
+    for(size_t i = 0; i < targets; i++) {
+        device_prepare(&devices[i], &settings);
+        devices[i].pipeline.tokens = &tokens;
 
-    if(fullsize % 8 != 0) {
-        fprintf(stderr, "[-] target length not correctly aligned\n");
-        return 1;
+        total += devices[i].fullsize - devices[i].offset;
+        skipped += devices[i].offset;
     }
 
-    size_t values = fullsize / sizeof(uint64_t);
+    if(skipped && targets > 1)
+        printf("[+] resume: skipping %.2f GB in total\n", GB(skipped));
 
-    printf("[+] generating crc length: %lu\n", values);
+    for(size_t i = 0; i < targets; i++)
+        if(pthread_create(&devices[i].thread, NULL, device_build, &devices[i]))
+            diep("pthread_create");
 
-    // time statistics
-    struct timeval time_total_begin, time_total_end;
-    struct timeval time_begin, time_end;
-    gettimeofday(&time_begin, NULL);
+    double elapsed = devices_monitor(devices, targets, total, "writing data", device_progress);
+    int failed = 0;
 
-    printf("[+] writing data: initializing...");
-    fflush(stdout);
+    for(size_t i = 0; i < targets; i++) {
+        device_t *device = &devices[i];
+        pipeline_t *pipeline = &device->pipeline;
 
-    ssize_t bufsize = 8 * 1024 * 1024;
-    ssize_t bufoff = 0;
-    char *buffer = calloc(sizeof(char), bufsize);
+        pthread_join(device->thread, NULL);
 
-    if(fullsize % bufsize != 0) {
-        printf("buffer not possible\n");
-        return 1;
+        if(!device->success) {
+            fprintf(stderr, "[-] %s: " COLOR_RED "build failed" COLOR_RESET "\n", device->target);
+            failed = 1;
+        }
+
+        if(device->success) {
+            printf("[+] %s: device ready, write speed: %.0f MB/s\n", device->target, speed(device->fullsize - device->offset, pipeline->elapsed));
+            printf("[+] %s: parameters: %.1f MB chunks (%s), alignment %lu, %s depth %lu, %lu workers\n", device->target,
+                    MB(device->chunksize), device->calibrated ? "calibrated" : (settings.bufsize ? "fixed" : "default"), device->geometry.alignment,
+                    engine_name(&device->engine), device->engine.depth, pipeline->workers);
+            printf("[+] %s: stalls: compute waited %.1f seconds on device, device waited %.1f seconds on compute\n",
+                    device->target, pipeline->compute_stall, pipeline->write_stall);
+        }
+
+        pipeline_free(pipeline);
     }
 
-    gettimeofday(&time_total_begin, NULL);
+    if(targets > 1)
+        printf("[+] aggregate write speed: %.0f MB/s (%.2f GB in %.1f seconds)\n", speed(total, elapsed), GB(total), elapsed);
 
-    for(size_t offset = 0; offset < values; offset++) {
-        memcpy(buffer + bufoff, &seed, sizeof(seed));
-        bufoff += sizeof(seed);
+    if(settings.verify && !failed) {
+        // read back everything, including what resume skipped
+        total = 0;
 
-        if(bufoff == bufsize) {
-            if(write(fd, buffer, bufsize) != bufsize)
-                diep("write");
+        for(size_t i = 0; i < targets; i++) {
+            device_t *device = &devices[i];
 
-            gettimeofday(&time_end, NULL);
+            if(!verify_init(&device->verify, &device->engine, settings.workers, device->origin, device->fullsize))
+                diep("verify");
 
-            double timed = time_spent(&time_end) - time_spent(&time_begin);
-            double cspeed = speed(bufsize, timed);
-            double progress = (offset / (double) values) * 100;
+            device->verify.tokens = &tokens;
+            total += device->fullsize;
 
-            printf("\r[+] writing data: %.2f %% [%.0f MB/s]\033[0K", progress, cspeed);
-            fflush(stdout);
+            if(pthread_create(&device->thread, NULL, device_verify, device))
+                diep("pthread_create");
+        }
+
+        elapsed = devices_monitor(devices, targets, total, "verifying data", device_verified);
+
+        for(size_t i = 0; i < targets; i++) {
+            device_t *device = &devices[i];
+            verify_t *verify = &device->verify;
+
+            pthread_join(device->thread, NULL);
+
+            if(!device->success) {
+                fprintf(stderr, "[-] %s: " COLOR_RED "verification could not complete" COLOR_RESET "\n", device->target);
+                failed = 1;
 
-            gettimeofday(&time_begin, NULL);
-            bufoff = 0;
+            } else if(verify->mismatches) {
+                fprintf(stderr, "[-] %s: " COLOR_RED "invalid values: %lu" COLOR_RESET ", first one at offset %lu (value %lu): 0x%016lx, expected 0x%016lx\n",
+                        device->target, verify->mismatches, verify->first * sizeof(uint64_t), verify->first, verify->found, verify->expected);
+                failed = 1;
+
+            } else {
+                printf("[+] %s: " COLOR_GREEN "device verified" COLOR_RESET ", read speed: %.0f MB/s\n", device->target, speed(device->fullsize, verify->elapsed));
+            }
+
+            printf("[+] %s: stalls: reads waited %.1f seconds on checks, checks waited %.1f seconds on reads\n",
+                    device->target, verify->read_stall, verify->check_stall);
+
+            verify_free(verify);
         }
 
-        seed = crc64((uint8_t *) &seed, sizeof(seed));
+        if(targets > 1)
+            printf("[+] aggregate read speed: %.0f MB/s (%.2f GB in %.1f seconds)\n", speed(total, elapsed), GB(total), elapsed);
     }
 
-    gettimeofday(&time_total_end, NULL);
-
-    double timed = time_spent(&time_total_end) - time_spent(&time_total_begin);
-    double cspeed = speed(fullsize, timed);
+    for(size_t i = 0; i < targets; i++)
+        engine_close(&devices[i].engine);
 
-    printf("\n[+] device ready, write speed: %.0f MB/s\n", cspeed);
+    sem_destroy(&tokens);
 
-    return 0;
+    return failed;
 }
@@ -1,7 +1,188 @@
 #ifndef STORAGE_BUILD_H
     #define STORAGE_H
 
-    uint64_t crc64(const uint8_t *data, size_t length);
+    #include <stdint.h>
+    #include <stddef.h>
+    #include <pthread.h>
+    #include <semaphore.h>
+    #include <sys/types.h>
+    #include "uring.h"
+    #include "crc64.h"
+
+    #define ENGINE_AUTO   0
+    #define ENGINE_URING  1
+    #define ENGINE_SYNC   2
+
+    // upper bound of --depth: a resume backs off by it, whatever
+    // depth the interrupted run was using
+    #define ENGINE_DEPTH_MAX  32
+
+    // chunks written between two flushes to stable storage, anything
+    // after the last flush can be lost on power cut (volatile cache)
+    #define PIPELINE_SYNC_CHUNKS  16
+
+    typedef struct geometry_t {
+        int blockdev;
+        size_t size;
+        size_t logical;
+        size_t physical;
+        size_t iomin;
+        size_t ioopt;
+
+        // every chunk size is a multiple of it
+        size_t alignment;
+
+    } geometry_t;
+
+    typedef struct engine_t {
+        int kind;
+        int fd;
+        int direct;
+        size_t depth;
+
+        // unaligned tail of direct writes
+        int tailfd;
+        size_t alignment;
+
+        // buffers, carved in one (maybe hugepages) area
+        char *area;
+        size_t arealen;
+        int hugepages;
+        char **buffers;
+        size_t count;
+        size_t length;
+
+        // io_uring engine
+        uring_t ring;
+        int fixedbuf;
+        int fixedfile;
+
+        // pwritev engine
+        size_t done;
+        int written;
+        off_t lastoffset;
+        size_t lastlength;
+
+    } engine_t;
+
+    typedef struct pipeline_worker_t {
+        struct pipeline_t *pipeline;
+        pthread_t thread;
+        size_t id;
+        double stall;
+
+    } pipeline_worker_t;
+
+    typedef struct pipeline_t {
+        engine_t *engine;
+        uint64_t seed;
+        size_t size;
+        size_t offset;
+
+        // ring of chunks (engine buffers), filled by the
+        // compute workers and drained by the writer
+        char **ring;
+        int *ready;
+        int *completed;
+        size_t slots;
+        size_t chunksize;
+        size_t chunks;
+
+        // chain jump between two chunks of the same worker
+        pipeline_worker_t *threads;
+        size_t workers;
+        crc64_affine_t stride;
+
+        pthread_mutex_t lock;
+        pthread_cond_t filled;
+        pthread_cond_t drained;
+        size_t produced;
+        size_t consumed;
+        size_t written;
+        int finished;
+        int failed;
+
+        // shared between pipelines of every device, bounds the
+        // amount of chunks computed at the same time (NULL: no limit)
+        sem_t *tokens;
+
+        // seconds each stage spent waiting on the other one
+        double compute_stall;
+        double write_stall;
+        double elapsed;
+
+    } pipeline_t;
+
+    typedef struct verify_worker_t {
+        struct verify_t *verify;
+        pthread_t thread;
+        size_t id;
+        double stall;
+
+    } verify_worker_t;
+
+    typedef struct verify_t {
+        engine_t *engine;
+        uint64_t seed;
+        size_t size;
+
+        // ring of chunks (engine buffers), loaded by the reader
+        // and released to it once checked, in ring order
+        char **ring;
+        size_t *loaded;
+        size_t *pending;
+        int *checked;
+        size_t slots;
+        size_t chunksize;
+        size_t chunks;
+
+        verify_worker_t *threads;
+        size_t workers;
+        crc64_affine_t stride;
+
+        pthread_mutex_t lock;
+        pthread_cond_t filled;
+        pthread_cond_t drained;
+        size_t released;
+        int finished;
+        int failed;
+        sem_t *tokens;
+
+        // wrong values, and the first one of them (value index)
+        size_t mismatches;
+        size_t first;
+        uint64_t expected;
+        uint64_t found;
+
+        // seconds the reader waited on checks, and the opposite
+        double read_stall;
+        double check_stall;
+        double elapsed;
+
+    } verify_t;
+
+    int geometry_probe(int fd, geometry_t *geometry);
+    size_t geometry_chunk(geometry_t *geometry, size_t length);
+    size_t geometry_chunk_max(geometry_t *geometry);
+    size_t geometry_calibrate(geometry_t *geometry, char *target, int kind, size_t depth, uint64_t seed);
+
+    int engine_open(engine_t *engine, char *target, int kind, size_t depth, size_t count, size_t length, int hugepages);
+    const char *engine_name(engine_t *engine);
+    int engine_write(engine_t *engine, size_t slot, size_t length, off_t offset);
+    int engine_read(engine_t *engine, size_t slot, size_t length, off_t offset);
+    int engine_reap(engine_t *engine, size_t *slot);
+    int engine_sync(engine_t *engine);
+    void engine_close(engine_t *engine);
+
+    int pipeline_init(pipeline_t *pipeline, engine_t *engine, size_t workers, uint64_t seed, size_t offset, size_t size);
+    int pipeline_run(pipeline_t *pipeline);
+    void pipeline_free(pipeline_t *pipeline);
+
+    int verify_init(verify_t *verify, engine_t *engine, size_t workers, uint64_t seed, size_t size);
+    int verify_run(verify_t *verify);
+    void verify_free(verify_t *verify);
+
+    size_t resume_locate(int fd, uint64_t seed, size_t size, size_t chunksize, size_t backoff, uint64_t *value);
 
     #define MB(x)   (x / (1024 * 1024.0))
     #define GB(x)   (x / (1024 * 1024 * 1024.0))
@@ -0,0 +1,36 @@
+#!/bin/sh
+#
+# multi-worker image check
+#
+# builds the same small image with a single compute worker and with
+# several ones (workers jump ahead in the chain, see pipeline.c), the
+# images must be identical byte for byte. the size is not a multiple
+# of the chunk size, so the last partial chunk is covered as well
+#
+# usage: ./test.sh [workers]
+#
+set -e
+
+BUILD=./storage-build
+WORKERS=${1:-4}
+SEED=0x5eedc0ffee15600d
+SIZE=$((40 * 1024 * 1024 + 4096 * 3))
+WORKDIR=$(mktemp -d)
+
+trap 'rm -rf "$WORKDIR"' EXIT
+
+for workers in 1 $WORKERS; do
+    truncate -s $SIZE "$WORKDIR/image-$workers"
+    $BUILD --disk "$WORKDIR/image-$workers" --seed $SEED --chunk 1 --threads $workers > "$WORKDIR/log-$workers" 2>&1 || {
+        cat "$WORKDIR/log-$workers"
+        echo "[-] build with $workers workers failed"
+        exit 1
+    }
+done
+
+if ! cmp "$WORKDIR/image-1" "$WORKDIR/image-$WORKERS"; then
+    echo "[-] image built with $WORKERS workers differs from the single worker one"
+    exit 1
+fi
+
+echo "[+] image built with $WORKERS workers matches the single worker one"
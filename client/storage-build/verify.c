@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "crc64.h"
+#include "storage.h"
+
+//
+// read-back verification
+//
+// the pipeline the other way around: the calling thread reads the
+// device sequentially into the ring (up to engine depth in flight)
+// while workers check chunks as soon as they are loaded. worker w
+// checks chunks w, w + N, ... against the chain value expected at
+// their position (jumping ahead like the build does), so every
+// wrong value is found and counted, not only broken links
+//
+static double time_now() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    return now.tv_sec + (now.tv_usec / 1000000.0);
+}
+
+static size_t verify_chunk_length(verify_t *verify, size_t index) {
+    size_t remaining = verify->size - (index * verify->chunksize);
+
+    return remaining < verify->chunksize ? remaining : verify->chunksize;
+}
+
+static void *verify_check(void *args) {
+    verify_worker_t *worker = args;
+    verify_t *verify = worker->verify;
+    size_t chunkvalues = verify->chunksize / sizeof(uint64_t);
+    uint64_t expected = crc64_jump(verify->seed, worker->id * chunkvalues);
+
+    for(size_t index = worker->id; index < verify->chunks; index += verify->workers) {
+        size_t slot = index % verify->slots;
+        double begin = time_now();
+
+        pthread_mutex_lock(&verify->lock);
+
+        // slots hold the index (+1) of the chunk they were loaded with
+        while(verify->loaded[slot] != index + 1 && !verify->failed)
+            pthread_cond_wait(&verify->filled, &verify->lock);
+
+        int failed = verify->failed;
+
+        pthread_mutex_unlock(&verify->lock);
+
+        worker->stall += time_now() - begin;
+
+        if(failed)
+            break;
+
+        uint64_t *buffer = (uint64_t *) verify->ring[slot];
+        size_t values = verify_chunk_length(verify, index) / sizeof(uint64_t);
+        size_t mismatches = 0;
+        size_t first = 0;
+        uint64_t found = 0, wanted = 0;
+
+        if(verify->tokens)
+            while(sem_wait(verify->tokens) < 0);
+
+        for(size_t i = 0; i < values; i++) {
+            if(buffer[i] != expected) {
+                if(mismatches++ == 0) {
+                    first = (index * chunkvalues) + i;
+                    found = buffer[i];
+                    wanted = expected;
+                }
+            }
+
+            expected = crc64_u64(expected);
+        }
+
+        if(verify->tokens)
+            sem_post(verify->tokens);
+
+        expected = crc64_affine_apply(&verify->stride, expected);
+
+        pthread_mutex_lock(&verify->lock);
+
+        if(mismatches && (verify->mismatches == 0 || first < verify->first)) {
+            verify->first = first;
+            verify->found = found;
+            verify->expected = wanted;
+        }
+
+        verify->mismatches += mismatches;
+        verify->loaded[slot] = 0;
+        verify->checked[slot] = 1;
+
+        while(verify->released < verify->chunks && verify->checked[verify->released % verify->slots]) {
+            verify->checked[verify->released % verify->slots] = 0;
+            verify->released += 1;
+        }
+
+        pthread_cond_signal(&verify->drained);
+        pthread_mutex_unlock(&verify->lock);
+    }
+
+    return NULL;
+}
+
+int verify_init(verify_t *verify, engine_t *engine, size_t workers, uint64_t seed, size_t size) {
+    memset(verify, 0, sizeof(verify_t));
+
+    verify->engine = engine;
+    verify->seed = seed;
+    verify->size = size;
+    verify->ring = engine->buffers;
+    verify->slots = engine->count;
+    verify->chunksize = engine->length;
+    verify->chunks = (size + engine->length - 1) / engine->length;
+    verify->workers = workers;
+
+    if(!(verify->loaded = calloc(sizeof(size_t), verify->slots)))
+        return 0;
+
+    if(!(verify->checked = calloc(sizeof(int), verify->slots)))
+        return 0;
+
+    if(!(verify->pending = calloc(sizeof(size_t), verify->slots)))
+        return 0;
+
+    if(!(verify->threads = calloc(sizeof(verify_worker_t), workers)))
+        return 0;
+
+    crc64_affine_steps(&verify->stride, (workers - 1) * (verify->chunksize / sizeof(uint64_t)));
+
+    // without direct i/o, what was just written would be read from cache
+    if(!engine->direct)
+        posix_fadvise(engine->fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    pthread_mutex_init(&verify->lock, NULL);
+    pthread_cond_init(&verify->filled, NULL);
+    pthread_cond_init(&verify->drained, NULL);
+
+    return 1;
+}
+
+void verify_free(verify_t *verify) {
+    free(verify->loaded);
+    free(verify->checked);
+    free(verify->pending);
+    free(verify->threads);
+
+    pthread_mutex_destroy(&verify->lock);
+    pthread_cond_destroy(&verify->filled);
+    pthread_cond_destroy(&verify->drained);
+}
+
+static void verify_fail(verify_t *verify) {
+    pthread_mutex_lock(&verify->lock);
+    verify->failed = 1;
+    pthread_cond_broadcast(&verify->filled);
+    pthread_mutex_unlock(&verify->lock);
+}
+
+// read the whole device, returns 0 on read failure (mismatches
+// are not a failure, they are counted in 'mismatches')
+int verify_run(verify_t *verify) {
+    engine_t *engine = verify->engine;
+    double begin = time_now();
+    size_t submitted = 0;
+    size_t inflight = 0;
+    size_t started;
+
+    for(started = 0; started < verify->workers; started++) {
+        verify_worker_t *worker = &verify->threads[started];
+
+        worker->verify = verify;
+        worker->id = started;
+
+        if(pthread_create(&worker->thread, NULL, verify_check, worker)) {
+            perror("pthread_create");
+            verify_fail(verify);
+            break;
+        }
+    }
+
+    while(!verify->failed) {
+        pthread_mutex_lock(&verify->lock);
+        size_t released = verify->released;
+        pthread_mutex_unlock(&verify->lock);
+
+        if(released == verify->chunks)
+            break;
+
+        if(submitted < verify->chunks && inflight < engine->depth && submitted - released < verify->slots) {
+            size_t slot = submitted % verify->slots;
+            size_t length = verify_chunk_length(verify, submitted);
+
+            if(!engine_read(engine, slot, length, submitted * verify->chunksize)) {
+                perror("read");
+                verify_fail(verify);
+                break;
+            }
+
+            verify->pending[slot] = submitted;
+            submitted += 1;
+            inflight += 1;
+            continue;
+        }
+
+        if(inflight) {
+            size_t slot;
+
+            if(!engine_reap(engine, &slot)) {
+                perror("read");
+                verify_fail(verify);
+                break;
+            }
+
+            inflight -= 1;
+
+            pthread_mutex_lock(&verify->lock);
+            verify->loaded[slot] = verify->pending[slot] + 1;
+            pthread_cond_broadcast(&verify->filled);
+            pthread_mutex_unlock(&verify->lock);
+
+            continue;
+        }
+
+        // every slot is loaded and waiting to be checked
+        double waiting = time_now();
+
+        pthread_mutex_lock(&verify->lock);
+
+        while(verify->released == released)
+            pthread_cond_wait(&verify->drained, &verify->lock);
+
+        pthread_mutex_unlock(&verify->lock);
+
+        verify->read_stall += time_now() - waiting;
+    }
+
+    // requests still in flight reference our buffers
+    for(size_t slot; inflight; inflight--)
+        engine_reap(engine, &slot);
+
+    for(size_t i = 0; i < started; i++) {
+        pthread_join(verify->threads[i].thread, NULL);
+        verify->check_stall += verify->threads[i].stall;
+    }
+
+    verify->elapsed = time_now() - begin;
+
+    pthread_mutex_lock(&verify->lock);
+    verify->finished = 1;
+    pthread_mutex_unlock(&verify->lock);
+
+    return !verify->failed;
+}
@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <curl/curl.h>
+#include <jansson.h>
+#include "storage.h"
+
+//
+// challenge agent
+//
+// everything a challenge needs is set up once: devices are opened
+// with their geometry probed, one read queue (io_uring and buffers)
+// serves all of them, and a single curl handle keeps its connection
+// to the server alive between polls, fetches and responses. the
+// server holds a poll until a challenge is pending (or 'interval'
+// elapsed), then the agent waits 'merge' for other disks to be
+// challenged as well, and reads every pending challenge in one batch
+//
+static double time_now() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    return now.tv_sec + (now.tv_usec / 1000000.0);
+}
+
+int agent_init(agent_t *agent, disk_t *disks, size_t count, char *nodeid) {
+    size_t slots = 0;
+    size_t slotsize = 0;
+
+    agent->disks = disks;
+    agent->count = count;
+    agent->nodeid = nodeid;
+    agent->stopped = 0;
+    agent->answered = 0;
+
+    if(!(agent->curl = curl_easy_init()))
+        return 0;
+
+    // every device keeps its own depth, buffers hold any sector
+    for(size_t i = 0; i < count; i++) {
+        slots += disks[i].reader.depth;
+
+        if(disks[i].reader.sector > slotsize)
+            slotsize = disks[i].reader.sector;
+    }
+
+    if(!reader_queue_init(&agent->queue, slots, slotsize))
+        return 0;
+
+    if(!(agent->jobs = calloc(sizeof(reader_job_t), count)))
+        return 0;
+
+    if(!(agent->answering = calloc(sizeof(disk_t *), count)))
+        return 0;
+
+    return 1;
+}
+
+void agent_free(agent_t *agent) {
+    reader_queue_free(&agent->queue);
+    curl_easy_cleanup(agent->curl);
+    free(agent->jobs);
+    free(agent->answering);
+}
+
+// sleep until 'until' (seconds), or until stopped
+static void agent_sleep(agent_t *agent, double until) {
+    while(!agent->stopped && time_now() < until)
+        usleep(100000);
+}
+
+// append 'item' to the heap allocated 'string' of 'length' bytes,
+// returns 0 on allocation failure ('string' is left untouched)
+static int agent_append(char **string, size_t *length, const char *item) {
+    size_t size = strlen(item);
+    char *grown;
+
+    if(!(grown = realloc(*string, *length + size + 1)))
+        return 0;
+
+    memcpy(grown + *length, item, size + 1);
+
+    *string = grown;
+    *length += size;
+
+    return 1;
+}
+
+// ask the server which disks have a challenge waiting, for 'wait'
+// seconds at most, returns the amount of pending disks or -1. disks
+// backing off are not asked for, when all of them are this waits
+// for the first one to be done. names are url-encoded, the list has
+// no length limit
+static int agent_poll(agent_t *agent, size_t wait) {
+    char waiting[64];
+    char *endpoint = NULL;
+    char *body;
+    double now = time_now();
+    double backoff = 0;
+    size_t listed = 0;
+    size_t length = 0;
+    int pending = 0;
+
+    snprintf(waiting, sizeof(waiting), "?wait=%lu&targets=", wait);
+
+    if(!agent_append(&endpoint, &length, CHECK_SERVER "/proof/pending/") ||
+       !agent_append(&endpoint, &length, agent->nodeid) || !agent_append(&endpoint, &length, waiting)) {
+        free(endpoint);
+        return -1;
+    }
+
+    for(size_t i = 0; i < agent->count; i++) {
+        disk_t *disk = &agent->disks[i];
+        char *name;
+
+        if(!disk->ready)
+            continue;
+
+        if(disk->backoff > now) {
+            if(backoff == 0 || disk->backoff < backoff)
+                backoff = disk->backoff;
+
+            continue;
+        }
+
+        if(!(name = curl_easy_escape(agent->curl, disk->name, 0))) {
+            free(endpoint);
+            return -1;
+        }
+
+        int appended = (!listed || agent_append(&endpoint, &length, ",")) && agent_append(&endpoint, &length, name);
+        curl_free(name);
+
+        if(!appended) {
+            free(endpoint);
+            return -1;
+        }
+
+        listed += 1;
+    }
+
+    if(listed == 0) {
+        free(endpoint);
+
+        if(wait)
+            agent_sleep(agent, backoff);
+
+        return 0;
+    }
+
+    int fetched = transport_get(agent->curl, endpoint, &body, &agent->stopped);
+    free(endpoint);
+
+    if(!fetched)
+        return -1;
+
+    json_error_t jsonerror;
+    json_t *root = json_loads(body, 0, &jsonerror);
+
+    free(body);
+
+    if(!json_is_array(root)) {
+        fprintf(stderr, "[-] malformed pending challenges list\n");
+        json_decref(root);
+        return -1;
+    }
+
+    for(size_t i = 0; i < agent->count; i++) {
+        disk_t *disk = &agent->disks[i];
+
+        for(size_t j = 0; j < json_array_size(root); j++) {
+            const char *name = json_string_value(json_array_get(root, j));
+
+            if(name && strcmp(name, disk->name) == 0 && disk->backoff <= now)
+                disk->pending = 1;
+        }
+
+        pending += disk->pending;
+    }
+
+    json_decref(root);
+
+    return pending;
+}
+
+// disk is left alone for an interval
+static void agent_backoff(agent_t *agent, disk_t *disk) {
+    disk->backoff = time_now() + agent->interval;
+    disk_release(disk);
+}
+
+// fetch, read in one batch, and answer every pending challenge, a
+// disk failing to read is put aside without holding the others
+static void agent_answer(agent_t *agent) {
+    size_t jobs = 0;
+    double begin = time_now();
+
+    for(size_t i = 0; i < agent->count; i++) {
+        disk_t *disk = &agent->disks[i];
+
+        if(!disk->pending)
+            continue;
+
+        disk->pending = 0;
+
+        // don't insist on a challenge we can't get
+        if(!disk_challenge(disk, agent->curl, agent->nodeid, agent->binary)) {
+            fprintf(stderr, "[-] %s: challenge unavailable, next attempt in %lu seconds\n", disk->name, agent->interval);
+            agent_backoff(agent, disk);
+            continue;
+        }
+
+        disk_job(disk, &agent->jobs[jobs]);
+        agent->answering[jobs++] = disk;
+    }
+
+    if(jobs == 0)
+        return;
+
+    double fetched = time_now();
+
+    reader_fetch_jobs(&agent->queue, agent->jobs, jobs);
+
+    double read = time_now();
+
+    for(size_t i = 0; i < jobs; i++) {
+        disk_t *disk = agent->answering[i];
+
+        if(agent->jobs[i].failed) {
+            fprintf(stderr, "[-] %s: read failed: %s, next attempt in %lu seconds\n", disk->name, strerror(agent->jobs[i].failed), agent->interval);
+            agent_backoff(agent, disk);
+            continue;
+        }
+
+        disk->elapsed = read - fetched;
+
+        if(disk_respond(disk, agent->curl, agent->nodeid, agent->detailed))
+            agent->answered += 1;
+
+        disk_release(disk);
+    }
+
+    printf("[+] agent: %lu challenges in %.3f seconds (fetch %.3f, read %.3f, respond %.3f), %lu answered so far\n",
+            jobs, time_now() - begin, fetched - begin, read - fetched, time_now() - read, agent->answered);
+}
+
+// until 'stopped' is set, disks failing are retried after an
+// interval, returns 1
+int agent_run(agent_t *agent) {
+    printf("[+] agent: watching %lu disks, polling every %lu seconds, merging challenges within %lu ms\n",
+            agent->count, agent->interval, agent->merge);
+
+    while(!agent->stopped) {
+        int pending = agent_poll(agent, agent->interval);
+
+        if(pending < 0) {
+            // server unreachable, try again later
+            agent_sleep(agent, time_now() + agent->interval);
+
+            continue;
+        }
+
+        if(pending == 0)
+            continue;
+
+        // other disks challenged close to this one join the batch
+        if(agent->merge && (size_t) pending < agent->count) {
+            usleep(agent->merge * 1000);
+            agent_poll(agent, 0);
+        }
+
+        agent_answer(agent);
+    }
+
+    return 1;
+}
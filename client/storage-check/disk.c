@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <curl/curl.h>
+#include <jansson.h>
+#include "storage.h"
+
+//
+// latency profile
+//
+// reads are sorted and queued, so these are not raw access times, but
+// local media still fall in clear ranges: flash answers in (tens of)
+// microseconds, spinning disks in milliseconds. anything faster than
+// a device comes from memory, a long tail beyond local disks hints at
+// a network between us and the data
+//
+#define PROFILE_MEMORY_NS     20000      // p50 below: no device is that fast
+#define PROFILE_FLASH_NS      1000000    // p50 below: flash
+#define PROFILE_FLASH_TAIL    5000000    // p99 below: flash
+#define PROFILE_DISK_TAIL     100000000  // p99 below: rotational
+
+static const char *latency_profile(reader_t *reader, const char **reason) {
+    uint64_t p50 = histogram_percentile(&reader->latency, 50);
+    uint64_t p99 = histogram_percentile(&reader->latency, 99);
+
+    *reason = NULL;
+
+    if(!reader->direct) {
+        *reason = "reads went through the page cache";
+        return "suspicious";
+    }
+
+    if(p50 < PROFILE_MEMORY_NS) {
+        *reason = "faster than any device, data is served from memory";
+        return "suspicious";
+    }
+
+    if(p50 < PROFILE_FLASH_NS && p99 < PROFILE_FLASH_TAIL)
+        return "flash";
+
+    if(p50 >= PROFILE_FLASH_NS && p99 < PROFILE_DISK_TAIL)
+        return "rotational";
+
+    *reason = "latency tail beyond local media, remote or network backed storage";
+    return "suspicious";
+}
+
+static json_t *latency_summary(histogram_t *histogram) {
+    json_t *timing = json_object();
+
+    // microseconds
+    json_object_set_new(timing, "count", json_integer(histogram->count));
+    json_object_set_new(timing, "min", json_integer(histogram_min(histogram) / 1000));
+    json_object_set_new(timing, "mean", json_integer(histogram->count ? (histogram->sum / histogram->count) / 1000 : 0));
+    json_object_set_new(timing, "p50", json_integer(histogram_percentile(histogram, 50) / 1000));
+    json_object_set_new(timing, "p90", json_integer(histogram_percentile(histogram, 90) / 1000));
+    json_object_set_new(timing, "p99", json_integer(histogram_percentile(histogram, 99) / 1000));
+    json_object_set_new(timing, "p999", json_integer(histogram_percentile(histogram, 99.9) / 1000));
+    json_object_set_new(timing, "max", json_integer(histogram->max / 1000));
+
+    return timing;
+}
+
+//
+// one challenged disk: its reader, stays open, and the challenge
+// being answered
+//
+int disk_open(disk_t *disk, char *target, size_t depth) {
+    struct stat sb;
+    char *copy;
+
+    memset(disk, 0, sizeof(disk_t));
+
+    disk->target = target;
+    disk->reader.fd = -1;
+
+    // endpoints are named after the device
+    if(!(copy = strdup(target)) || !(disk->name = strdup(basename(copy))))
+        return 0;
+
+    free(copy);
+
+    if(lstat(target, &sb) < 0)
+        return 0;
+
+    if(S_ISBLK(sb.st_mode))
+        printf(COLOR_GREEN "[+] %s: running on block device" COLOR_RESET "\n", disk->name);
+
+    if(S_ISREG(sb.st_mode))
+        printf(COLOR_YELLOW "[+] %s: running on regular file (debug only)" COLOR_RESET "\n", disk->name);
+
+    if(!reader_open(&disk->reader, target, depth))
+        return 0;
+
+    printf("[+] %s: read engine: %s, queue depth %lu, %s, %lu bytes sectors\n", disk->name, reader_name(&disk->reader), depth,
+            disk->reader.direct ? "direct i/o (page cache bypassed)" : COLOR_YELLOW "page cache" COLOR_RESET, disk->reader.sector);
+
+    disk->ready = 1;
+
+    return 1;
+}
+
+void disk_close(disk_t *disk) {
+    reader_close(&disk->reader);
+    free(disk->name);
+}
+
+static void disk_endpoint(disk_t *disk, char *endpoint, size_t length, const char *route, char *nodeid) {
+    snprintf(endpoint, length, CHECK_SERVER "/proof/%s/%s/%s", route, nodeid, disk->name);
+}
+
+// challenge decoded, the disk is ready to read it
+static int disk_challenged(disk_t *disk) {
+    printf("[+] %s: challenge received: %s, %lu bytes, %lu datapoints\n", disk->name,
+            disk->challenge.binary ? "binary" : "json", disk->challenge.received, disk->challenge.length);
+
+    if(!(disk->points = calloc(sizeof(datapoint_t), disk->challenge.length ? disk->challenge.length : 1)))
+        return 0;
+
+    reader_reset(&disk->reader);
+
+    return 1;
+}
+
+// fetch the challenge of the disk, 'curl' is reused when set
+int disk_challenge(disk_t *disk, CURL *curl, char *nodeid, int binary) {
+    char endpoint[1024];
+
+    disk_endpoint(disk, endpoint, sizeof(endpoint), "challenge", nodeid);
+    printf("[+] %s: fetching verification datapoints: %s\n", disk->name, endpoint);
+
+    if(!challenge_fetch(&disk->challenge, curl, endpoint, binary))
+        return 0;
+
+    return disk_challenged(disk);
+}
+
+// same as disk_challenge, with the transfer run by a multi handle
+int disk_challenge_prepare(disk_t *disk, CURL *curl, char *nodeid, int binary) {
+    char endpoint[1024];
+
+    disk_endpoint(disk, endpoint, sizeof(endpoint), "challenge", nodeid);
+    printf("[+] %s: fetching verification datapoints: %s\n", disk->name, endpoint);
+
+    return challenge_prepare(&disk->challenge, curl, endpoint, binary);
+}
+
+int disk_challenge_complete(disk_t *disk, CURLcode res) {
+    if(!challenge_complete(&disk->challenge, res))
+        return 0;
+
+    return disk_challenged(disk);
+}
+
+// datapoints of the challenge, to be read along with other disks
+void disk_job(disk_t *disk, reader_job_t *job) {
+    memset(job, 0, sizeof(reader_job_t));
+
+    job->reader = &disk->reader;
+    job->offsets = disk->challenge.offsets;
+    job->length = disk->challenge.length;
+    job->points = disk->points;
+}
+
+// summary of what was read, and the response to send
+static void disk_response(disk_t *disk, upload_t *upload, int detailed) {
+    reader_t *reader = &disk->reader;
+    histogram_t *histogram = &reader->latency;
+    challenge_t *challenge = &disk->challenge;
+    const char *reason;
+    const char *profile = latency_profile(reader, &reason);
+    char key[32];
+
+    printf("[+] %s: %lu datapoints read in %.3f seconds (%lu sectors)\n", disk->name, challenge->length, disk->elapsed, reader->sectors);
+
+    printf("[+] %s: read latency: min %.0f us, p50 %.0f us, p90 %.0f us, p99 %.0f us, p99.9 %.0f us, max %.0f us\n", disk->name,
+            histogram_min(histogram) / 1000.0, histogram_percentile(histogram, 50) / 1000.0, histogram_percentile(histogram, 90) / 1000.0,
+            histogram_percentile(histogram, 99) / 1000.0, histogram_percentile(histogram, 99.9) / 1000.0, histogram->max / 1000.0);
+
+    if(reason)
+        printf("[+] %s: latency profile: " COLOR_RED "%s" COLOR_RESET " (%s)\n", disk->name, profile, reason);
+    else
+        printf("[+] %s: latency profile: " COLOR_GREEN "%s" COLOR_RESET "\n", disk->name, profile);
+
+    if(reader->rotational >= 0 && strcmp(profile, "suspicious") != 0 && reader->rotational != (strcmp(profile, "rotational") == 0))
+        printf("[-] %s: latency profile does not match the device, kernel reports it %srotational\n", disk->name, reader->rotational ? "" : "non-");
+
+    // timing evidence, next to the values (datapoints latencies
+    // are added while sending)
+    json_t *timing = latency_summary(histogram);
+    json_object_set_new(timing, "profile", json_string(profile));
+
+    // whole blocks around datapoints, only their verdict is sent
+    json_t *consistency = json_object();
+    json_t *broken = json_array();
+
+    for(size_t i = 0; i < challenge->length; i++) {
+        if(!disk->points[i].consistent) {
+            sprintf(key, "%lu", challenge->offsets[i]);
+            json_array_append_new(broken, json_string(key));
+        }
+    }
+
+    json_object_set_new(consistency, "blocks", json_integer(reader->sectors));
+    json_object_set_new(consistency, "values", json_integer(reader->sectors * (reader->sector / sizeof(uint64_t))));
+    json_object_set_new(consistency, "inconsistent", broken);
+
+    if(reader->inconsistent)
+        printf("[-] %s: local chain: " COLOR_RED "%lu / %lu blocks inconsistent" COLOR_RESET "\n", disk->name, reader->inconsistent, reader->sectors);
+    else
+        printf("[+] %s: local chain: " COLOR_GREEN "%lu blocks consistent" COLOR_RESET " (%lu values)\n", disk->name, reader->sectors, reader->sectors * (reader->sector / sizeof(uint64_t)));
+
+    upload_init(upload, challenge->binary, detailed, challenge->offsets, disk->points, challenge->length,
+            json_dumps(timing, JSON_COMPACT), json_dumps(consistency, JSON_COMPACT));
+
+    json_decref(timing);
+    json_decref(consistency);
+}
+
+static int disk_responded(disk_t *disk, upload_t *upload, int success, char *reply) {
+    if(success) {
+        printf("[+] %s: response sent: %s, %lu bytes\n", disk->name, upload->binary ? "binary" : "json", upload->sent);
+
+        if(reply)
+            printf("[+] %s: server reply: %s\n", disk->name, reply);
+    }
+
+    free(reply);
+    upload_free(upload);
+
+    return success;
+}
+
+// send the response to the server, 'curl' is reused when set
+int disk_respond(disk_t *disk, CURL *curl, char *nodeid, int detailed) {
+    char endpoint[1024];
+    upload_t upload;
+    char *reply;
+
+    disk_response(disk, &upload, detailed);
+
+    disk_endpoint(disk, endpoint, sizeof(endpoint), "verify", nodeid);
+    printf("[+] %s: sending response: %s\n", disk->name, endpoint);
+
+    int success = upload_send(&upload, curl, endpoint, &reply);
+
+    return disk_responded(disk, &upload, success, reply);
+}
+
+// same as disk_respond, with the transfer run by a multi handle,
+// 'upload' lives until disk_respond_complete
+int disk_respond_prepare(disk_t *disk, upload_t *upload, CURL *curl, char *nodeid, int detailed) {
+    char endpoint[1024];
+
+    disk_response(disk, upload, detailed);
+
+    disk_endpoint(disk, endpoint, sizeof(endpoint), "verify", nodeid);
+    printf("[+] %s: sending response: %s\n", disk->name, endpoint);
+
+    return upload_prepare(upload, curl, endpoint);
+}
+
+int disk_respond_complete(disk_t *disk, upload_t *upload, CURLcode res) {
+    char *reply;
+    int success = upload_complete(upload, res, &reply);
+
+    return disk_responded(disk, upload, success, reply);
+}
+
+// challenge answered, the disk waits for the next one
+void disk_release(disk_t *disk) {
+    challenge_free(&disk->challenge);
+    free(disk->points);
+
+    memset(&disk->challenge, 0, sizeof(challenge_t));
+    disk->points = NULL;
+}
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "storage.h"
+
+//
+// latency histogram
+//
+// log-linear buckets (hdr style): values below HISTOGRAM_SUB are exact,
+// above that each power of two is split in HISTOGRAM_SUB buckets, so
+// every recorded value is known within 1/HISTOGRAM_SUB (~6%) whatever
+// its magnitude, from nanoseconds to seconds
+//
+static size_t histogram_bucket(uint64_t value) {
+    if(value < HISTOGRAM_SUB)
+        return value;
+
+    int magnitude = 63 - __builtin_clzll(value);
+    size_t sub = (value >> (magnitude - HISTOGRAM_BITS)) & (HISTOGRAM_SUB - 1);
+
+    return ((magnitude - HISTOGRAM_BITS + 1) * HISTOGRAM_SUB) + sub;
+}
+
+// highest value falling in a bucket
+static uint64_t histogram_value(size_t bucket) {
+    if(bucket < HISTOGRAM_SUB)
+        return bucket;
+
+    int magnitude = (bucket / HISTOGRAM_SUB) + HISTOGRAM_BITS - 1;
+    uint64_t sub = bucket % HISTOGRAM_SUB;
+    uint64_t width = 1ULL << (magnitude - HISTOGRAM_BITS);
+
+    return (1ULL << magnitude) + (sub * width) + (width - 1);
+}
+
+void histogram_init(histogram_t *histogram) {
+    memset(histogram, 0, sizeof(histogram_t));
+    histogram->min = UINT64_MAX;
+}
+
+void histogram_add(histogram_t *histogram, uint64_t value) {
+    histogram->buckets[histogram_bucket(value)] += 1;
+    histogram->count += 1;
+    histogram->sum += value;
+
+    if(value < histogram->min)
+        histogram->min = value;
+
+    if(value > histogram->max)
+        histogram->max = value;
+}
+
+// smallest recorded value, 0 when nothing was recorded
+uint64_t histogram_min(histogram_t *histogram) {
+    return histogram->count ? histogram->min : 0;
+}
+
+// value under which 'percent' of the recorded values are
+uint64_t histogram_percentile(histogram_t *histogram, double percent) {
+    uint64_t wanted = (uint64_t)((percent / 100.0) * histogram->count);
+    uint64_t seen = 0;
+
+    if(histogram->count == 0)
+        return 0;
+
+    if(wanted == 0)
+        wanted = 1;
+
+    for(size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if((seen += histogram->buckets[i]) >= wanted) {
+            uint64_t value = histogram_value(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
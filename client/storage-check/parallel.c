@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <curl/curl.h>
+#include "storage.h"
+
+//
+// parallel check
+//
+// a check takes as long as its slowest disk, not the sum of them: all
+// challenges are requested at once, a disk starts reading as soon as
+// its own challenge arrived, and posts its response as soon as it's
+// read. transfers are driven by one multi handle from the calling
+// thread, a reader thread wakes it up when its device is done
+//
+#define PARALLEL_CONNECTIONS  8
+
+static double time_now() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    return now.tv_sec + (now.tv_usec / 1000000.0);
+}
+
+int parallel_init(parallel_t *parallel, disk_t *disks, size_t count, char *nodeid) {
+    memset(parallel, 0, sizeof(parallel_t));
+
+    parallel->count = count;
+    parallel->nodeid = nodeid;
+
+    if(!(parallel->disks = calloc(sizeof(parallel_disk_t), count)))
+        return 0;
+
+    if(!(parallel->multi = curl_multi_init()))
+        return 0;
+
+    // don't open one connection per disk on large hosts, transfers
+    // wait for a free one
+    curl_multi_setopt(parallel->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long) PARALLEL_CONNECTIONS);
+
+    for(size_t i = 0; i < count; i++) {
+        parallel_disk_t *slot = &parallel->disks[i];
+
+        slot->disk = &disks[i];
+        slot->parallel = parallel;
+
+        if(!(slot->curl = curl_easy_init()))
+            return 0;
+    }
+
+    pthread_mutex_init(&parallel->lock, NULL);
+
+    return 1;
+}
+
+void parallel_free(parallel_t *parallel) {
+    for(size_t i = 0; i < parallel->count; i++)
+        curl_easy_cleanup(parallel->disks[i].curl);
+
+    curl_multi_cleanup(parallel->multi);
+    pthread_mutex_destroy(&parallel->lock);
+    free(parallel->disks);
+}
+
+static void *parallel_reader(void *args) {
+    parallel_disk_t *slot = args;
+    parallel_t *parallel = slot->parallel;
+    disk_t *disk = slot->disk;
+    double begin = time_now();
+
+    int success = reader_fetch(&disk->reader, disk->challenge.offsets, disk->challenge.length, disk->points);
+
+    if(!success)
+        fprintf(stderr, "[-] %s: read failed: %s\n", disk->name, strerror(errno));
+
+    disk->elapsed = time_now() - begin;
+
+    pthread_mutex_lock(&parallel->lock);
+    slot->read = time_now() - parallel->begin;
+    slot->success = success;
+    slot->state = PARALLEL_READ;
+    pthread_mutex_unlock(&parallel->lock);
+
+    curl_multi_wakeup(parallel->multi);
+
+    return NULL;
+}
+
+static int parallel_transfer(parallel_disk_t *slot) {
+    curl_easy_setopt(slot->curl, CURLOPT_PRIVATE, slot);
+
+    return curl_multi_add_handle(slot->parallel->multi, slot->curl) == CURLM_OK;
+}
+
+// challenge transfer is over, start reading
+static void parallel_fetched(parallel_disk_t *slot, CURLcode res) {
+    parallel_t *parallel = slot->parallel;
+    disk_t *disk = slot->disk;
+
+    slot->fetched = time_now() - parallel->begin;
+
+    if(!disk_challenge_complete(disk, res)) {
+        slot->state = PARALLEL_FAILED;
+        return;
+    }
+
+    printf("[+] %s: reading %lu datapoints\n", disk->name, disk->challenge.length);
+
+    slot->state = PARALLEL_READING;
+
+    if(pthread_create(&slot->thread, NULL, parallel_reader, slot)) {
+        perror("pthread_create");
+        slot->state = PARALLEL_FAILED;
+    }
+}
+
+// device read, post its response
+static void parallel_post(parallel_disk_t *slot) {
+    parallel_t *parallel = slot->parallel;
+    disk_t *disk = slot->disk;
+
+    pthread_join(slot->thread, NULL);
+
+    if(!slot->success) {
+        slot->state = PARALLEL_FAILED;
+        return;
+    }
+
+    curl_easy_reset(slot->curl);
+    slot->state = PARALLEL_POSTING;
+
+    if(!disk_respond_prepare(disk, &slot->upload, slot->curl, parallel->nodeid, parallel->detailed) || !parallel_transfer(slot)) {
+        slot->success = disk_respond_complete(disk, &slot->upload, CURLE_FAILED_INIT);
+        slot->state = PARALLEL_FAILED;
+    }
+}
+
+static void parallel_posted(parallel_disk_t *slot, CURLcode res) {
+    slot->posted = time_now() - slot->parallel->begin;
+    slot->success = disk_respond_complete(slot->disk, &slot->upload, res);
+    slot->state = slot->success ? PARALLEL_DONE : PARALLEL_FAILED;
+}
+
+static int parallel_finished(parallel_disk_t *slot) {
+    return slot->state == PARALLEL_DONE || slot->state == PARALLEL_FAILED;
+}
+
+static void parallel_summary(parallel_t *parallel, double elapsed) {
+    parallel_disk_t *slowest = NULL;
+    size_t answered = 0;
+    double summed = 0;
+
+    for(size_t i = 0; i < parallel->count; i++) {
+        parallel_disk_t *slot = &parallel->disks[i];
+        disk_t *disk = slot->disk;
+        reader_t *reader = &disk->reader;
+
+        if(!slot->success) {
+            printf("[-] %s: " COLOR_RED "not answered" COLOR_RESET "\n", disk->name);
+            continue;
+        }
+
+        size_t bytes = reader->sectors * reader->sector;
+        double timed = disk->elapsed > 0 ? disk->elapsed : 1e-9;
+
+        printf("[+] %s: fetch %.3f s, read %.3f s [%.0f IOPS, %.1f MB/s, p50 %.0f us, p99 %.0f us], post %.3f s, total %.3f s\n",
+                disk->name, slot->fetched, disk->elapsed, reader->sectors / timed, MB(bytes) / timed,
+                histogram_percentile(&reader->latency, 50) / 1000.0, histogram_percentile(&reader->latency, 99) / 1000.0,
+                slot->posted - slot->read, slot->posted);
+
+        if(!slowest || slot->posted > slowest->posted)
+            slowest = slot;
+
+        summed += slot->posted;
+        answered += 1;
+    }
+
+    printf("[+] %lu / %lu disks answered in %.3f seconds", answered, parallel->count, elapsed);
+
+    if(slowest)
+        printf(" (slowest %s: %.3f s, summed: %.3f s)", slowest->disk->name, slowest->posted, summed);
+
+    printf("\n");
+}
+
+// every disk answers its challenge, returns 0 if any of them failed
+int parallel_run(parallel_t *parallel) {
+    size_t remaining = parallel->count;
+    int running;
+
+    parallel->begin = time_now();
+
+    for(size_t i = 0; i < parallel->count; i++) {
+        parallel_disk_t *slot = &parallel->disks[i];
+
+        slot->state = PARALLEL_FETCHING;
+
+        // could not be opened, reported as not answered
+        if(!slot->disk->ready) {
+            slot->state = PARALLEL_FAILED;
+            remaining -= 1;
+            continue;
+        }
+
+        if(!disk_challenge_prepare(slot->disk, slot->curl, parallel->nodeid, parallel->binary) || !parallel_transfer(slot)) {
+            fprintf(stderr, "[-] %s: could not request challenge\n", slot->disk->name);
+            slot->state = PARALLEL_FAILED;
+            remaining -= 1;
+        }
+    }
+
+    while(remaining) {
+        CURLMsg *message;
+        int left;
+
+        curl_multi_perform(parallel->multi, &running);
+
+        while((message = curl_multi_info_read(parallel->multi, &left))) {
+            parallel_disk_t *slot;
+            void *private;
+
+            if(message->msg != CURLMSG_DONE)
+                continue;
+
+            CURLcode res = message->data.result;
+
+            curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &private);
+            slot = private;
+            curl_multi_remove_handle(parallel->multi, slot->curl);
+
+            if(slot->state == PARALLEL_FETCHING)
+                parallel_fetched(slot, res);
+            else
+                parallel_posted(slot, res);
+
+            if(parallel_finished(slot))
+                remaining -= 1;
+        }
+
+        // devices done reading since last time
+        for(size_t i = 0; i < parallel->count; i++) {
+            parallel_disk_t *slot = &parallel->disks[i];
+
+            pthread_mutex_lock(&parallel->lock);
+            int state = slot->state;
+            pthread_mutex_unlock(&parallel->lock);
+
+            if(state != PARALLEL_READ)
+                continue;
+
+            parallel_post(slot);
+
+            // read failure, nothing to post
+            if(parallel_finished(slot))
+                remaining -= 1;
+        }
+
+        if(remaining)
+            curl_multi_poll(parallel->multi, NULL, 0, 1000, NULL);
+    }
+
+    parallel_summary(parallel, time_now() - parallel->begin);
+
+    for(size_t i = 0; i < parallel->count; i++)
+        if(!parallel->disks[i].success)
+            return 0;
+
+    return 1;
+}
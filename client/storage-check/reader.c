@@ -0,0 +1,438 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <time.h>
+#include "uring.h"
+#include "crc64.h"
+#include "storage.h"
+
+//
+// challenge datapoints reader
+//
+// every datapoint is one physical block read with O_DIRECT (the page
+// cache can't answer for the device), submitted in device order so the
+// elevator (and the disk) can serve them in a single sweep. values
+// sharing a block are served by the same read. the device transfers
+// the whole block anyway, its local chain consistency is checked for
+// free. up to 'depth' reads are in flight with io_uring, plain sorted
+// preads are used when io_uring is not available
+//
+// each sector read is timed with the monotonic clock, from submission
+// to completion, every value it holds gets that latency
+//
+// several readers (jobs) can share one queue: their reads are
+// interleaved, each device keeps its own order and at most its own
+// depth in flight, every device is busy at the same time
+//
+typedef struct reader_group_t {
+    off_t sector;
+    size_t first;   // first entry in the sorted order
+    size_t count;   // entries served by this sector
+
+} reader_group_t;
+
+static uint64_t reader_clock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec * 1000000000ULL) + now.tv_nsec;
+}
+
+int reader_open(reader_t *reader, char *target, size_t depth) {
+    struct stat sb;
+
+    memset(reader, 0, sizeof(reader_t));
+
+    reader->depth = depth;
+    reader->direct = 1;
+
+    histogram_init(&reader->latency);
+
+    if((reader->fd = open(target, O_RDONLY | O_DIRECT)) < 0) {
+        // some filesystems (tmpfs, ...) refuse direct access
+        if(errno != EINVAL)
+            return 0;
+
+        fprintf(stderr, "[-] O_DIRECT not supported by target, reading through page cache\n");
+
+        if((reader->fd = open(target, O_RDONLY)) < 0)
+            return 0;
+
+        reader->direct = 0;
+    }
+
+    if(fstat(reader->fd, &sb) < 0)
+        return 0;
+
+    reader->sector = 4096;
+    reader->rotational = -1;
+    reader->size = sb.st_size;
+
+    if(S_ISBLK(sb.st_mode)) {
+        uint64_t size;
+        int logical = 0;
+        unsigned int physical = 0;
+        unsigned short rotational;
+
+        if(ioctl(reader->fd, BLKSSZGET, &logical) == 0 && logical > 0)
+            reader->sector = logical;
+
+        // physical block is the smallest unit the device really reads
+        if(ioctl(reader->fd, BLKPBSZGET, &physical) == 0 && physical > reader->sector)
+            reader->sector = physical;
+
+        if(ioctl(reader->fd, BLKROTATIONAL, &rotational) == 0)
+            reader->rotational = rotational;
+
+        if(ioctl(reader->fd, BLKGETSIZE64, &size) == 0)
+            reader->size = size;
+    }
+
+    if(!reader_queue_init(&reader->queue, depth, reader->sector))
+        return 0;
+
+    return 1;
+}
+
+void reader_close(reader_t *reader) {
+    reader_queue_free(&reader->queue);
+
+    if(reader->fd >= 0)
+        close(reader->fd);
+}
+
+const char *reader_name(reader_t *reader) {
+    return reader->queue.uring ? "io_uring" : "pread";
+}
+
+// statistics of the next challenge start from scratch
+void reader_reset(reader_t *reader) {
+    reader->sectors = 0;
+    reader->inconsistent = 0;
+    histogram_init(&reader->latency);
+}
+
+int reader_queue_init(reader_queue_t *queue, size_t slots, size_t slotsize) {
+    memset(queue, 0, sizeof(reader_queue_t));
+
+    queue->slots = slots;
+    queue->slotsize = slotsize;
+
+    if(posix_memalign((void **) &queue->area, 4096, slotsize * slots))
+        return 0;
+
+    if(!(queue->jobs = calloc(sizeof(size_t), slots)))
+        return 0;
+
+    if(!(queue->groups = calloc(sizeof(size_t), slots)))
+        return 0;
+
+    if(!(queue->submitted = calloc(sizeof(uint64_t), slots)))
+        return 0;
+
+    queue->uring = uring_init(&queue->ring, slots);
+
+    return 1;
+}
+
+void reader_queue_free(reader_queue_t *queue) {
+    if(queue->uring)
+        uring_free(&queue->ring);
+
+    free(queue->area);
+    free(queue->jobs);
+    free(queue->groups);
+    free(queue->submitted);
+}
+
+static int reader_compare(const void *a, const void *b) {
+    const uint64_t *x = a, *y = b;
+
+    // offset first, original position to keep it stable
+    if(x[0] != y[0])
+        return x[0] < y[0] ? -1 : 1;
+
+    return x[1] < y[1] ? -1 : (x[1] > y[1]);
+}
+
+// every value of the block is the crc64 of the previous one, checked
+// CRC64_LANES pairs at a time with the multi-lane kernel
+static int reader_consistent(const uint64_t *values, size_t length) {
+    uint64_t lanes[CRC64_LANES];
+    size_t i = 0;
+
+    for(; i + CRC64_LANES < length; i += CRC64_LANES) {
+        memcpy(lanes, values + i, sizeof(lanes));
+        crc64_x8(lanes, 1);
+
+        if(memcmp(lanes, values + i + 1, sizeof(lanes)) != 0)
+            return 0;
+    }
+
+    for(; i + 1 < length; i++)
+        if(values[i + 1] != crc64_u64(values[i]))
+            return 0;
+
+    return 1;
+}
+
+// block is loaded in 'buffer', copy every value it holds
+static int reader_complete(reader_job_t *job, reader_group_t *group, char *buffer, ssize_t result, uint64_t latency) {
+    reader_t *reader = job->reader;
+    uint64_t *sorted = job->sorted;
+
+    // partial block at the end of the device
+    int consistent = reader_consistent((uint64_t *) buffer, result / sizeof(uint64_t));
+
+    for(size_t i = group->first; i < group->first + group->count; i++) {
+        off_t within = (sorted[i * 2] * sizeof(uint64_t)) - group->sector;
+        datapoint_t *point = &job->points[sorted[(i * 2) + 1]];
+
+        // short read past the end of the device
+        if(result < (ssize_t)(within + sizeof(uint64_t))) {
+            errno = EIO;
+            return 0;
+        }
+
+        memcpy(&point->value, buffer + within, sizeof(uint64_t));
+        point->latency = latency;
+        point->consistent = consistent;
+    }
+
+    if(!consistent)
+        reader->inconsistent += 1;
+
+    histogram_add(&reader->latency, latency);
+    reader->sectors += 1;
+
+    return 1;
+}
+
+// a read of the job failed, the rest of it is not read, other jobs go on
+static void reader_job_fail(reader_job_t *job, size_t *remaining) {
+    if(job->failed)
+        return;
+
+    job->failed = errno ? errno : EIO;
+    *remaining -= job->count - job->next;
+    job->next = job->count;
+}
+
+static int reader_fetch_sync(reader_queue_t *queue, reader_job_t *jobs, size_t count) {
+    for(size_t j = 0; j < count; j++) {
+        reader_job_t *job = &jobs[j];
+        size_t remaining = job->count;
+
+        for(size_t g = 0; g < job->count && !job->failed; g++) {
+            uint64_t begin = reader_clock();
+            ssize_t result = pread(job->reader->fd, queue->area, job->reader->sector, job->groups[g].sector);
+            uint64_t latency = reader_clock() - begin;
+
+            job->next = g + 1;
+            remaining -= 1;
+
+            if(result < 0 || !reader_complete(job, &job->groups[g], queue->area, result, latency))
+                reader_job_fail(job, &remaining);
+        }
+    }
+
+    return 1;
+}
+
+static int reader_fetch_uring(reader_queue_t *queue, reader_job_t *jobs, size_t count) {
+    size_t *unused = calloc(sizeof(size_t), queue->slots);
+    size_t available = queue->slots;
+    size_t remaining = 0;
+    size_t inflight = 0;
+    int success = 1;
+
+    if(!unused)
+        return 0;
+
+    for(size_t i = 0; i < queue->slots; i++)
+        unused[i] = i;
+
+    for(size_t j = 0; j < count; j++)
+        remaining += jobs[j].count;
+
+    while(inflight || (remaining && success)) {
+        int queued = 1;
+
+        // one sector per device and per pass, in device order, as
+        // long as buffers and the device depth allow
+        while(success && available && queued) {
+            queued = 0;
+
+            for(size_t j = 0; j < count && available; j++) {
+                reader_job_t *job = &jobs[j];
+
+                if(job->next == job->count || job->inflight == job->reader->depth)
+                    continue;
+
+                struct io_uring_sqe *sqe = uring_sqe(&queue->ring);
+
+                if(!sqe)
+                    break;
+
+                size_t slot = unused[--available];
+
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = job->reader->fd;
+                sqe->addr = (uintptr_t)(queue->area + (slot * queue->slotsize));
+                sqe->len = job->reader->sector;
+                sqe->off = job->groups[job->next].sector;
+                sqe->user_data = slot;
+
+                queue->jobs[slot] = j;
+                queue->groups[slot] = job->next;
+
+                // submitted right after the loop
+                queue->submitted[slot] = reader_clock();
+
+                job->next += 1;
+                job->inflight += 1;
+                remaining -= 1;
+                inflight += 1;
+                queued = 1;
+            }
+        }
+
+        if(uring_submit(&queue->ring, 0) < 0) {
+            success = 0;
+            break;
+        }
+
+        uint64_t userdata;
+        int32_t result;
+
+        if(uring_reap(&queue->ring, &userdata, &result, 1) <= 0) {
+            success = 0;
+            break;
+        }
+
+        size_t slot = userdata;
+        reader_job_t *job = &jobs[queue->jobs[slot]];
+        uint64_t latency = reader_clock() - queue->submitted[slot];
+
+        inflight -= 1;
+        job->inflight -= 1;
+        unused[available++] = slot;
+
+        if(result < 0) {
+            errno = -result;
+            reader_job_fail(job, &remaining);
+            continue;
+        }
+
+        if(!reader_complete(job, &job->groups[queue->groups[slot]], queue->area + (slot * queue->slotsize), result, latency))
+            reader_job_fail(job, &remaining);
+    }
+
+    // queue itself broke down, nothing left is read
+    for(size_t j = 0; j < count && !success; j++)
+        if(jobs[j].next < jobs[j].count || jobs[j].inflight)
+            reader_job_fail(&jobs[j], &remaining);
+
+    free(unused);
+
+    return success;
+}
+
+// (offset, position) pairs sorted by offset, and one group per
+// distinct sector (values never cross sectors)
+static int reader_job_prepare(reader_job_t *job) {
+    size_t sector = job->reader->sector;
+
+    job->count = 0;
+    job->next = 0;
+    job->inflight = 0;
+
+    if(!(job->sorted = calloc(sizeof(uint64_t) * 2, job->length ? job->length : 1)))
+        return 0;
+
+    for(size_t i = 0; i < job->length; i++) {
+        job->sorted[i * 2] = job->offsets[i];
+        job->sorted[(i * 2) + 1] = i;
+    }
+
+    qsort(job->sorted, job->length, sizeof(uint64_t) * 2, reader_compare);
+
+    if(!(job->groups = calloc(sizeof(reader_group_t), job->length ? job->length : 1)))
+        return 0;
+
+    for(size_t i = 0; i < job->length; i++) {
+        off_t offset = ((job->sorted[i * 2] * sizeof(uint64_t)) / sector) * sector;
+
+        if(job->count == 0 || job->groups[job->count - 1].sector != offset) {
+            job->groups[job->count].sector = offset;
+            job->groups[job->count].first = i;
+            job->count += 1;
+        }
+
+        job->groups[job->count - 1].count += 1;
+    }
+
+    return 1;
+}
+
+// read the datapoints of every job, interleaved on 'queue' (its
+// slots need to hold a sector of every reader), 'points' of each
+// job are filled in the same order as its 'offsets'. a failed read
+// only stops its own job ('failed' is set), returns 0 when any job
+// failed, errno is the one of the first failed job
+int reader_fetch_jobs(reader_queue_t *queue, reader_job_t *jobs, size_t count) {
+    int success = 1;
+
+    for(size_t j = 0; j < count; j++) {
+        jobs[j].sorted = NULL;
+        jobs[j].groups = NULL;
+        jobs[j].failed = 0;
+
+        if(!reader_job_prepare(&jobs[j])) {
+            jobs[j].failed = ENOMEM;
+            success = 0;
+        }
+    }
+
+    if(success) {
+        if(queue->uring)
+            success = reader_fetch_uring(queue, jobs, count);
+        else
+            success = reader_fetch_sync(queue, jobs, count);
+    }
+
+    for(size_t j = 0; j < count; j++) {
+        free(jobs[j].sorted);
+        free(jobs[j].groups);
+    }
+
+    for(size_t j = 0; j < count; j++) {
+        if(jobs[j].failed) {
+            errno = jobs[j].failed;
+            return 0;
+        }
+    }
+
+    return success;
+}
+
+// read 'length' values at 'offsets' (value index), 'points' are
+// filled in the same order as 'offsets', returns 0 on read failure
+int reader_fetch(reader_t *reader, const uint64_t *offsets, size_t length, datapoint_t *points) {
+    reader_job_t job = {
+        .reader = reader,
+        .offsets = offsets,
+        .length = length,
+        .points = points,
+    };
+
+    return reader_fetch_jobs(&reader->queue, &job, 1);
+}
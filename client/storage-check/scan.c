@@ -0,0 +1,417 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "uring.h"
+#include "crc64.h"
+#include "storage.h"
+
+//
+// full device chain scan
+//
+// every adjacent pair of the device needs v[i + 1] == crc64(v[i]),
+// no seed involved, so any chunk can be checked on its own. the
+// calling thread reads the device sequentially in large aligned
+// chunks (up to the reader depth in flight) while workers check
+// chunks as soon as they are loaded, CRC64_LANES pairs at a time.
+// each chunk is read one sector longer, the pair crossing into the
+// next chunk belongs to it. broken pairs are gathered in ranges per
+// chunk, and merged in device order when chunks are released
+//
+static double time_now() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    return now.tv_sec + (now.tv_usec / 1000000.0);
+}
+
+// bytes of chunk 'index' needed to check its pairs
+static size_t scan_chunk_length(scan_t *scan, size_t index) {
+    size_t position = scan->offset + (index * scan->chunksize);
+    size_t remaining = scan->size - position;
+    size_t wanted = scan->chunksize + sizeof(uint64_t);
+
+    return remaining < wanted ? remaining : wanted;
+}
+
+static void scan_mark(scan_result_t *result, uint64_t index, int broken) {
+    if(!broken) {
+        result->tail = 0;
+        return;
+    }
+
+    result->mismatches += 1;
+
+    if(!result->tail && result->ranges++ == 0)
+        result->first.first = index;
+
+    if(result->ranges == 1)
+        result->first.last = index;
+
+    result->tail = 1;
+}
+
+// pairs (values[i], values[i + 1]) for i < pairs, 'base' is the value
+// index of values[0]
+static void scan_check(scan_result_t *result, const uint64_t *values, size_t pairs, uint64_t base) {
+    uint64_t lanes[CRC64_LANES];
+    size_t i = 0;
+
+    memset(result, 0, sizeof(scan_result_t));
+
+    for(; i + CRC64_LANES <= pairs; i += CRC64_LANES) {
+        memcpy(lanes, values + i, sizeof(lanes));
+        crc64_x8(lanes, 1);
+
+        if(memcmp(lanes, values + i + 1, sizeof(lanes)) == 0) {
+            result->tail = 0;
+            continue;
+        }
+
+        for(size_t lane = 0; lane < CRC64_LANES; lane++)
+            scan_mark(result, base + i + lane, lanes[lane] != values[i + lane + 1]);
+    }
+
+    for(; i < pairs; i++)
+        scan_mark(result, base + i, values[i + 1] != crc64_u64(values[i]));
+
+    result->head = result->ranges && result->first.first == base;
+}
+
+// append the next chunk (device order) to the whole scan result,
+// a range running across chunks is counted once
+static void scan_merge(scan_result_t *scan, scan_result_t *chunk) {
+    scan->mismatches += chunk->mismatches;
+
+    if(chunk->ranges == 0) {
+        scan->tail = 0;
+        return;
+    }
+
+    if(scan->tail && chunk->head) {
+        // still the first range of the scan, it grows
+        if(scan->ranges == 1)
+            scan->first.last = chunk->first.last;
+
+        scan->ranges += chunk->ranges - 1;
+
+    } else {
+        if(scan->ranges == 0)
+            scan->first = chunk->first;
+
+        scan->ranges += chunk->ranges;
+    }
+
+    scan->tail = chunk->tail;
+}
+
+static void *scan_worker(void *args) {
+    scan_worker_t *worker = args;
+    scan_t *scan = worker->scan;
+
+    for(size_t index = worker->id; ; index += scan->workers) {
+        size_t slot = index % scan->slots;
+        double begin = time_now();
+
+        pthread_mutex_lock(&scan->lock);
+
+        // slots hold the index (+1) of the chunk they were loaded with
+        while(scan->loaded[slot] != index + 1 && !scan->failed && index < scan->chunks)
+            pthread_cond_wait(&scan->filled, &scan->lock);
+
+        int done = scan->failed || index >= scan->chunks;
+
+        pthread_mutex_unlock(&scan->lock);
+
+        worker->stall += time_now() - begin;
+
+        if(done)
+            break;
+
+        uint64_t *values = (uint64_t *)(scan->area + (slot * scan->slotsize));
+        size_t count = scan->lengths[slot] / sizeof(uint64_t);
+        uint64_t base = (scan->offset / sizeof(uint64_t)) + (index * (scan->chunksize / sizeof(uint64_t)));
+
+        scan_check(&scan->results[slot], values, count ? count - 1 : 0, base);
+
+        pthread_mutex_lock(&scan->lock);
+
+        scan->loaded[slot] = 0;
+        scan->checked[slot] = 1;
+
+        while(scan->released < scan->chunks && scan->checked[scan->released % scan->slots]) {
+            size_t next = scan->released % scan->slots;
+
+            scan_merge(&scan->result, &scan->results[next]);
+            scan->checked[next] = 0;
+            scan->released += 1;
+        }
+
+        pthread_cond_signal(&scan->drained);
+        pthread_mutex_unlock(&scan->lock);
+    }
+
+    return NULL;
+}
+
+// 'offset' (bytes) is rounded down to the sector, pairs are checked
+// from there up to the end of the device
+int scan_init(scan_t *scan, reader_t *reader, size_t workers, size_t chunksize, size_t offset) {
+    memset(scan, 0, sizeof(scan_t));
+
+    scan->reader = reader;
+    scan->size = reader->size;
+    scan->offset = (offset / reader->sector) * reader->sector;
+    scan->chunksize = ((chunksize + reader->sector - 1) / reader->sector) * reader->sector;
+    scan->slotsize = scan->chunksize + reader->sector;
+    scan->workers = workers;
+
+    if(scan->offset < scan->size)
+        scan->chunks = ((scan->size - scan->offset) + scan->chunksize - 1) / scan->chunksize;
+
+    // enough chunks to keep the queue full while every worker checks
+    scan->slots = (reader->depth * 2) + workers;
+
+    if(posix_memalign((void **) &scan->area, 4096, scan->slots * scan->slotsize))
+        return 0;
+
+    if(!(scan->loaded = calloc(sizeof(size_t), scan->slots)))
+        return 0;
+
+    if(!(scan->pending = calloc(sizeof(size_t), scan->slots)))
+        return 0;
+
+    if(!(scan->lengths = calloc(sizeof(ssize_t), scan->slots)))
+        return 0;
+
+    if(!(scan->checked = calloc(sizeof(int), scan->slots)))
+        return 0;
+
+    if(!(scan->results = calloc(sizeof(scan_result_t), scan->slots)))
+        return 0;
+
+    if(!(scan->threads = calloc(sizeof(scan_worker_t), workers)))
+        return 0;
+
+    pthread_mutex_init(&scan->lock, NULL);
+    pthread_cond_init(&scan->filled, NULL);
+    pthread_cond_init(&scan->drained, NULL);
+
+    return 1;
+}
+
+void scan_free(scan_t *scan) {
+    free(scan->area);
+    free(scan->loaded);
+    free(scan->pending);
+    free(scan->lengths);
+    free(scan->checked);
+    free(scan->results);
+    free(scan->threads);
+
+    pthread_mutex_destroy(&scan->lock);
+    pthread_cond_destroy(&scan->filled);
+    pthread_cond_destroy(&scan->drained);
+}
+
+static void scan_fail(scan_t *scan) {
+    pthread_mutex_lock(&scan->lock);
+    scan->failed = 1;
+    pthread_cond_broadcast(&scan->filled);
+    pthread_mutex_unlock(&scan->lock);
+}
+
+// queue the read of chunk 'index' in 'slot', done in place without
+// io_uring (then it's reaped right away)
+static int scan_read(scan_t *scan, size_t slot, size_t index) {
+    reader_t *reader = scan->reader;
+    size_t length = scan_chunk_length(scan, index);
+    off_t offset = scan->offset + (index * scan->chunksize);
+    char *buffer = scan->area + (slot * scan->slotsize);
+
+    // direct i/o transfers whole sectors, past the end is a short read
+    length = ((length + reader->sector - 1) / reader->sector) * reader->sector;
+    scan->pending[slot] = index;
+
+    if(!reader->queue.uring) {
+        ssize_t result = pread(reader->fd, buffer, length, offset);
+
+        if(result < 0)
+            return 0;
+
+        scan->lengths[slot] = result;
+        return 1;
+    }
+
+    struct io_uring_sqe *sqe = uring_sqe(&reader->queue.ring);
+
+    if(!sqe) {
+        errno = EBUSY;
+        return 0;
+    }
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = reader->fd;
+    sqe->addr = (uintptr_t) buffer;
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->user_data = slot;
+
+    return uring_submit(&reader->queue.ring, 0) >= 0;
+}
+
+static int scan_reap(scan_t *scan, size_t *slot, size_t last) {
+    reader_t *reader = scan->reader;
+    uint64_t userdata;
+    int32_t result;
+
+    if(!reader->queue.uring) {
+        *slot = last;
+
+    } else {
+        if(uring_reap(&reader->queue.ring, &userdata, &result, 1) <= 0)
+            return 0;
+
+        if(result < 0) {
+            errno = -result;
+            return 0;
+        }
+
+        *slot = userdata;
+        scan->lengths[*slot] = result;
+    }
+
+    // short read before the end of the device
+    if((size_t) scan->lengths[*slot] < scan_chunk_length(scan, scan->pending[*slot])) {
+        errno = EIO;
+        return 0;
+    }
+
+    scan->lengths[*slot] = scan_chunk_length(scan, scan->pending[*slot]);
+
+    return 1;
+}
+
+// read the whole device (from offset), returns 0 on read failure,
+// mismatches are not a failure. setting 'stopped' ends the scan
+// after the chunks already read, 'released' tells where it ended
+int scan_run(scan_t *scan) {
+    reader_t *reader = scan->reader;
+    size_t depth = reader->queue.uring ? reader->depth : 1;
+    double begin = time_now();
+    size_t submitted = 0;
+    size_t inflight = 0;
+    size_t started;
+    size_t last = 0;
+
+    for(started = 0; started < scan->workers; started++) {
+        scan_worker_t *worker = &scan->threads[started];
+
+        worker->scan = scan;
+        worker->id = started;
+
+        if(pthread_create(&worker->thread, NULL, scan_worker, worker)) {
+            perror("pthread_create");
+            scan_fail(scan);
+            break;
+        }
+    }
+
+    while(!scan->failed) {
+        pthread_mutex_lock(&scan->lock);
+        size_t released = scan->released;
+        pthread_mutex_unlock(&scan->lock);
+
+        if(released == scan->chunks)
+            break;
+
+        if(!scan->stopped && submitted < scan->chunks && inflight < depth && submitted - released < scan->slots) {
+            last = submitted % scan->slots;
+
+            if(!scan_read(scan, last, submitted)) {
+                perror("read");
+                scan_fail(scan);
+                break;
+            }
+
+            submitted += 1;
+            inflight += 1;
+            continue;
+        }
+
+        if(inflight) {
+            size_t slot;
+
+            if(!scan_reap(scan, &slot, last)) {
+                perror("read");
+                inflight -= 1;
+                scan_fail(scan);
+                break;
+            }
+
+            inflight -= 1;
+
+            pthread_mutex_lock(&scan->lock);
+            scan->loaded[slot] = scan->pending[slot] + 1;
+            pthread_cond_broadcast(&scan->filled);
+            pthread_mutex_unlock(&scan->lock);
+
+            continue;
+        }
+
+        // interrupted: everything read is checked, workers stop there
+        if(scan->stopped && released == submitted) {
+            pthread_mutex_lock(&scan->lock);
+            scan->chunks = submitted;
+            pthread_cond_broadcast(&scan->filled);
+            pthread_mutex_unlock(&scan->lock);
+            break;
+        }
+
+        // every slot is loaded and waiting to be checked
+        double waiting = time_now();
+
+        pthread_mutex_lock(&scan->lock);
+
+        while(scan->released == released)
+            pthread_cond_wait(&scan->drained, &scan->lock);
+
+        pthread_mutex_unlock(&scan->lock);
+
+        scan->read_stall += time_now() - waiting;
+    }
+
+    // requests still in flight reference our buffers
+    for(size_t slot; inflight && reader->queue.uring; inflight--)
+        scan_reap(scan, &slot, last);
+
+    for(size_t i = 0; i < started; i++) {
+        pthread_join(scan->threads[i].thread, NULL);
+        scan->check_stall += scan->threads[i].stall;
+    }
+
+    scan->elapsed = time_now() - begin;
+
+    pthread_mutex_lock(&scan->lock);
+    scan->finished = 1;
+    pthread_mutex_unlock(&scan->lock);
+
+    return !scan->failed;
+}
+
+// bytes checked so far, contiguous from the start offset
+size_t scan_progress(scan_t *scan, int *finished) {
+    pthread_mutex_lock(&scan->lock);
+    size_t checked = scan->released * scan->chunksize;
+    *finished = scan->finished;
+    pthread_mutex_unlock(&scan->lock);
+
+    size_t total = scan->size > scan->offset ? scan->size - scan->offset : 0;
+
+    return checked < total ? checked : total;
+}
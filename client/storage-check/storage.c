@@ -3,109 +3,193 @@
 #include <stdint.h>
 #include <sys/time.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <fcntl.h>
 #include <unistd.h>
 #include <getopt.h>
-#include <curl/curl.h>
-#include <jansson.h>
-#include <libgen.h>
+#include <signal.h>
+#include <errno.h>
+#include "crc64.h"
 #include "storage.h"
 
 static struct option long_options[] = {
     {"disk",   required_argument, 0, 'd'},
     {"nodeid", required_argument, 0, 'n'},
+    {"depth",  required_argument, 0, 'q'},
+    {"latencies", no_argument,    0, 'l'},
+    {"full-scan", no_argument,    0, 'f'},
+    {"offset", required_argument, 0, 'o'},
+    {"chunk",  required_argument, 0, 'c'},
+    {"threads", required_argument, 0, 't'},
+    {"json",   no_argument,       0, 'j'},
+    {"agent",  no_argument,       0, 'a'},
+    {"interval", required_argument, 0, 'i'},
+    {"merge",  required_argument, 0, 'm'},
     {"help",   no_argument,       0, 'h'},
     {0, 0, 0, 0}
 };
 
-typedef struct http_t {
-    char *data;
-    size_t size;
-
-} http_t;
+#define CHECK_MAX_DEVICES    128
+#define CHECK_DEFAULT_DEPTH  32
+#define AGENT_DEFAULT_INTERVAL  30
+#define AGENT_DEFAULT_MERGE     200
+#define SCAN_DEFAULT_DEPTH   8
+#define SCAN_DEFAULT_CHUNK   (4 * 1024 * 1024)
 
 void diep(char *str) {
     perror(str);
     exit(EXIT_FAILURE);
 }
 
-size_t curl_write_cb(char *in, size_t size, size_t nmemb, http_t *data) {
-    size_t r = size * nmemb;
+static double time_now() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
 
-    data->data = realloc(data->data, r);
-    memcpy(data->data + data->size, in, r);
-    data->size += r;
-    data->data[data->size - 1] = '\0';
+    return now.tv_sec + (now.tv_usec / 1000000.0);
+}
 
-    return r;
+static double speed(size_t size, double timed) {
+    return (size / timed) / (1024 * 1024);
 }
 
-static char *fetch_datapoints(char *endpoint) {
-    CURL *curl;
-    CURLcode res;
-    http_t http = {
-        .data = NULL,
-        .size = 0,
-    };
+// interrupted scan stops cleanly and tells where to resume
+static scan_t *scanning = NULL;
+
+static void scan_interrupt(int signum) {
+    (void) signum;
+
+    if(scanning)
+        scanning->stopped = 1;
+}
+
+static void *scan_thread(void *args) {
+    scan_t *scan = args;
+
+    scan_run(scan);
+
+    return NULL;
+}
+
+//
+// full device scan: local audit of the whole chain, no server involved,
+// returns 0 when every pair from 'offset' to the end is consistent
+//
+static int full_scan(char *target, size_t depth, size_t threads, size_t chunksize, size_t offset) {
+    reader_t reader;
+    scan_t scan;
+    pthread_t thread;
+
+    if(!reader_open(&reader, target, depth))
+        diep(target);
+
+    if(threads == 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(!scan_init(&scan, &reader, threads, chunksize, offset))
+        diep("scan");
+
+    size_t total = scan.offset < scan.size ? scan.size - scan.offset : 0;
+
+    printf("[+] crc64 implementation: %s\n", crc64_impl->name);
+    printf("[+] read engine: %s, queue depth %lu, %s, %.1f MB chunks, %lu workers\n", reader_name(&reader), reader.queue.uring ? depth : 1,
+            reader.direct ? "direct i/o (page cache bypassed)" : COLOR_YELLOW "page cache" COLOR_RESET, MB(scan.chunksize), threads);
 
-    if(!(curl = curl_easy_init()))
-        return NULL;
+    if(scan.offset)
+        printf("[+] resume: scanning from offset %lu, skipping %.2f GB\n", scan.offset, GB(scan.offset));
 
-    curl_easy_setopt(curl, CURLOPT_URL, endpoint);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &http);
+    printf("[+] scanning %.2f GB, press ctrl-c to stop (the scan can be resumed)\n", GB(total));
 
-    res = curl_easy_perform(curl);
+    scanning = &scan;
+    signal(SIGINT, scan_interrupt);
+    signal(SIGTERM, scan_interrupt);
 
-    if(res != CURLE_OK) {
-        fprintf(stderr, "[-] fetching data failed: %s\n", curl_easy_strerror(res));
-        curl_easy_cleanup(curl);
-        return NULL;
+    if(pthread_create(&thread, NULL, scan_thread, &scan))
+        diep("pthread_create");
+
+    double last = time_now();
+    size_t previous = 0;
+    int finished = 0;
+
+    while(!finished) {
+        usleep(250000);
+
+        size_t current = scan_progress(&scan, &finished);
+        double now = time_now();
+        double percent = total ? (current / (double) total) * 100 : 100;
+        size_t delta = current - previous;
+
+        printf("\r[+] scanning: %.2f %% [%.0f MB/s], offset %lu\033[0K", percent, MB(delta) / (now - last), scan.offset + current);
+        fflush(stdout);
+
+        previous = current;
+        last = now;
     }
 
-    curl_easy_cleanup(curl);
+    printf("\n");
 
-    return http.data;
-}
+    pthread_join(thread, NULL);
 
-static char *send_response(char *json, char *endpoint) {
-    CURL *curl;
-    CURLcode res;
-    struct curl_slist *headers = NULL;
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    scanning = NULL;
 
-    if(!(curl = curl_easy_init()))
-        return NULL;
+    size_t checked = scan_progress(&scan, &finished);
+    scan_result_t *result = &scan.result;
+    int success = 1;
 
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    printf("[+] scanned %.2f GB in %.1f seconds, read speed: %.0f MB/s\n", GB(checked), scan.elapsed, speed(checked, scan.elapsed));
+    printf("[+] stalls: reads waited %.1f seconds on checks, checks waited %.1f seconds on reads\n", scan.read_stall, scan.check_stall);
 
-    curl_easy_setopt(curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, -1L);
+    if(scan.failed) {
+        fprintf(stderr, "[-] " COLOR_RED "scan could not complete" COLOR_RESET ", read failed after offset %lu\n", scan.offset + checked);
+        success = 0;
 
-    curl_easy_setopt(curl, CURLOPT_URL, endpoint);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    } else if(checked < total) {
+        printf("[-] scan interrupted, resume with: --full-scan --offset %lu\n", scan.offset + checked);
+        success = 0;
+    }
 
-    res = curl_easy_perform(curl);
+    // pairs are named after their first value
+    if(result->mismatches) {
+        fprintf(stderr, "[-] chain: " COLOR_RED "%lu broken pairs in %lu ranges" COLOR_RESET "\n", result->mismatches, result->ranges);
+        fprintf(stderr, "[-] chain: first range at offset %lu - %lu (values %lu - %lu)\n",
+                result->first.first * sizeof(uint64_t), (result->first.last + 1) * sizeof(uint64_t) + (sizeof(uint64_t) - 1),
+                result->first.first, result->first.last + 1);
+        success = 0;
 
-    if(res != CURLE_OK) {
-        fprintf(stderr, "[-] fetching data failed: %s\n", curl_easy_strerror(res));
-        curl_easy_cleanup(curl);
-        return NULL;
+    } else {
+        printf("[+] chain: " COLOR_GREEN "consistent" COLOR_RESET " from offset %lu to %lu\n", scan.offset, scan.offset + checked);
     }
 
-    curl_easy_cleanup(curl);
+    scan_free(&scan);
+    reader_close(&reader);
 
-    return NULL;
+    return success ? 0 : 1;
+}
+
+// stopped agent finishes the challenges it's answering
+static agent_t *running = NULL;
+
+static void agent_interrupt(int signum) {
+    (void) signum;
+
+    if(running)
+        running->stopped = 1;
 }
 
 int main(int argc, char *argv[]) {
     int option_index = 0;
-    char *target = NULL;
+    char *targets[CHECK_MAX_DEVICES];
+    size_t count = 0;
     char *nodeid = NULL;
-    char endpoint[1024];
+    size_t depth = 0;
+    int detailed = 0;
+    int fullscan = 0;
+    size_t offset = 0;
+    size_t chunksize = SCAN_DEFAULT_CHUNK;
+    size_t threads = 0;
+    int binary = 1;
+    int agent = 0;
+    size_t interval = AGENT_DEFAULT_INTERVAL;
+    size_t merge = AGENT_DEFAULT_MERGE;
 
     printf(COLOR_CYAN "[+] initializing storage-proof verifier" COLOR_RESET "\n");
 
@@ -117,15 +201,74 @@ int main(int argc, char *argv[]) {
 
         switch(i) {
             case 'd':
-                target = optarg;
+                if(count == CHECK_MAX_DEVICES) {
+                    fprintf(stderr, "[-] too many devices (max %d)\n", CHECK_MAX_DEVICES);
+                    return 1;
+                }
+
+                targets[count++] = optarg;
                 break;
 
             case 'n':
                 nodeid = optarg;
                 break;
 
+            case 'q':
+                if((depth = strtoul(optarg, NULL, 10)) < 1) {
+                    fprintf(stderr, "[-] queue depth needs to be at least 1\n");
+                    return 1;
+                }
+                break;
+
+            case 'l':
+                detailed = 1;
+                break;
+
+            case 'f':
+                fullscan = 1;
+                break;
+
+            case 'j':
+                binary = 0;
+                break;
+
+            case 'a':
+                agent = 1;
+                break;
+
+            case 'i':
+                if((interval = strtoul(optarg, NULL, 10)) < 1) {
+                    fprintf(stderr, "[-] poll interval needs to be at least 1 second\n");
+                    return 1;
+                }
+                break;
+
+            case 'm':
+                merge = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'o':
+                offset = strtoull(optarg, NULL, 10);
+                break;
+
+            case 'c':
+                if((chunksize = strtoul(optarg, NULL, 10) * 1024 * 1024) == 0) {
+                    fprintf(stderr, "[-] chunk size needs to be at least 1 MB\n");
+                    return 1;
+                }
+                break;
+
+            case 't':
+                if((threads = strtoul(optarg, NULL, 10)) < 1) {
+                    fprintf(stderr, "[-] at least 1 check thread is needed\n");
+                    return 1;
+                }
+                break;
+
             case 'h':
-                printf("help\n");
+                printf("usage: %s --disk DEVICE [--disk DEVICE ...] --nodeid NODEID [--depth N] [--latencies] [--json]\n", argv[0]);
+                printf("       %s --agent --disk DEVICE [--disk DEVICE ...] --nodeid NODEID [--interval SECONDS] [--merge MS] [--depth N] [--latencies] [--json]\n", argv[0]);
+                printf("       %s --disk DEVICE --full-scan [--offset BYTES] [--depth N] [--chunk MB] [--threads N]\n", argv[0]);
                 return 1;
 
             case '?':
@@ -135,72 +278,90 @@ int main(int argc, char *argv[]) {
 
     }
 
-    if(target == NULL) {
+    if(count == 0) {
         fprintf(stderr, "[-] missing target device\n");
         return 1;
     }
 
-    if(nodeid == NULL) {
-        fprintf(stderr, "[-] missing nodeid\n");
+    if(count > 1 && fullscan) {
+        fprintf(stderr, "[-] full scan checks one device at a time\n");
         return 1;
     }
 
-    char *webtarget = basename(target);
+    if(fullscan)
+        return full_scan(targets[0], depth ? depth : SCAN_DEFAULT_DEPTH, threads, chunksize, offset);
 
-    struct stat sb;
-    if(lstat(target, &sb) < 0)
-        diep(target);
+    if(depth == 0)
+        depth = CHECK_DEFAULT_DEPTH;
 
-    if(sb.st_mode & S_IFBLK) {
-        printf(COLOR_GREEN "[+] running on block device" COLOR_RESET "\n");
+    if(nodeid == NULL) {
+        fprintf(stderr, "[-] missing nodeid\n");
+        return 1;
     }
 
-    if(sb.st_mode & S_IFREG) {
-        printf(COLOR_YELLOW "[+] running on regular file (debug only)" COLOR_RESET "\n");
-    }
+    curl_global_init(CURL_GLOBAL_DEFAULT);
 
-    int fd;
-    if((fd = open(target, O_RDONLY)) < 0)
-        diep("open");
+    disk_t disks[CHECK_MAX_DEVICES];
+    size_t ready = 0;
 
-    sprintf(endpoint, "http://127.0.0.1:6010/proof/challenge/%s/%s", nodeid, webtarget);
-    printf("[+] fetching verification datapoints: %s\n", endpoint);
-    char *json = fetch_datapoints(endpoint);
+    // a device we can't open doesn't hold the others
+    for(size_t i = 0; i < count; i++) {
+        if(disk_open(&disks[i], targets[i], depth)) {
+            ready += 1;
+            continue;
+        }
 
-    json_error_t jsonerror;
-    json_t *root = json_loads(json, 0, &jsonerror);
+        fprintf(stderr, "[-] %s: " COLOR_RED "%s" COLOR_RESET ", device skipped\n", targets[i], strerror(errno));
+    }
 
-    if(!json_is_array(root)) {
-        printf("malformed expected json response\n");
+    if(ready == 0) {
+        fprintf(stderr, "[-] no device could be opened\n");
         return 1;
     }
 
-    size_t length = json_array_size(root);
-    json_t *response = json_object();
-    char convert[32];
+    if(agent) {
+        agent_t state;
 
-    printf("[+] reading %lu datapoints\n", length);
+        if(!agent_init(&state, disks, count, nodeid))
+            diep("agent");
 
-    for(size_t i = 0; i < length; i++) {
-        json_t *item = json_array_get(root, i);
-        const char *sitem = json_string_value(item);
-        uint64_t index = atoll(sitem);
+        state.binary = binary;
+        state.detailed = detailed;
+        state.interval = interval;
+        state.merge = merge;
 
-        lseek(fd, index * sizeof(uint64_t), SEEK_SET);
-        uint64_t value;
+        running = &state;
+        signal(SIGINT, agent_interrupt);
+        signal(SIGTERM, agent_interrupt);
 
-        if(read(fd, &value, sizeof(value)) != sizeof(value))
-            diep("read");
+        int success = agent_run(&state);
 
-        sprintf(convert, "%016lx", value);
-        json_object_set_new(response, sitem, json_string(convert));
+        printf("[+] agent: stopped, %lu challenges answered\n", state.answered);
+
+        agent_free(&state);
+
+        for(size_t i = 0; i < count; i++)
+            disk_close(&disks[i]);
+
+        return success ? 0 : 1;
     }
 
-    char *reply = json_dumps(response, 0);
-    puts(reply);
+    parallel_t check;
+
+    if(!parallel_init(&check, disks, count, nodeid))
+        diep("parallel");
 
-    sprintf(endpoint, "http://127.0.0.1:6010/proof/verify/%s/%s", nodeid, webtarget);
-    send_response(reply, endpoint);
+    check.binary = binary;
+    check.detailed = detailed;
+
+    int success = parallel_run(&check);
+
+    parallel_free(&check);
+
+    for(size_t i = 0; i < count; i++) {
+        disk_release(&disks[i]);
+        disk_close(&disks[i]);
+    }
 
-    return 0;
+    return success ? 0 : 1;
 }
@@ -1,6 +1,403 @@
 #ifndef STORAGE_CHECK_H
     #define STORAGE_CHECK_H
 
+    #include <stdint.h>
+    #include <stddef.h>
+    #include <pthread.h>
+    #include <sys/types.h>
+    #include <curl/curl.h>
+    #include "uring.h"
+
+    #define HISTOGRAM_BITS     4
+    #define HISTOGRAM_SUB      (1 << HISTOGRAM_BITS)
+    #define HISTOGRAM_BUCKETS  ((64 - HISTOGRAM_BITS + 1) * HISTOGRAM_SUB)
+
+    typedef struct histogram_t {
+        uint64_t buckets[HISTOGRAM_BUCKETS];
+        uint64_t count;
+        uint64_t sum;
+        uint64_t min;
+        uint64_t max;
+
+    } histogram_t;
+
+    void histogram_init(histogram_t *histogram);
+    void histogram_add(histogram_t *histogram, uint64_t value);
+    uint64_t histogram_min(histogram_t *histogram);
+    uint64_t histogram_percentile(histogram_t *histogram, double percent);
+
+    typedef struct datapoint_t {
+        uint64_t value;
+        uint64_t latency;   // nanoseconds
+        int consistent;     // local chain of the whole block
+
+    } datapoint_t;
+
+    // reads in flight, one sector buffer each, shared by every reader
+    // of a batch (reader_fetch uses the reader's own one)
+    typedef struct reader_queue_t {
+        int uring;
+        uring_t ring;
+
+        char *area;
+        size_t slots;
+        size_t slotsize;
+
+        // job and sector group of each slot, and its submission time
+        size_t *jobs;
+        size_t *groups;
+        uint64_t *submitted;
+
+    } reader_queue_t;
+
+    typedef struct reader_t {
+        int fd;
+        int direct;
+        int rotational;   // as reported by the kernel, -1 if unknown
+        size_t sector;
+        size_t size;
+
+        // reads in flight on this device at most
+        size_t depth;
+        reader_queue_t queue;
+
+        // sectors read so far, broken ones and their latency (nanoseconds)
+        size_t sectors;
+        size_t inconsistent;
+        histogram_t latency;
+
+    } reader_t;
+
+    // datapoints of one reader, read along with other jobs
+    typedef struct reader_job_t {
+        reader_t *reader;
+        const uint64_t *offsets;
+        size_t length;
+        datapoint_t *points;
+
+        uint64_t *sorted;
+        struct reader_group_t *groups;
+        size_t count;
+        size_t next;
+        size_t inflight;
+        int failed;   // errno of the read that failed this job
+
+    } reader_job_t;
+
+    int reader_open(reader_t *reader, char *target, size_t depth);
+    const char *reader_name(reader_t *reader);
+    void reader_reset(reader_t *reader);
+    int reader_fetch(reader_t *reader, const uint64_t *offsets, size_t length, datapoint_t *points);
+    void reader_close(reader_t *reader);
+
+    int reader_queue_init(reader_queue_t *queue, size_t slots, size_t slotsize);
+    void reader_queue_free(reader_queue_t *queue);
+    int reader_fetch_jobs(reader_queue_t *queue, reader_job_t *jobs, size_t count);
+
+    // contiguous run of broken pairs, value index of the first
+    // value of its first and last pair
+    typedef struct scan_range_t {
+        uint64_t first;
+        uint64_t last;
+
+    } scan_range_t;
+
+    // broken pairs of one chunk (or of the whole scan)
+    typedef struct scan_result_t {
+        size_t mismatches;
+        size_t ranges;
+        scan_range_t first;
+        int head;   // first pair is broken
+        int tail;   // last pair is broken
+
+    } scan_result_t;
+
+    typedef struct scan_worker_t {
+        struct scan_t *scan;
+        pthread_t thread;
+        size_t id;
+        double stall;
+
+    } scan_worker_t;
+
+    typedef struct scan_t {
+        reader_t *reader;
+        size_t offset;
+        size_t size;
+
+        // ring of chunks, loaded by the reader and released to it
+        // once checked, in ring order. each read goes one sector
+        // past its chunk, the pair across chunks is checked too
+        char *area;
+        size_t *loaded;
+        size_t *pending;
+        ssize_t *lengths;
+        int *checked;
+        scan_result_t *results;
+        size_t slots;
+        size_t slotsize;
+        size_t chunksize;
+        size_t chunks;
+
+        scan_worker_t *threads;
+        size_t workers;
+
+        pthread_mutex_t lock;
+        pthread_cond_t filled;
+        pthread_cond_t drained;
+        size_t released;
+        int finished;
+        int failed;
+        volatile int stopped;
+
+        // merged in device order
+        scan_result_t result;
+
+        double read_stall;
+        double check_stall;
+        double elapsed;
+
+    } scan_t;
+
+    int scan_init(scan_t *scan, reader_t *reader, size_t workers, size_t chunksize, size_t offset);
+    int scan_run(scan_t *scan);
+    size_t scan_progress(scan_t *scan, int *finished);
+    void scan_free(scan_t *scan);
+
+    //
+    // challenge transport
+    //
+    // challenges are fetched with "Accept: application/x-capacity-challenge",
+    // a server knowing it answers with the binary encoding, any other
+    // answer is the legacy json (a list of offsets, or the offsets key,
+    // size and count). both are parsed while they are received, straight
+    // into a packed array of offsets
+    //
+    //   0   magic     "CAPC"
+    //   4   version   uint8
+    //   5   flags     uint8
+    //   6   reserved  uint16
+    //   8   count     uint64 le
+    //   16  key       uint64 le   (derived only)
+    //   24  size      uint64 le   (derived only)
+    //   32  offsets   count * varint, delta from previous offset
+    //
+    // with CHALLENGE_DERIVED, offsets are regenerated from (key, size,
+    // count) like derived reports, nothing follows the header
+    //
+    // a binary challenge is answered in binary as well, values come in
+    // the challenge order, the offsets are implicit
+    //
+    //   0   magic     "CAPV"
+    //   4   version   uint8
+    //   5   flags     uint8
+    //   6   reserved  uint16
+    //   8   count     uint64 le
+    //   16  values    count * uint64 le
+    //   ..  latencies count * uint32 le, microseconds (RESPONSE_LATENCIES)
+    //   ..  json object {"timing": ..., "consistency": ...}, up to the end
+    //
+    // responses (binary or json) are generated while they are sent,
+    // with chunked transfer encoding
+    //
+    #define CHALLENGE_MAGIC    "CAPC"
+    #define CHALLENGE_VERSION  1
+    #define CHALLENGE_HEADER   32
+    #define CHALLENGE_DERIVED  0x01
+    #define CHALLENGE_MIME     "application/x-capacity-challenge"
+
+    #define RESPONSE_MAGIC      "CAPV"
+    #define RESPONSE_VERSION    1
+    #define RESPONSE_HEADER     16
+    #define RESPONSE_LATENCIES  0x01
+    #define RESPONSE_MIME       "application/x-capacity-response"
+
+    // legacy json object is small, it's kept whole
+    #define CHALLENGE_OBJECT_MAX  (64 * 1024)
+
+    typedef struct challenge_t {
+        uint64_t *offsets;
+        size_t length;
+        size_t allocated;
+        int binary;
+        int state;
+
+        // binary header, and varint being decoded
+        uint8_t header[CHALLENGE_HEADER];
+        size_t headerlen;
+        uint64_t expected;
+        uint64_t previous;
+        uint64_t value;
+        unsigned shift;
+
+        // json number being decoded
+        int digits;
+
+        // legacy json object
+        char *object;
+        size_t objectlen;
+
+        size_t received;
+        struct curl_slist *headers;
+
+    } challenge_t;
+
+    typedef struct upload_t {
+        const uint64_t *offsets;
+        const datapoint_t *points;
+        size_t length;
+        int binary;
+        int detailed;
+
+        // small json objects sent after the values (owned)
+        char *timing;
+        char *consistency;
+
+        // what is being sent: one step of the layout, one part of it
+        // (prefix, body, suffix) and a piece of that part, formatted
+        // in 'scratch' or pointing to a string
+        int step;
+        int part;
+        size_t index;
+        const char *piece;
+        size_t piecelen;
+        char scratch[16384];
+
+        size_t sent;
+
+        // transfer: request headers, server reply
+        struct curl_slist *headers;
+        char *reply;
+        size_t replylen;
+
+    } upload_t;
+
+    int challenge_prepare(challenge_t *challenge, CURL *curl, char *endpoint, int binary);
+    int challenge_complete(challenge_t *challenge, CURLcode res);
+    int challenge_fetch(challenge_t *challenge, CURL *curl, char *endpoint, int binary);
+    void challenge_free(challenge_t *challenge);
+
+    void upload_init(upload_t *upload, int binary, int detailed, const uint64_t *offsets, const datapoint_t *points, size_t length, char *timing, char *consistency);
+    int upload_prepare(upload_t *upload, CURL *curl, char *endpoint);
+    int upload_complete(upload_t *upload, CURLcode res, char **reply);
+    int upload_send(upload_t *upload, CURL *curl, char *endpoint, char **reply);
+    void upload_free(upload_t *upload);
+
+    int transport_get(CURL *curl, char *endpoint, char **body, volatile int *stopped);
+
+    #define CHECK_SERVER  "http://127.0.0.1:6010"
+
+    typedef struct disk_t {
+        char *target;
+        char *name;   // in endpoints
+        int ready;    // opened, can be challenged
+
+        reader_t reader;
+        challenge_t challenge;
+        datapoint_t *points;
+        double elapsed;
+
+        // agent: challenge waiting on the server, failed ones
+        // are left alone until 'backoff' (seconds)
+        int pending;
+        double backoff;
+
+    } disk_t;
+
+    int disk_open(disk_t *disk, char *target, size_t depth);
+    int disk_challenge(disk_t *disk, CURL *curl, char *nodeid, int binary);
+    int disk_challenge_prepare(disk_t *disk, CURL *curl, char *nodeid, int binary);
+    int disk_challenge_complete(disk_t *disk, CURLcode res);
+    void disk_job(disk_t *disk, reader_job_t *job);
+    int disk_respond(disk_t *disk, CURL *curl, char *nodeid, int detailed);
+    int disk_respond_prepare(disk_t *disk, upload_t *upload, CURL *curl, char *nodeid, int detailed);
+    int disk_respond_complete(disk_t *disk, upload_t *upload, CURLcode res);
+    void disk_release(disk_t *disk);
+    void disk_close(disk_t *disk);
+
+    //
+    // agent: long running, devices stay open with one read queue for
+    // all of them, one http connection is kept alive. pending
+    // challenges are long polled, the ones arriving close together
+    // are read in a single batch
+    //
+    typedef struct agent_t {
+        disk_t *disks;
+        size_t count;
+        char *nodeid;
+        int binary;
+        int detailed;
+
+        size_t interval;   // seconds, longest wait of a poll
+        size_t merge;      // milliseconds
+
+        CURL *curl;
+        reader_queue_t queue;
+        reader_job_t *jobs;
+        disk_t **answering;
+
+        volatile int stopped;
+        size_t answered;
+
+    } agent_t;
+
+    int agent_init(agent_t *agent, disk_t *disks, size_t count, char *nodeid);
+    int agent_run(agent_t *agent);
+    void agent_free(agent_t *agent);
+
+    //
+    // parallel check: every disk is challenged once, at the same time.
+    // challenges are fetched and responses posted by one multi handle,
+    // each device is read by its own thread on its own queue, a disk
+    // posts its response as soon as it's read, without waiting for
+    // the others
+    //
+    enum {
+        PARALLEL_FETCHING,
+        PARALLEL_READING,
+        PARALLEL_READ,
+        PARALLEL_POSTING,
+        PARALLEL_DONE,
+        PARALLEL_FAILED,
+    };
+
+    typedef struct parallel_disk_t {
+        disk_t *disk;
+        struct parallel_t *parallel;
+
+        CURL *curl;
+        upload_t upload;
+        pthread_t thread;
+        int state;
+        int success;
+
+        // seconds since the start of the check
+        double fetched;
+        double read;
+        double posted;
+
+    } parallel_disk_t;
+
+    typedef struct parallel_t {
+        parallel_disk_t *disks;
+        size_t count;
+        char *nodeid;
+        int binary;
+        int detailed;
+
+        CURLM *multi;
+        pthread_mutex_t lock;   // disks state, while reading
+        double begin;
+
+    } parallel_t;
+
+    int parallel_init(parallel_t *parallel, disk_t *disks, size_t count, char *nodeid);
+    int parallel_run(parallel_t *parallel);
+    void parallel_free(parallel_t *parallel);
+
+    #define MB(x)   (x / (1024 * 1024.0))
+    #define GB(x)   (x / (1024 * 1024 * 1024.0))
+
     #define COLOR_RED    "\033[31;1m"
     #define COLOR_YELLOW "\033[33;1m"
     #define COLOR_BLUE   "\033[34;1m"
@@ -0,0 +1,743 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <curl/curl.h>
+#include <jansson.h>
+#include "offsets.h"
+#include "storage.h"
+
+//
+// challenge transport
+//
+// nothing scales with the challenge but the offsets array itself: the
+// challenge is decoded while it's received (no body buffer, no json
+// tree), the response is generated while it's sent (no json tree, no
+// body string). see storage.h for the binary layouts
+//
+typedef struct http_t {
+    char *data;
+    size_t size;
+
+} http_t;
+
+static size_t curl_write_cb(char *in, size_t size, size_t nmemb, http_t *data) {
+    size_t r = size * nmemb;
+    char *grown;
+
+    if(!(grown = realloc(data->data, data->size + r + 1)))
+        return 0;
+
+    data->data = grown;
+    memcpy(data->data + data->size, in, r);
+    data->size += r;
+    data->data[data->size] = '\0';
+
+    return r;
+}
+
+// reuse the handle of the caller (and its live connections) when
+// there is one, a fresh one otherwise
+static CURL *transport_handle(CURL *shared) {
+    if(!shared)
+        return curl_easy_init();
+
+    curl_easy_reset(shared);
+
+    return shared;
+}
+
+static void transport_release(CURL *curl, CURL *shared) {
+    if(curl != shared)
+        curl_easy_cleanup(curl);
+}
+
+static int transport_abort(volatile int *stopped, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+    (void) dltotal;
+    (void) dlnow;
+    (void) ultotal;
+    (void) ulnow;
+
+    return *stopped;
+}
+
+// plain get of a (small) body, 'stopped' (can be NULL) aborts the
+// transfer as soon as it's set, returns 0 on failure
+int transport_get(CURL *shared, char *endpoint, char **body, volatile int *stopped) {
+    http_t http = {
+        .data = NULL,
+        .size = 0,
+    };
+    CURL *curl;
+    CURLcode res;
+
+    *body = NULL;
+
+    if(!(curl = transport_handle(shared)))
+        return 0;
+
+    curl_easy_setopt(curl, CURLOPT_URL, endpoint);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &http);
+
+    if(stopped) {
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, transport_abort);
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, stopped);
+    }
+
+    res = curl_easy_perform(curl);
+
+    transport_release(curl, shared);
+
+    if(res != CURLE_OK) {
+        if(!stopped || !*stopped)
+            fprintf(stderr, "[-] fetching data failed: %s\n", curl_easy_strerror(res));
+
+        free(http.data);
+        return 0;
+    }
+
+    *body = http.data;
+
+    return 1;
+}
+
+static void le64_store(uint8_t *dst, uint64_t value) {
+    for(int i = 0; i < 8; i++)
+        dst[i] = value >> (i * 8);
+}
+
+static uint64_t le64_load(const uint8_t *src) {
+    uint64_t value = 0;
+
+    for(int i = 0; i < 8; i++)
+        value |= (uint64_t) src[i] << (i * 8);
+
+    return value;
+}
+
+static void le32_store(uint8_t *dst, uint32_t value) {
+    for(int i = 0; i < 4; i++)
+        dst[i] = value >> (i * 8);
+}
+
+//
+// challenge decoder
+//
+enum {
+    CHALLENGE_START,
+    CHALLENGE_HEADER_READ,
+    CHALLENGE_VARINTS,
+    CHALLENGE_OBJECT,
+    CHALLENGE_VALUE,
+    CHALLENGE_STRING,
+    CHALLENGE_NUMBER,
+    CHALLENGE_NEXT,
+    CHALLENGE_DONE,
+    CHALLENGE_FAILED,
+};
+
+static int challenge_push(challenge_t *challenge, uint64_t offset) {
+    if(challenge->length == challenge->allocated) {
+        size_t allocated = challenge->allocated ? challenge->allocated * 2 : 1024;
+        uint64_t *grown;
+
+        if(!(grown = realloc(challenge->offsets, allocated * sizeof(uint64_t))))
+            return 0;
+
+        challenge->offsets = grown;
+        challenge->allocated = allocated;
+    }
+
+    challenge->offsets[challenge->length++] = offset;
+
+    return 1;
+}
+
+static int challenge_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static int challenge_digit(challenge_t *challenge, char c) {
+    uint64_t digit = c - '0';
+
+    if(challenge->value > (UINT64_MAX - digit) / 10)
+        return 0;
+
+    challenge->value = (challenge->value * 10) + digit;
+    challenge->digits += 1;
+
+    return 1;
+}
+
+static int challenge_header(challenge_t *challenge) {
+    uint8_t *header = challenge->header;
+
+    if(memcmp(header, CHALLENGE_MAGIC, 4) != 0 || header[4] != CHALLENGE_VERSION || (header[5] & ~CHALLENGE_DERIVED))
+        return 0;
+
+    challenge->expected = le64_load(header + 8);
+
+    if(!(challenge->offsets = calloc(sizeof(uint64_t), challenge->expected ? challenge->expected : 1)))
+        return 0;
+
+    challenge->allocated = challenge->expected;
+
+    if(header[5] & CHALLENGE_DERIVED) {
+        offsets_generate(challenge->offsets, le64_load(header + 16), le64_load(header + 24), challenge->expected);
+        challenge->length = challenge->expected;
+        challenge->state = CHALLENGE_DONE;
+        return 1;
+    }
+
+    challenge->state = CHALLENGE_VARINTS;
+
+    return 1;
+}
+
+// one byte of the body, returns 0 on malformed challenge
+static int challenge_byte(challenge_t *challenge, uint8_t byte) {
+    char c = byte;
+
+    switch(challenge->state) {
+        case CHALLENGE_START:
+            if(challenge_space(c))
+                return 1;
+
+            if(c == CHALLENGE_MAGIC[0]) {
+                challenge->binary = 1;
+                challenge->state = CHALLENGE_HEADER_READ;
+                challenge->header[challenge->headerlen++] = byte;
+                return 1;
+            }
+
+            if(c == '{') {
+                challenge->state = CHALLENGE_OBJECT;
+                return challenge_byte(challenge, byte);
+            }
+
+            if(c == '[') {
+                challenge->state = CHALLENGE_VALUE;
+                return 1;
+            }
+
+            return 0;
+
+        case CHALLENGE_HEADER_READ:
+            challenge->header[challenge->headerlen++] = byte;
+
+            if(challenge->headerlen == CHALLENGE_HEADER)
+                return challenge_header(challenge);
+
+            return 1;
+
+        case CHALLENGE_VARINTS:
+            if(challenge->length == challenge->expected || challenge->shift >= 64)
+                return 0;
+
+            challenge->value |= (uint64_t)(byte & 0x7f) << challenge->shift;
+            challenge->shift += 7;
+
+            if(byte & 0x80)
+                return 1;
+
+            challenge->previous += challenge->value;
+            challenge->offsets[challenge->length++] = challenge->previous;
+            challenge->value = 0;
+            challenge->shift = 0;
+
+            return 1;
+
+        case CHALLENGE_OBJECT:
+            if(challenge->objectlen == CHALLENGE_OBJECT_MAX)
+                return 0;
+
+            if(!challenge->object && !(challenge->object = malloc(CHALLENGE_OBJECT_MAX + 1)))
+                return 0;
+
+            challenge->object[challenge->objectlen++] = c;
+
+            return 1;
+
+        case CHALLENGE_VALUE:
+            if(challenge_space(c))
+                return 1;
+
+            challenge->value = 0;
+            challenge->digits = 0;
+
+            if(c == '"') {
+                challenge->state = CHALLENGE_STRING;
+                return 1;
+            }
+
+            if(c >= '0' && c <= '9') {
+                challenge->state = CHALLENGE_NUMBER;
+                return challenge_digit(challenge, c);
+            }
+
+            // empty list
+            if(c == ']' && challenge->length == 0) {
+                challenge->state = CHALLENGE_DONE;
+                return 1;
+            }
+
+            return 0;
+
+        case CHALLENGE_STRING:
+            if(c >= '0' && c <= '9')
+                return challenge_digit(challenge, c);
+
+            if(c != '"' || challenge->digits == 0)
+                return 0;
+
+            challenge->state = CHALLENGE_NEXT;
+
+            return challenge_push(challenge, challenge->value);
+
+        case CHALLENGE_NUMBER:
+            if(c >= '0' && c <= '9')
+                return challenge_digit(challenge, c);
+
+            challenge->state = CHALLENGE_NEXT;
+
+            if(!challenge_push(challenge, challenge->value))
+                return 0;
+
+            return challenge_byte(challenge, byte);
+
+        case CHALLENGE_NEXT:
+            if(challenge_space(c))
+                return 1;
+
+            if(c == ',') {
+                challenge->state = CHALLENGE_VALUE;
+                return 1;
+            }
+
+            if(c == ']') {
+                challenge->state = CHALLENGE_DONE;
+                return 1;
+            }
+
+            return 0;
+
+        case CHALLENGE_DONE:
+            // nothing can follow a binary challenge, json can end with spaces
+            return !challenge->binary && challenge_space(c);
+    }
+
+    return 0;
+}
+
+static size_t challenge_write_cb(char *in, size_t size, size_t nmemb, challenge_t *challenge) {
+    size_t r = size * nmemb;
+
+    challenge->received += r;
+
+    for(size_t i = 0; i < r; i++) {
+        if(!challenge_byte(challenge, in[i])) {
+            challenge->state = CHALLENGE_FAILED;
+            return 0;
+        }
+    }
+
+    return r;
+}
+
+// legacy json object: the offsets key, size and count from which
+// offsets are derived
+static int challenge_object(challenge_t *challenge) {
+    json_error_t jsonerror;
+    json_t *root;
+    int success = 0;
+
+    challenge->object[challenge->objectlen] = '\0';
+
+    if(!(root = json_loads(challenge->object, 0, &jsonerror)))
+        return 0;
+
+    const char *key = json_string_value(json_object_get(root, "key"));
+    json_t *size = json_object_get(root, "size");
+    json_t *count = json_object_get(root, "count");
+
+    if(key && json_is_integer(size) && json_is_integer(count) && json_integer_value(count) >= 0) {
+        challenge->length = json_integer_value(count);
+
+        if((challenge->offsets = calloc(sizeof(uint64_t), challenge->length ? challenge->length : 1))) {
+            offsets_generate(challenge->offsets, strtoull(key, NULL, 16), json_integer_value(size), challenge->length);
+            success = 1;
+        }
+    }
+
+    json_decref(root);
+
+    return success;
+}
+
+static int challenge_finish(challenge_t *challenge) {
+    switch(challenge->state) {
+        case CHALLENGE_VARINTS:
+            return challenge->length == challenge->expected && challenge->shift == 0;
+
+        case CHALLENGE_OBJECT:
+            return challenge_object(challenge);
+
+        case CHALLENGE_DONE:
+            return 1;
+    }
+
+    return 0;
+}
+
+// set 'curl' up to fetch and decode a challenge, binary is asked for
+// unless 'binary' is 0, the transfer is run by the caller (easy or
+// multi handle) and its result given to challenge_complete
+int challenge_prepare(challenge_t *challenge, CURL *curl, char *endpoint, int binary) {
+    memset(challenge, 0, sizeof(challenge_t));
+
+    if(binary)
+        challenge->headers = curl_slist_append(NULL, "Accept: " CHALLENGE_MIME ", application/json");
+    else
+        challenge->headers = curl_slist_append(NULL, "Accept: application/json");
+
+    if(!challenge->headers)
+        return 0;
+
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, challenge->headers);
+    curl_easy_setopt(curl, CURLOPT_URL, endpoint);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, challenge_write_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, challenge);
+
+    return 1;
+}
+
+// returns 0 on failure (transfer or malformed challenge)
+int challenge_complete(challenge_t *challenge, CURLcode res) {
+    curl_slist_free_all(challenge->headers);
+    challenge->headers = NULL;
+
+    if(challenge->state == CHALLENGE_FAILED) {
+        fprintf(stderr, "[-] malformed challenge (after %lu bytes)\n", challenge->received);
+        return 0;
+    }
+
+    if(res != CURLE_OK) {
+        fprintf(stderr, "[-] fetching data failed: %s\n", curl_easy_strerror(res));
+        return 0;
+    }
+
+    if(!challenge_finish(challenge)) {
+        fprintf(stderr, "[-] malformed or truncated challenge (%lu bytes)\n", challenge->received);
+        return 0;
+    }
+
+    return 1;
+}
+
+// fetch and decode a challenge, returns 0 on failure
+int challenge_fetch(challenge_t *challenge, CURL *shared, char *endpoint, int binary) {
+    CURL *curl;
+    CURLcode res;
+
+    if(!(curl = transport_handle(shared)))
+        return 0;
+
+    if(!challenge_prepare(challenge, curl, endpoint, binary)) {
+        transport_release(curl, shared);
+        return 0;
+    }
+
+    res = curl_easy_perform(curl);
+
+    transport_release(curl, shared);
+
+    return challenge_complete(challenge, res);
+}
+
+void challenge_free(challenge_t *challenge) {
+    free(challenge->offsets);
+    free(challenge->object);
+    curl_slist_free_all(challenge->headers);
+}
+
+//
+// response encoder
+//
+// binary: header, values, latencies, {"timing": ..., "consistency": ...}
+// json:   {"offset": "value", ..., "timing": {..., "datapoints": {...}}, "consistency": ...}
+//
+enum {
+    UPLOAD_OPEN,
+    UPLOAD_VALUES,
+    UPLOAD_LATENCIES,
+    UPLOAD_TIMING,
+    UPLOAD_CONSISTENCY,
+    UPLOAD_END,
+};
+
+static const int upload_binary_steps[] = {UPLOAD_OPEN, UPLOAD_VALUES, UPLOAD_LATENCIES, UPLOAD_TIMING, UPLOAD_CONSISTENCY, UPLOAD_END};
+static const int upload_json_steps[] = {UPLOAD_OPEN, UPLOAD_VALUES, UPLOAD_TIMING, UPLOAD_LATENCIES, UPLOAD_CONSISTENCY, UPLOAD_END};
+
+#define UPLOAD_ENTRY_MAX  64
+
+void upload_init(upload_t *upload, int binary, int detailed, const uint64_t *offsets, const datapoint_t *points, size_t length, char *timing, char *consistency) {
+    memset(upload, 0, sizeof(upload_t));
+
+    upload->binary = binary;
+    upload->detailed = detailed;
+    upload->offsets = offsets;
+    upload->points = points;
+    upload->length = length;
+    upload->timing = timing;
+    upload->consistency = consistency;
+}
+
+void upload_free(upload_t *upload) {
+    free(upload->timing);
+    free(upload->consistency);
+    free(upload->reply);
+    curl_slist_free_all(upload->headers);
+}
+
+static void upload_string(upload_t *upload, const char *string, size_t length) {
+    upload->piece = string;
+    upload->piecelen = length;
+}
+
+// as many values (or latencies) as scratch holds, from 'index'
+static void upload_batch(upload_t *upload, int latencies) {
+    size_t used = 0;
+
+    for(; upload->index < upload->length && used + UPLOAD_ENTRY_MAX <= sizeof(upload->scratch); upload->index++) {
+        const datapoint_t *point = &upload->points[upload->index];
+        uint8_t *dst = (uint8_t *) upload->scratch + used;
+
+        if(upload->binary && !latencies) {
+            le64_store(dst, point->value);
+            used += sizeof(uint64_t);
+
+        } else if(upload->binary) {
+            le32_store(dst, point->latency / 1000);
+            used += sizeof(uint32_t);
+
+        } else if(!latencies) {
+            used += sprintf(upload->scratch + used, "\"%lu\":\"%016lx\",", upload->offsets[upload->index], point->value);
+
+        } else {
+            used += sprintf(upload->scratch + used, "%s\"%lu\":%lu", upload->index ? "," : "", upload->offsets[upload->index], point->latency / 1000);
+        }
+    }
+
+    upload_string(upload, upload->scratch, used);
+}
+
+// prefix (part 0), body (part 1) and suffix (part 2) of a step, sets
+// an empty piece when there is nothing there
+static void upload_part(upload_t *upload, int step) {
+    upload_string(upload, "", 0);
+
+    switch(step) {
+        case UPLOAD_OPEN:
+            if(upload->part != 0)
+                return;
+
+            if(!upload->binary) {
+                upload_string(upload, "{", 1);
+                return;
+            }
+
+            memcpy(upload->scratch, RESPONSE_MAGIC, 4);
+            upload->scratch[4] = RESPONSE_VERSION;
+            upload->scratch[5] = upload->detailed ? RESPONSE_LATENCIES : 0;
+            upload->scratch[6] = upload->scratch[7] = 0;
+            le64_store((uint8_t *) upload->scratch + 8, upload->length);
+            upload_string(upload, upload->scratch, RESPONSE_HEADER);
+            return;
+
+        case UPLOAD_VALUES:
+            if(upload->part == 1)
+                upload_batch(upload, 0);
+
+            return;
+
+        case UPLOAD_LATENCIES:
+            if(!upload->detailed)
+                return;
+
+            if(upload->part == 1)
+                upload_batch(upload, 1);
+
+            // inside the timing object, see below
+            if(!upload->binary && upload->part == 0)
+                upload_string(upload, ",\"datapoints\":{", 15);
+
+            if(!upload->binary && upload->part == 2)
+                upload_string(upload, "}}", 2);
+
+            return;
+
+        case UPLOAD_TIMING:
+            if(upload->part == 0)
+                upload_string(upload, upload->binary ? "{\"timing\":" : "\"timing\":", upload->binary ? 10 : 9);
+
+            // json latencies are added to the timing object, it's
+            // closed after them
+            if(upload->part == 1)
+                upload_string(upload, upload->timing, strlen(upload->timing) - (!upload->binary && upload->detailed));
+
+            return;
+
+        case UPLOAD_CONSISTENCY:
+            if(upload->part == 0)
+                upload_string(upload, ",\"consistency\":", 15);
+
+            if(upload->part == 1)
+                upload_string(upload, upload->consistency, strlen(upload->consistency));
+
+            if(upload->part == 2)
+                upload_string(upload, "}", 1);
+
+            return;
+    }
+}
+
+// next piece to send, 0 when everything was sent
+static int upload_next(upload_t *upload) {
+    const int *steps = upload->binary ? upload_binary_steps : upload_json_steps;
+
+    while(steps[upload->step] != UPLOAD_END) {
+        int step = steps[upload->step];
+        int batched = upload->part == 1 && (step == UPLOAD_VALUES || (step == UPLOAD_LATENCIES && upload->detailed));
+
+        upload_part(upload, step);
+
+        // batches stay on the body until every datapoint is there
+        if(!batched || upload->index == upload->length) {
+            if(++upload->part == 3) {
+                upload->part = 0;
+                upload->step += 1;
+                upload->index = 0;
+            }
+        }
+
+        if(upload->piecelen)
+            return 1;
+    }
+
+    return 0;
+}
+
+static size_t upload_read_cb(char *dst, size_t size, size_t nmemb, upload_t *upload) {
+    size_t room = size * nmemb;
+    size_t copied = 0;
+
+    while(copied < room) {
+        if(upload->piecelen == 0 && !upload_next(upload))
+            break;
+
+        size_t length = upload->piecelen < room - copied ? upload->piecelen : room - copied;
+
+        memcpy(dst + copied, upload->piece, length);
+        upload->piece += length;
+        upload->piecelen -= length;
+        copied += length;
+    }
+
+    upload->sent += copied;
+
+    return copied;
+}
+
+static size_t upload_reply_cb(char *in, size_t size, size_t nmemb, upload_t *upload) {
+    size_t r = size * nmemb;
+    char *grown;
+
+    if(!(grown = realloc(upload->reply, upload->replylen + r + 1)))
+        return 0;
+
+    upload->reply = grown;
+    memcpy(upload->reply + upload->replylen, in, r);
+    upload->replylen += r;
+    upload->reply[upload->replylen] = '\0';
+
+    return r;
+}
+
+// set 'curl' up to post the response with chunked encoding, the
+// transfer result is given to upload_complete
+int upload_prepare(upload_t *upload, CURL *curl, char *endpoint) {
+    struct curl_slist *headers = NULL;
+
+    if(upload->binary)
+        headers = curl_slist_append(headers, "Content-Type: " RESPONSE_MIME);
+    else
+        headers = curl_slist_append(headers, "Content-Type: application/json");
+
+    headers = curl_slist_append(headers, "Transfer-Encoding: chunked");
+    headers = curl_slist_append(headers, "Expect:");
+
+    if(!(upload->headers = headers))
+        return 0;
+
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, upload_read_cb);
+    curl_easy_setopt(curl, CURLOPT_READDATA, upload);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, upload_reply_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, upload);
+
+    curl_easy_setopt(curl, CURLOPT_URL, endpoint);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+
+    return 1;
+}
+
+// 'reply' gets the server answer (to be freed), returns 0 on failure
+int upload_complete(upload_t *upload, CURLcode res, char **reply) {
+    curl_slist_free_all(upload->headers);
+    upload->headers = NULL;
+
+    *reply = upload->reply;
+    upload->reply = NULL;
+    upload->replylen = 0;
+
+    if(res != CURLE_OK) {
+        fprintf(stderr, "[-] sending response failed: %s\n", curl_easy_strerror(res));
+        free(*reply);
+        *reply = NULL;
+        return 0;
+    }
+
+    return 1;
+}
+
+// post the response, returns 0 on failure
+int upload_send(upload_t *upload, CURL *shared, char *endpoint, char **reply) {
+    CURL *curl;
+    CURLcode res;
+
+    *reply = NULL;
+
+    if(!(curl = transport_handle(shared)))
+        return 0;
+
+    if(!upload_prepare(upload, curl, endpoint)) {
+        transport_release(curl, shared);
+        return 0;
+    }
+
+    res = curl_easy_perform(curl);
+
+    transport_release(curl, shared);
+
+    return upload_complete(upload, res, reply);
+}
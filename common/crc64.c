@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <x86intrin.h>
+#include "crc64.h"
+
+// customized version from https://github.com/rawrunprotected/crc
+
+static const uint8_t shuffle_masks[] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x8f, 0x8e, 0x8d, 0x8c, 0x8b, 0x8a, 0x89, 0x88, 0x87, 0x86, 0x85, 0x84, 0x83, 0x82, 0x81, 0x80,
+};
+
+#define CRC64_POLY  0xc96c5795d7870f42  // reflected ecma-182
+#define CRC64_MU    0x9c3e466c172963d5  // barrett constant
+#define CRC64_P     0x92d8af2baf0e1e85  // polynomial (barrett form)
+
+__attribute__((target("ssse3")))
+static void shiftr128(__m128i in, size_t n, __m128i *outl, __m128i *outr) {
+    const __m128i ma = _mm_loadu_si128((const __m128i *)(shuffle_masks + (16 - n)));
+    const __m128i mb = _mm_xor_si128(ma, _mm_cmpeq_epi8(_mm_setzero_si128(), _mm_setzero_si128()));
+
+    *outl = _mm_shuffle_epi8(in, mb);
+    *outr = _mm_shuffle_epi8(in, ma);
+}
+
+__attribute__((target("sse4.1,pclmul")))
+uint64_t crc64(const uint8_t *data, size_t length) {
+    uint64_t crc = 0;
+    const uint64_t k1 = 0xe05dd497ca393ae4;
+    const uint64_t k2 = 0xdabe95afc7875f40;
+    const uint64_t mu = 0x9c3e466c172963d5;
+    const uint64_t p  = 0x92d8af2baf0e1e85;
+
+    const __m128i fc1 = _mm_set_epi64x(k2, k1);
+    const __m128i fc2 = _mm_set_epi64x(p, mu);
+
+    const uint8_t *end = data + length;
+
+    const __m128i *aligned_data = (const __m128i *)((uintptr_t) data & ~(uintptr_t) 15);
+    const __m128i *aligned_end = (const __m128i *)(((uintptr_t) end + 15) & ~(uintptr_t) 15);
+
+    const size_t lead_size = data - (const uint8_t *) aligned_data;
+    const size_t lead_out_size = (const uint8_t *) aligned_end - end;
+
+    const __m128i lead_mask = _mm_loadu_si128((const __m128i *)(shuffle_masks + (16 - lead_size)));
+    const __m128i data0 = _mm_blendv_epi8(_mm_setzero_si128(), _mm_load_si128(aligned_data), lead_mask);
+
+    const __m128i icrc = _mm_set_epi64x(0, ~crc);
+
+    __m128i crc0, crc1;
+    shiftr128(icrc, 16 - length, &crc0, &crc1);
+
+    __m128i A, B;
+    shiftr128(data0, lead_out_size, &A, &B);
+
+    const __m128i P = _mm_xor_si128(A, crc0);
+    __m128i R = _mm_xor_si128(_mm_clmulepi64_si128(P, fc1, 0x10), _mm_xor_si128(_mm_srli_si128(P, 8), _mm_slli_si128(crc1, 8)));
+
+    const __m128i T1 = _mm_clmulepi64_si128(R, fc2, 0x00);
+    const __m128i T2 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(T1, fc2, 0x10), _mm_slli_si128(T1, 8)), R);
+
+    return ~(((uint64_t)(uint32_t)_mm_extract_epi32(T2, 3) << 32) | (uint64_t)(uint32_t)_mm_extract_epi32(T2, 2));
+}
+
+//
+// fixed width step
+//
+// the chain only ever hash one 8 bytes value, which is exactly one
+// barrett reduction: no lead/tail masking and no shuffle needed
+//
+static uint64_t crc64_table[8][256];
+
+static void crc64_table_init() {
+    for(int i = 0; i < 256; i++) {
+        uint64_t crc = i;
+
+        for(int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC64_POLY : 0);
+
+        crc64_table[0][i] = crc;
+    }
+
+    for(int i = 0; i < 256; i++)
+        for(int t = 1; t < 8; t++)
+            crc64_table[t][i] = (crc64_table[t - 1][i] >> 8) ^ crc64_table[0][crc64_table[t - 1][i] & 0xff];
+}
+
+uint64_t crc64_u64_table(uint64_t value) {
+    uint64_t x = ~value;
+
+    return ~(crc64_table[7][x & 0xff] ^
+             crc64_table[6][(x >> 8) & 0xff] ^
+             crc64_table[5][(x >> 16) & 0xff] ^
+             crc64_table[4][(x >> 24) & 0xff] ^
+             crc64_table[3][(x >> 32) & 0xff] ^
+             crc64_table[2][(x >> 40) & 0xff] ^
+             crc64_table[1][(x >> 48) & 0xff] ^
+             crc64_table[0][x >> 56]);
+}
+
+__attribute__((target("sse4.1,pclmul")))
+uint64_t crc64_u64_pclmul(uint64_t value) {
+    const __m128i fc2 = _mm_set_epi64x(CRC64_P, CRC64_MU);
+    const __m128i R = _mm_set_epi64x(0, ~value);
+
+    const __m128i T1 = _mm_clmulepi64_si128(R, fc2, 0x00);
+    const __m128i T2 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(T1, fc2, 0x10), _mm_slli_si128(T1, 8)), R);
+
+    return ~(uint64_t) _mm_extract_epi64(T2, 1);
+}
+
+// same reduction, evex encoded: no sse/avx transition penalty when
+// mixed with avx-512 code, wide lanes are used by batched kernels
+__attribute__((target("avx512f,avx512vl,vpclmulqdq,pclmul")))
+uint64_t crc64_u64_vpclmul(uint64_t value) {
+    const __m128i fc2 = _mm_set_epi64x(CRC64_P, CRC64_MU);
+    const __m128i R = _mm_set_epi64x(0, ~value);
+
+    const __m128i T1 = _mm_clmulepi64_si128(R, fc2, 0x00);
+    const __m128i T2 = _mm_ternarylogic_epi64(_mm_clmulepi64_si128(T1, fc2, 0x10), _mm_slli_si128(T1, 8), R, 0x96);
+
+    return ~(uint64_t) _mm_extract_epi64(T2, 1);
+}
+
+//
+// multi-lane step
+//
+// one chain is bound by clmul latency, not throughput: advancing
+// CRC64_LANES independent chains in lockstep keeps the units busy.
+// lanes are kept inverted between two steps, the final not of one
+// step cancels with the initial not of the next one
+//
+void crc64_x8_table(uint64_t *lanes, size_t steps) {
+    for(size_t i = 0; i < steps; i++)
+        for(int l = 0; l < CRC64_LANES; l++)
+            lanes[l] = crc64_u64_table(lanes[l]);
+}
+
+__attribute__((target("sse4.1,pclmul")))
+void crc64_x8_pclmul(uint64_t *lanes, size_t steps) {
+    const __m128i fc2 = _mm_set_epi64x(CRC64_P, CRC64_MU);
+    __m128i R[CRC64_LANES];
+
+    for(int l = 0; l < CRC64_LANES; l++)
+        R[l] = _mm_set_epi64x(0, ~lanes[l]);
+
+    for(size_t i = 0; i < steps; i++) {
+        for(int l = 0; l < CRC64_LANES; l++) {
+            const __m128i T1 = _mm_clmulepi64_si128(R[l], fc2, 0x00);
+            const __m128i T2 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(T1, fc2, 0x10), _mm_slli_si128(T1, 8)), R[l]);
+            R[l] = _mm_srli_si128(T2, 8);
+        }
+    }
+
+    for(int l = 0; l < CRC64_LANES; l++)
+        lanes[l] = ~(uint64_t) _mm_cvtsi128_si64(R[l]);
+}
+
+// each 128 bits lane of a zmm register holds one chain in its low
+// quadword, two registers cover the eight lanes
+__attribute__((target("avx512f,avx512bw,vpclmulqdq")))
+void crc64_x8_vpclmul(uint64_t *lanes, size_t steps) {
+    const __m512i fc2 = _mm512_broadcast_i32x4(_mm_set_epi64x(CRC64_P, CRC64_MU));
+    const __m512i spread0 = _mm512_set_epi64(0, 3, 0, 2, 0, 1, 0, 0);
+    const __m512i spread1 = _mm512_set_epi64(0, 7, 0, 6, 0, 5, 0, 4);
+    const __m512i gather = _mm512_set_epi64(14, 12, 10, 8, 6, 4, 2, 0);
+    const __m512i ones = _mm512_set1_epi64(-1);
+    const __mmask8 low = 0x55;
+
+    const __m512i input = _mm512_xor_si512(_mm512_loadu_si512(lanes), ones);
+    __m512i R0 = _mm512_maskz_permutexvar_epi64(low, spread0, input);
+    __m512i R1 = _mm512_maskz_permutexvar_epi64(low, spread1, input);
+
+    for(size_t i = 0; i < steps; i++) {
+        const __m512i A1 = _mm512_clmulepi64_epi128(R0, fc2, 0x00);
+        const __m512i B1 = _mm512_clmulepi64_epi128(R1, fc2, 0x00);
+
+        const __m512i A2 = _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(A1, fc2, 0x10), _mm512_bslli_epi128(A1, 8), R0, 0x96);
+        const __m512i B2 = _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(B1, fc2, 0x10), _mm512_bslli_epi128(B1, 8), R1, 0x96);
+
+        R0 = _mm512_bsrli_epi128(A2, 8);
+        R1 = _mm512_bsrli_epi128(B2, 8);
+    }
+
+    const __m512i output = _mm512_permutex2var_epi64(R0, gather, R1);
+    _mm512_storeu_si512(lanes, _mm512_xor_si512(output, ones));
+}
+
+static int crc64_supported_table() {
+    return 1;
+}
+
+static int crc64_supported_pclmul() {
+    return __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("pclmul");
+}
+
+static int crc64_supported_vpclmul() {
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") &&
+           __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("vpclmulqdq");
+}
+
+// ordered from the slowest to the fastest
+const crc64_impl_t crc64_impls[] = {
+    {.name = "table", .u64 = crc64_u64_table, .x8 = crc64_x8_table, .supported = crc64_supported_table},
+    {.name = "pclmul", .u64 = crc64_u64_pclmul, .x8 = crc64_x8_pclmul, .supported = crc64_supported_pclmul},
+    {.name = "vpclmul", .u64 = crc64_u64_vpclmul, .x8 = crc64_x8_vpclmul, .supported = crc64_supported_vpclmul},
+    {.name = NULL, .u64 = NULL, .x8 = NULL, .supported = NULL},
+};
+
+crc64_u64_t crc64_u64 = crc64_u64_table;
+crc64_x8_t crc64_x8 = crc64_x8_table;
+const crc64_impl_t *crc64_impl = &crc64_impls[0];
+
+//
+// jump ahead
+//
+// crc64 of a fixed width value is linear in its input, plus the
+// constant coming from the inversions, the map for 2^n steps is
+// built from the one for 2^(n-1) steps composed with itself
+//
+static uint64_t crc64_affine_linear(const crc64_affine_t *map, uint64_t value) {
+    uint64_t result = 0;
+
+    for(int i = 0; value; i++, value >>= 1)
+        if(value & 1)
+            result ^= map->columns[i];
+
+    return result;
+}
+
+uint64_t crc64_affine_apply(const crc64_affine_t *map, uint64_t value) {
+    return crc64_affine_linear(map, value) ^ map->constant;
+}
+
+// target = second(first(x)), target can't be one of the inputs
+static void crc64_affine_compose(crc64_affine_t *target, const crc64_affine_t *second, const crc64_affine_t *first) {
+    for(int i = 0; i < 64; i++)
+        target->columns[i] = crc64_affine_linear(second, first->columns[i]);
+
+    target->constant = crc64_affine_apply(second, first->constant);
+}
+
+void crc64_affine_steps(crc64_affine_t *map, uint64_t steps) {
+    crc64_affine_t power, temp;
+
+    // single step and identity
+    power.constant = crc64_u64_table(0);
+
+    for(int i = 0; i < 64; i++) {
+        power.columns[i] = crc64_u64_table(1ULL << i) ^ power.constant;
+        map->columns[i] = 1ULL << i;
+    }
+
+    map->constant = 0;
+
+    while(steps) {
+        if(steps & 1) {
+            crc64_affine_compose(&temp, &power, map);
+            *map = temp;
+        }
+
+        if((steps >>= 1)) {
+            crc64_affine_compose(&temp, &power, &power);
+            power = temp;
+        }
+    }
+}
+
+uint64_t crc64_jump(uint64_t value, uint64_t steps) {
+    crc64_affine_t map;
+
+    crc64_affine_steps(&map, steps);
+
+    return crc64_affine_apply(&map, value);
+}
+
+//
+// golden vectors
+//
+static const uint64_t crc64_golden[][2] = {
+    {0x0000000000000000, 0xb66a73654282cac0},
+    {0x0000000000000001, 0x6cd4e6ca85059580},
+    {0xffffffffffffffff, 0xffffffffffffffff},
+    {0x0f6f8ca19f2c59c2, 0x0ec1bbf56237c402},
+    {0x8000000000000000, 0x7f0624f09505c582},
+    {0x0123456789abcdef, 0x5322e1f655ec4276},
+};
+
+// value after 65536 chain steps from 0x0f6f8ca19f2c59c2
+#define CRC64_GOLDEN_CHAIN  0x8c67e22ff9ebf2b7
+
+int crc64_selftest(const crc64_impl_t *impl) {
+    int errors = 0;
+
+    for(size_t i = 0; i < sizeof(crc64_golden) / sizeof(crc64_golden[0]); i++) {
+        uint64_t value = impl->u64(crc64_golden[i][0]);
+
+        if(value != crc64_golden[i][1]) {
+            fprintf(stderr, "[-] crc64 %s: 0x%016lx: got 0x%016lx, expected 0x%016lx\n",
+                    impl->name, crc64_golden[i][0], value, crc64_golden[i][1]);
+            errors += 1;
+        }
+    }
+
+    uint64_t seed = crc64_golden[3][0];
+    for(size_t i = 0; i < 65536; i++)
+        seed = impl->u64(seed);
+
+    if(seed != CRC64_GOLDEN_CHAIN) {
+        fprintf(stderr, "[-] crc64 %s: chain mismatch: 0x%016lx\n", impl->name, seed);
+        errors += 1;
+    }
+
+    // every lane must match the single chain, whatever its position
+    uint64_t lanes[CRC64_LANES];
+
+    for(int l = 0; l < CRC64_LANES; l++)
+        lanes[l] = (l == 3) ? crc64_golden[3][0] : crc64_golden[l % 6][0] ^ l;
+
+    impl->x8(lanes, 65536);
+
+    if(lanes[3] != CRC64_GOLDEN_CHAIN) {
+        fprintf(stderr, "[-] crc64 %s: lanes chain mismatch: 0x%016lx\n", impl->name, lanes[3]);
+        errors += 1;
+    }
+
+    for(int l = 0; l < CRC64_LANES; l++) {
+        uint64_t expected = (l == 3) ? crc64_golden[3][0] : crc64_golden[l % 6][0] ^ l;
+
+        for(size_t i = 0; i < 65536; i++)
+            expected = crc64_u64_table(expected);
+
+        if(lanes[l] != expected) {
+            fprintf(stderr, "[-] crc64 %s: lane %d mismatch: 0x%016lx\n", impl->name, l, lanes[l]);
+            errors += 1;
+        }
+    }
+
+    return errors;
+}
+
+// selecting implementation once, before main, every supported
+// variant must return bit-identical values or we refuse to run
+__attribute__((constructor))
+static void crc64_dispatch() {
+    __builtin_cpu_init();
+    crc64_table_init();
+
+    // jump ahead must land where the sequential chain does
+    if(crc64_jump(crc64_golden[3][0], 65536) != CRC64_GOLDEN_CHAIN || crc64_jump(crc64_golden[5][0], 1) != crc64_golden[5][1]) {
+        fprintf(stderr, "[-] crc64 jump ahead: golden vectors failed, aborting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(const crc64_impl_t *impl = crc64_impls; impl->name; impl++) {
+        if(!impl->supported())
+            continue;
+
+        if(crc64_selftest(impl)) {
+            fprintf(stderr, "[-] crc64 %s: golden vectors failed, aborting\n", impl->name);
+            exit(EXIT_FAILURE);
+        }
+
+        crc64_impl = impl;
+        crc64_u64 = impl->u64;
+        crc64_x8 = impl->x8;
+    }
+}
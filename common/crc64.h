@@ -0,0 +1,59 @@
+#ifndef CRC64_H
+    #define CRC64_H
+
+    #include <stdint.h>
+    #include <stddef.h>
+
+    // crc-64/xz (ecma-182 polynomial, reflected, inverted)
+    uint64_t crc64(const uint8_t *data, size_t length);
+
+    // fixed width step used by every chain: crc64 of a single
+    // 8 bytes value, without any length handling or masking
+    typedef uint64_t (*crc64_u64_t)(uint64_t value);
+
+    // advance CRC64_LANES independent chains by the same amount of steps
+    #define CRC64_LANES  8
+    typedef void (*crc64_x8_t)(uint64_t *lanes, size_t steps);
+
+    typedef struct crc64_impl_t {
+        char *name;
+        crc64_u64_t u64;
+        crc64_x8_t x8;
+        int (*supported)(void);
+
+    } crc64_impl_t;
+
+    uint64_t crc64_u64_table(uint64_t value);
+    uint64_t crc64_u64_pclmul(uint64_t value);
+    uint64_t crc64_u64_vpclmul(uint64_t value);
+
+    void crc64_x8_table(uint64_t *lanes, size_t steps);
+    void crc64_x8_pclmul(uint64_t *lanes, size_t steps);
+    void crc64_x8_vpclmul(uint64_t *lanes, size_t steps);
+
+    // fastest implementation supported by the running cpu,
+    // selected (and checked against golden vectors) on startup
+    extern crc64_u64_t crc64_u64;
+    extern crc64_x8_t crc64_x8;
+    extern const crc64_impl_t *crc64_impl;
+
+    // list of every implementation, terminated by an empty entry
+    extern const crc64_impl_t crc64_impls[];
+
+    int crc64_selftest(const crc64_impl_t *impl);
+
+    // one chain step is an affine map over GF(2)^64: step(x) = A.x ^ c,
+    // any amount of steps is one as well and is computed by squaring,
+    // columns[i] holds A applied to bit i
+    typedef struct crc64_affine_t {
+        uint64_t columns[64];
+        uint64_t constant;
+
+    } crc64_affine_t;
+
+    void crc64_affine_steps(crc64_affine_t *map, uint64_t steps);
+    uint64_t crc64_affine_apply(const crc64_affine_t *map, uint64_t value);
+
+    // value after 'steps' chain steps from 'value', in O(log steps)
+    uint64_t crc64_jump(uint64_t value, uint64_t steps);
+#endif
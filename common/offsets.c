@@ -0,0 +1,137 @@
+#include <stdint.h>
+#include "offsets.h"
+
+// splitmix64 finalizer
+static uint64_t mix64(uint64_t value) {
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+    return value ^ (value >> 31);
+}
+
+static uint64_t next64(uint64_t *state) {
+    *state += 0x9e3779b97f4a7c15;
+    return mix64(*state);
+}
+
+// uniform value in [0, limit), multiply-shift with rejection
+// of the few values which would bias the result
+static uint64_t bounded64(uint64_t *state, uint64_t limit) {
+    unsigned __int128 product = (unsigned __int128) next64(state) * limit;
+
+    if((uint64_t) product < limit) {
+        uint64_t threshold = -limit % limit;
+
+        while((uint64_t) product < threshold)
+            product = (unsigned __int128) next64(state) * limit;
+    }
+
+    return product >> 64;
+}
+
+// (value * numerator) / denominator without overflow
+static uint64_t scale64(uint64_t value, uint64_t numerator, uint64_t denominator) {
+    return ((unsigned __int128) value * numerator) / denominator;
+}
+
+static size_t bucket(uint64_t value, size_t length, uint64_t limit) {
+    return limit ? scale64(value, length, limit) : 0;
+}
+
+// we request 256 datapoints per 20 GB
+size_t offsets_count(uint64_t size) {
+    return 256 * ((size / (20ULL * 1024 * 1024 * 1024)) + 1);
+}
+
+size_t offsets_segments(size_t count) {
+    size_t segments = count / OFFSETS_PER_SEGMENT;
+    return segments ? segments : 1;
+}
+
+static uint64_t segment_state(uint64_t key, uint64_t size, size_t count, size_t segment) {
+    return mix64(mix64(mix64(key ^ mix64(size)) ^ count) ^ segment);
+}
+
+static size_t segment_first(size_t count, size_t segment) {
+    return scale64(count, segment, offsets_segments(count));
+}
+
+// fill dst (at least OFFSETS_SEGMENT_MAX entries) with the sorted
+// offsets of one segment, returns amount of offsets written
+size_t offsets_segment(uint64_t *dst, uint64_t key, uint64_t size, size_t count, size_t segment) {
+    uint64_t values = size / sizeof(uint64_t);
+    size_t segments = offsets_segments(count);
+
+    uint64_t from = scale64(values, segment, segments);
+    uint64_t limit = scale64(values, segment + 1, segments) - from;
+    size_t length = segment_first(count, segment + 1) - segment_first(count, segment);
+
+    uint64_t state = segment_state(key, size, count, segment);
+    uint64_t drawn[OFFSETS_SEGMENT_MAX];
+    size_t buckets[OFFSETS_SEGMENT_MAX + 1] = {0};
+
+    // draws are uniform, one bucket per draw gives an expected
+    // linear time sort: counting pass, scatter, then insertion
+    // sort inside (almost always single entry) buckets
+    for(size_t i = 0; i < length; i++) {
+        drawn[i] = limit ? bounded64(&state, limit) : 0;
+        buckets[bucket(drawn[i], length, limit) + 1] += 1;
+    }
+
+    for(size_t i = 1; i <= length; i++)
+        buckets[i] += buckets[i - 1];
+
+    for(size_t i = 0; i < length; i++)
+        dst[buckets[bucket(drawn[i], length, limit)]++] = drawn[i];
+
+    for(size_t i = 1; i < length; i++) {
+        uint64_t value = dst[i];
+        size_t j = i;
+
+        for(; j > 0 && dst[j - 1] > value; j--)
+            dst[j] = dst[j - 1];
+
+        dst[j] = value;
+    }
+
+    for(size_t i = 0; i < length; i++)
+        dst[i] += from;
+
+    return length;
+}
+
+void offsets_generate(uint64_t *dst, uint64_t key, uint64_t size, size_t count) {
+    size_t segments = offsets_segments(count);
+
+    for(size_t segment = 0; segment < segments; segment++)
+        dst += offsets_segment(dst, key, size, count, segment);
+}
+
+// split the datapoints (in offsets_generate order) in 'subsets'
+// disjoint subsets of the same size (within one). datapoints of each
+// segment are shuffled then dealt round-robin, so every subset stays
+// spread over the whole disk and membership can't be guessed without
+// the key
+void offsets_subsets(uint16_t *dst, uint64_t key, uint64_t size, size_t count, size_t subsets) {
+    size_t segments = offsets_segments(count);
+    uint8_t rank[OFFSETS_SEGMENT_MAX];
+
+    for(size_t segment = 0; segment < segments; segment++) {
+        size_t first = segment_first(count, segment);
+        size_t length = segment_first(count, segment + 1) - first;
+        uint64_t state = segment_state(key, size, count, segment) ^ OFFSETS_SUBSETS_DOMAIN;
+
+        for(size_t i = 0; i < length; i++)
+            rank[i] = i;
+
+        for(size_t i = length; i > 1; i--) {
+            size_t j = bounded64(&state, i);
+            uint8_t swap = rank[i - 1];
+
+            rank[i - 1] = rank[j];
+            rank[j] = swap;
+        }
+
+        for(size_t i = 0; i < length; i++)
+            dst[first + rank[i]] = (first + i) % subsets;
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef OFFSETS_H
+    #define OFFSETS_H
+
+    #include <stdint.h>
+    #include <stddef.h>
+
+    //
+    // challenge offsets (crc index, not bytes offsets)
+    //
+    // offsets are a pure function of (key, size, count): anyone knowing
+    // the report header can regenerate them, reports don't need to
+    // store them. the key is random and kept by the pool until the
+    // challenge, unlike the chain seed the node builds its disk with.
+    // the chain is split in equal segments, each one gets its share
+    // of datapoints drawn uniformly inside its range (to keep them
+    // spread all over the disk) from its own generator, so any segment
+    // can be regenerated alone. offsets are sorted ascending
+    //
+    #define OFFSETS_PER_SEGMENT  8
+    #define OFFSETS_SEGMENT_MAX  (OFFSETS_PER_SEGMENT * 2)
+
+    // oversampled reports hold up to this many challenges
+    #define OFFSETS_SUBSETS_MAX     64
+    #define OFFSETS_SUBSETS_DOMAIN  0x7375627365747321
+
+    // amount of datapoints for a capacity size
+    size_t offsets_count(uint64_t size);
+
+    size_t offsets_segments(size_t count);
+    size_t offsets_segment(uint64_t *dst, uint64_t key, uint64_t size, size_t count, size_t segment);
+
+    void offsets_generate(uint64_t *dst, uint64_t key, uint64_t size, size_t count);
+    void offsets_subsets(uint16_t *dst, uint64_t key, uint64_t size, size_t count, size_t subsets);
+#endif
@@ -0,0 +1,193 @@
+#include <string.h>
+#include <stdint.h>
+#include "report.h"
+
+static uint8_t *le64_store(uint8_t *dst, uint64_t value) {
+    for(int i = 0; i < 8; i++)
+        dst[i] = value >> (i * 8);
+
+    return dst + 8;
+}
+
+static uint64_t le64_load(const uint8_t *src) {
+    uint64_t value = 0;
+
+    for(int i = 0; i < 8; i++)
+        value |= (uint64_t) src[i] << (i * 8);
+
+    return value;
+}
+
+static uint16_t le16_load(const uint8_t *src) {
+    return src[0] | (src[1] << 8);
+}
+
+static uint8_t *varint_store(uint8_t *dst, uint64_t value) {
+    while(value >= 0x80) {
+        *dst++ = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+
+    *dst++ = value;
+
+    return dst;
+}
+
+static const uint8_t *varint_load(const uint8_t *src, const uint8_t *end, uint64_t *value) {
+    uint64_t result = 0;
+
+    for(int shift = 0; src < end && shift < 64; shift += 7) {
+        uint8_t byte = *src++;
+        result |= (uint64_t) (byte & 0x7f) << shift;
+
+        if(!(byte & 0x80)) {
+            *value = result;
+            return src;
+        }
+    }
+
+    return NULL;
+}
+
+// worst case buffer size needed to encode 'count' datapoints
+size_t report_encoded_max(size_t count) {
+    return REPORT_HEADER + (count * sizeof(uint64_t)) + (count * 10);
+}
+
+// encode into 'dst' (at least report_encoded_max bytes), returns
+// the encoded length, or 0 if offsets are not sorted. without
+// offsets, the report is flagged derived
+size_t report_encode(uint8_t *dst, const report_t *header, const uint64_t *offsets, const uint64_t *results) {
+    uint8_t *cursor = dst;
+    uint64_t previous = 0;
+    size_t count = header->count;
+    uint16_t subsets = header->subsets ? header->subsets : 1;
+
+    memcpy(cursor, REPORT_MAGIC, 4);
+    cursor[4] = REPORT_VERSION;
+    cursor[5] = offsets ? 0 : REPORT_DERIVED;
+    cursor[6] = subsets;
+    cursor[7] = subsets >> 8;
+
+    cursor = le64_store(cursor + 8, header->seed);
+    cursor = le64_store(cursor, header->size);
+    cursor = le64_store(cursor, count);
+    cursor = le64_store(cursor, header->key);
+
+    for(size_t i = 0; i < count; i++)
+        cursor = le64_store(cursor, results[i]);
+
+    for(size_t i = 0; offsets && i < count; i++) {
+        if(offsets[i] < previous)
+            return 0;
+
+        cursor = varint_store(cursor, offsets[i] - previous);
+        previous = offsets[i];
+    }
+
+    return cursor - dst;
+}
+
+// validate a report and point into it, returns 0 on malformed input
+int report_decode(report_t *report, const uint8_t *src, size_t length) {
+    size_t headlen = REPORT_HEADER;
+
+    if(length < REPORT_HEADER_V1 || memcmp(src, REPORT_MAGIC, 4) != 0)
+        return 0;
+
+    if(src[4] == 1)
+        headlen = REPORT_HEADER_V1;
+
+    if(!src[4] || src[4] > REPORT_VERSION || length < headlen || (src[5] & ~REPORT_DERIVED))
+        return 0;
+
+    // version 1 derived offsets from the seed the node knows
+    if(src[4] == 1 && (src[5] & REPORT_DERIVED))
+        return 0;
+
+    report->flags = src[5];
+    report->seed = le64_load(src + 8);
+    report->size = le64_load(src + 16);
+    report->count = le64_load(src + 24);
+    report->key = report->seed;
+    report->subsets = 1;
+
+    if(src[4] >= 2) {
+        report->key = le64_load(src + 32);
+        report->subsets = le16_load(src + 6);
+    }
+
+    if(report->subsets == 0 || report->subsets > OFFSETS_SUBSETS_MAX)
+        return 0;
+
+    // count is checked against the length before being multiplied,
+    // a crafted count would wrap around
+    if(report->flags & REPORT_DERIVED) {
+        if(report->count > (length - headlen) / sizeof(uint64_t) || report->count * sizeof(uint64_t) != length - headlen)
+            return 0;
+
+    // each offset takes at least one byte
+    } else if(report->count > (length - headlen) / (sizeof(uint64_t) + 1)) {
+        return 0;
+    }
+
+    report->results = src + headlen;
+    report->offsets = report->results + (report->count * sizeof(uint64_t));
+    report->end = src + length;
+
+    return 1;
+}
+
+uint64_t report_result(const report_t *report, size_t index) {
+    return le64_load(report->results + (index * sizeof(uint64_t)));
+}
+
+void report_iter_init(const report_t *report, report_iter_t *iter) {
+    iter->cursor = report->offsets;
+    iter->offset = 0;
+    iter->index = 0;
+    iter->segindex = 0;
+    iter->seglength = 0;
+    iter->segcursor = 0;
+}
+
+static int report_iter_derived(const report_t *report, report_iter_t *iter, uint64_t *offset) {
+    while(iter->segcursor == iter->seglength) {
+        if(iter->segindex == offsets_segments(report->count))
+            return 0;
+
+        iter->seglength = offsets_segment(iter->segment, report->key, report->size, report->count, iter->segindex);
+        iter->segindex += 1;
+        iter->segcursor = 0;
+    }
+
+    *offset = iter->segment[iter->segcursor++];
+
+    return 1;
+}
+
+// next (offset, result) pair, returns 0 when done or malformed
+int report_iter_next(const report_t *report, report_iter_t *iter, uint64_t *offset, uint64_t *result) {
+    uint64_t delta;
+
+    if(iter->index >= report->count)
+        return 0;
+
+    if(report->flags & REPORT_DERIVED) {
+        if(!report_iter_derived(report, iter, &iter->offset))
+            return 0;
+
+    } else {
+        if(!(iter->cursor = varint_load(iter->cursor, report->end, &delta)))
+            return 0;
+
+        iter->offset += delta;
+    }
+
+    *offset = iter->offset;
+    *result = report_result(report, iter->index);
+
+    iter->index += 1;
+
+    return 1;
+}
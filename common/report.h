@@ -0,0 +1,80 @@
+#ifndef REPORT_H
+    #define REPORT_H
+
+    #include <stdint.h>
+    #include <stddef.h>
+    #include "offsets.h"
+
+    //
+    // binary capacity report (version 2)
+    //
+    //   0   magic     "CAPR"
+    //   4   version   uint8
+    //   5   flags     uint8
+    //   6   subsets   uint16 le
+    //   8   seed      uint64 le
+    //   16  size      uint64 le
+    //   24  count     uint64 le
+    //   32  key       uint64 le
+    //   40  results   count * uint64 le
+    //   ..  offsets   count * varint, delta from previous offset
+    //
+    // results come first so they stay 8 bytes aligned and can be
+    // used in place, offsets must be sorted ascending
+    //
+    // with REPORT_DERIVED flag, offsets are not stored at all, they
+    // are regenerated from (key, size, count), see offsets.h
+    //
+    // an oversampled report holds 'subsets' disjoint challenges, see
+    // offsets_subsets for the datapoints of each one
+    //
+    // version 1 (no subsets, no key, 32 bytes header) is still decoded
+    // with explicit offsets, derived version 1 reports are refused: their
+    // offsets key was the seed, which the node knows
+    //
+    #define REPORT_MAGIC      "CAPR"
+    #define REPORT_VERSION    2
+    #define REPORT_HEADER     40
+    #define REPORT_HEADER_V1  32
+
+    #define REPORT_DERIVED  0x01
+
+    typedef struct report_t {
+        uint64_t seed;
+        uint64_t size;
+        uint64_t count;
+        uint64_t key;
+        uint16_t subsets;
+        uint8_t flags;
+
+        // pointers inside the decoded buffer, nothing is copied
+        const uint8_t *results;
+        const uint8_t *offsets;
+        const uint8_t *end;
+
+    } report_t;
+
+    typedef struct report_iter_t {
+        const uint8_t *cursor;
+        uint64_t offset;
+        size_t index;
+
+        // derived offsets, regenerated one segment at a time
+        uint64_t segment[OFFSETS_SEGMENT_MAX];
+        size_t segindex;
+        size_t seglength;
+        size_t segcursor;
+
+    } report_iter_t;
+
+    size_t report_encoded_max(size_t count);
+    // seed, size, count, key and subsets are taken from 'header',
+    // offsets can be NULL for a derived report
+    size_t report_encode(uint8_t *dst, const report_t *header, const uint64_t *offsets, const uint64_t *results);
+
+    int report_decode(report_t *report, const uint8_t *src, size_t length);
+    uint64_t report_result(const report_t *report, size_t index);
+
+    void report_iter_init(const report_t *report, report_iter_t *iter);
+    int report_iter_next(const report_t *report, report_iter_t *iter, uint64_t *offset, uint64_t *result);
+#endif
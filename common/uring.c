@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned submit, unsigned complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, submit, complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, void *args, unsigned count) {
+    return syscall(__NR_io_uring_register, fd, opcode, args, count);
+}
+
+// returns 0 when io_uring is not available (old kernel, seccomp, ...)
+int uring_init(uring_t *ring, unsigned entries) {
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(uring_t));
+    memset(&params, 0, sizeof(params));
+
+    if((ring->fd = uring_setup(entries, &params)) < 0)
+        return 0;
+
+    ring->entries = params.sq_entries;
+    ring->sq_maplen = params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+    ring->cq_maplen = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+    ring->sqes_maplen = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // both rings share the same mapping on recent kernels
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(ring->cq_maplen > ring->sq_maplen)
+            ring->sq_maplen = ring->cq_maplen;
+
+        ring->cq_maplen = 0;
+    }
+
+    ring->sq_map = mmap(NULL, ring->sq_maplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if(ring->sq_map == MAP_FAILED)
+        goto failed;
+
+    ring->cq_map = ring->sq_map;
+
+    if(ring->cq_maplen) {
+        ring->cq_map = mmap(NULL, ring->cq_maplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if(ring->cq_map == MAP_FAILED)
+            goto failed;
+    }
+
+    ring->sqes = mmap(NULL, ring->sqes_maplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED)
+        goto failed;
+
+    ring->sq_head = (unsigned *)((char *) ring->sq_map + params.sq_off.head);
+    ring->sq_tail = (unsigned *)((char *) ring->sq_map + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)((char *) ring->sq_map + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((char *) ring->sq_map + params.sq_off.array);
+
+    ring->cq_head = (unsigned *)((char *) ring->cq_map + params.cq_off.head);
+    ring->cq_tail = (unsigned *)((char *) ring->cq_map + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)((char *) ring->cq_map + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *) ring->cq_map + params.cq_off.cqes);
+
+    return 1;
+
+failed:
+    perror("io_uring mmap");
+    uring_free(ring);
+    return 0;
+}
+
+void uring_free(uring_t *ring) {
+    if(ring->sqes && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_maplen);
+
+    if(ring->cq_maplen && ring->cq_map && ring->cq_map != MAP_FAILED)
+        munmap(ring->cq_map, ring->cq_maplen);
+
+    if(ring->sq_map && ring->sq_map != MAP_FAILED)
+        munmap(ring->sq_map, ring->sq_maplen);
+
+    if(ring->fd >= 0)
+        close(ring->fd);
+
+    memset(ring, 0, sizeof(uring_t));
+    ring->fd = -1;
+}
+
+// pinned buffers, kernel skips the page mapping on each request
+int uring_register_buffers(uring_t *ring, struct iovec *iovecs, unsigned count) {
+    return uring_register(ring->fd, IORING_REGISTER_BUFFERS, iovecs, count) == 0;
+}
+
+int uring_register_files(uring_t *ring, int *fds, unsigned count) {
+    return uring_register(ring->fd, IORING_REGISTER_FILES, fds, count) == 0;
+}
+
+// next free submission entry (zeroed), NULL if the queue is full
+struct io_uring_sqe *uring_sqe(uring_t *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail + ring->pending;
+
+    if(tail - head >= ring->entries)
+        return NULL;
+
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array[index] = index;
+    ring->pending += 1;
+
+    return sqe;
+}
+
+// publish prepared entries, optionally waiting for completions
+int uring_submit(uring_t *ring, unsigned wait) {
+    unsigned submit = ring->pending;
+    int value;
+
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->pending, __ATOMIC_RELEASE);
+    ring->pending = 0;
+
+    while((value = uring_enter(ring->fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0)) < 0 && errno == EINTR)
+        submit = 0;
+
+    return value;
+}
+
+// pop one completion, returns 0 if none is available (and wait not set)
+int uring_reap(uring_t *ring, uint64_t *userdata, int32_t *result, int wait) {
+    while(1) {
+        unsigned head = *ring->cq_head;
+
+        if(head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+
+            *userdata = cqe->user_data;
+            *result = cqe->res;
+
+            __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+            return 1;
+        }
+
+        if(!wait)
+            return 0;
+
+        if(uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+            return -1;
+    }
+}
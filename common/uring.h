@@ -0,0 +1,47 @@
+#ifndef URING_H
+    #define URING_H
+
+    #include <stdint.h>
+    #include <stddef.h>
+    #include <sys/uio.h>
+    #include <linux/io_uring.h>
+
+    //
+    // minimal io_uring wrapper, straight on top of the syscalls
+    // (no liburing dependency): one submission and one completion
+    // queue, sqe are prepared in place and flushed on submit
+    //
+    typedef struct uring_t {
+        int fd;
+        unsigned entries;
+        unsigned pending;
+
+        unsigned *sq_head;
+        unsigned *sq_tail;
+        unsigned *sq_mask;
+        unsigned *sq_array;
+        struct io_uring_sqe *sqes;
+
+        unsigned *cq_head;
+        unsigned *cq_tail;
+        unsigned *cq_mask;
+        struct io_uring_cqe *cqes;
+
+        void *sq_map;
+        void *cq_map;
+        size_t sq_maplen;
+        size_t cq_maplen;
+        size_t sqes_maplen;
+
+    } uring_t;
+
+    int uring_init(uring_t *ring, unsigned entries);
+    void uring_free(uring_t *ring);
+
+    int uring_register_buffers(uring_t *ring, struct iovec *iovecs, unsigned count);
+    int uring_register_files(uring_t *ring, int *fds, unsigned count);
+
+    struct io_uring_sqe *uring_sqe(uring_t *ring);
+    int uring_submit(uring_t *ring, unsigned wait);
+    int uring_reap(uring_t *ring, uint64_t *userdata, int32_t *result, int wait);
+#endif
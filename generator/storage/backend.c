@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <hiredis.h>
+#include "crc64.h"
+#include "storage.h"
+#include "pool.h"
+
+//
+// zdb backend
+//
+// one persistent connection per backend, reports are pipelined:
+// SET commands are appended to the output buffer and replies are
+// only read when the in-flight window is full or on flush, so many
+// reports share a single round-trip. pending commands are kept until
+// their reply arrives, to be replayed after a reconnection
+//
+#define BACKEND_WINDOW   64
+#define BACKEND_RETRIES  5
+
+static void backend_completed_default(backend_t *backend, void *userdata, int success) {
+    (void) backend;
+    (void) userdata;
+
+    if(success)
+        printf("[+] capacity report saved\n");
+}
+
+void backend_disconnect(backend_t *backend) {
+    if(backend->kntxt)
+        redisFree(backend->kntxt);
+
+    backend->kntxt = NULL;
+}
+
+// connect, authenticate and select namespace
+int backend_connect(backend_t *backend) {
+    struct timeval timeout = {.tv_sec = 5, .tv_usec = 0};
+    redisReply *reply;
+
+    backend_disconnect(backend);
+
+    if(!(backend->kntxt = redisConnectWithTimeout(backend->host, backend->port, timeout))) {
+        perror("zdb");
+        return 0;
+    }
+
+    if(backend->kntxt->err) {
+        fprintf(stderr, "[-] zdb: %s\n", backend->kntxt->errstr);
+        backend_disconnect(backend);
+        return 0;
+    }
+
+    if(backend->password) {
+        if(!(reply = redisCommand(backend->kntxt, "AUTH %s", backend->password)) || reply->type == REDIS_REPLY_ERROR) {
+            fprintf(stderr, "[-] zdb: authentication failed: %s\n", reply ? reply->str : backend->kntxt->errstr);
+            goto failed;
+        }
+
+        freeReplyObject(reply);
+    }
+
+    if(!(reply = redisCommand(backend->kntxt, "SELECT %s", backend->namespace)) || reply->type == REDIS_REPLY_ERROR) {
+        fprintf(stderr, "[-] zdb: could not select namespace: %s\n", reply ? reply->str : backend->kntxt->errstr);
+        goto failed;
+    }
+
+    freeReplyObject(reply);
+
+    return 1;
+
+failed:
+    if(reply)
+        freeReplyObject(reply);
+
+    backend_disconnect(backend);
+    return 0;
+}
+
+static int backend_append(backend_t *backend, backend_pending_t *pending) {
+    const char *argv[3] = {"SET", pending->key, pending->payload};
+    size_t argvlen[3] = {3, strlen(pending->key), pending->length};
+
+    return redisAppendCommandArgv(backend->kntxt, 3, argv, argvlen) == REDIS_OK;
+}
+
+static void backend_complete(backend_t *backend, int success) {
+    backend_pending_t *pending = &backend->pending[backend->head];
+
+    if(pending->notify)
+        backend->completed(backend, pending->userdata, success);
+
+    free(pending->key);
+    free(pending->payload);
+
+    backend->head = (backend->head + 1) % backend->window;
+    backend->inflight -= 1;
+}
+
+// reconnect and replay every command still waiting for a reply,
+// gives up (and fails them) after a few attempts
+static int backend_reconnect(backend_t *backend) {
+    for(int attempt = 1; attempt <= BACKEND_RETRIES; attempt++) {
+        if(backend_connect(backend)) {
+            int replayed = 1;
+
+            for(size_t i = 0; i < backend->inflight && replayed; i++)
+                replayed = backend_append(backend, &backend->pending[(backend->head + i) % backend->window]);
+
+            if(replayed)
+                return 1;
+        }
+
+        fprintf(stderr, "[-] zdb: connection attempt %d/%d failed\n", attempt, BACKEND_RETRIES);
+        sleep(attempt);
+    }
+
+    while(backend->inflight)
+        backend_complete(backend, 0);
+
+    return 0;
+}
+
+// read the reply of the oldest pending command
+static int backend_reply(backend_t *backend) {
+    redisReply *reply;
+
+    while(redisGetReply(backend->kntxt, (void **) &reply) != REDIS_OK) {
+        fprintf(stderr, "[-] zdb: %s, reconnecting\n", backend->kntxt->errstr);
+
+        if(!backend_reconnect(backend))
+            return 0;
+    }
+
+    int success = (reply->type != REDIS_REPLY_ERROR);
+
+    if(!success)
+        fprintf(stderr, "[-] could not commit report %s: %s\n", backend->pending[backend->head].key, reply->str);
+
+    freeReplyObject(reply);
+    backend_complete(backend, success);
+
+    return success;
+}
+
+static int backend_queue(backend_t *backend, char *key, void *payload, size_t length, void *userdata, int notify) {
+    if(!backend->window)
+        backend->window = BACKEND_WINDOW;
+
+    if(!backend->completed)
+        backend->completed = backend_completed_default;
+
+    if(!backend->pending && !(backend->pending = calloc(sizeof(backend_pending_t), backend->window)))
+        return 0;
+
+    // bounded in-flight queue, wait for the oldest one
+    if(backend->inflight == backend->window)
+        backend_reply(backend);
+
+    if(!backend->kntxt && !backend_reconnect(backend)) {
+        free(payload);
+
+        if(notify)
+            backend->completed(backend, userdata, 0);
+
+        return 0;
+    }
+
+    backend_pending_t *pending = &backend->pending[(backend->head + backend->inflight) % backend->window];
+
+    pending->key = strdup(key);
+    pending->payload = payload;
+    pending->length = length;
+    pending->userdata = userdata;
+    pending->notify = notify;
+
+    backend->inflight += 1;
+
+    if(!backend_append(backend, pending))
+        return backend_reconnect(backend);
+
+    return 1;
+}
+
+// queue a report, backend takes ownership of the payload which
+// is released once committed (or definitely failed)
+int backend_set(backend_t *backend, char *key, void *payload, size_t length, void *userdata) {
+    return backend_queue(backend, key, payload, length, userdata, 1);
+}
+
+// size class queue of this backend, registered on first use
+static backend_class_t *backend_class(backend_t *backend, uint64_t size) {
+    backend_class_t *class;
+
+    for(size_t i = 0; i < backend->classcount; i++)
+        if(backend->classes[i].size == size)
+            return &backend->classes[i];
+
+    if(backend->classcount == CAPACITY_MAX_SIZES)
+        return NULL;
+
+    // synchronous commands, nothing must be in flight
+    backend_flush(backend);
+
+    class = &backend->classes[backend->classcount];
+    class->size = size;
+
+    // a connection lost meanwhile is retried once, on a new one
+    for(int attempt = 0; ; attempt++) {
+        if(!backend->kntxt && !backend_reconnect(backend))
+            return NULL;
+
+        if(pool_register(backend->kntxt, size, backend->writer, &class->tail))
+            break;
+
+        backend_disconnect(backend);
+
+        if(attempt == 1) {
+            fprintf(stderr, "[-] zdb: could not register size class %lu\n", size);
+            return NULL;
+        }
+    }
+
+    backend->classcount += 1;
+
+    return class;
+}
+
+// writer id of this backend, host name and process id, so
+// generators on the same host get their own queues
+static void backend_writer(backend_t *backend) {
+    char hostname[32] = "unknown";
+
+    gethostname(hostname, sizeof(hostname) - 1);
+    hostname[sizeof(hostname) - 1] = '\0';
+
+    // separators of the writers list and the keys
+    for(char *c = hostname; *c; c++)
+        if(*c == ',' || *c == ' ')
+            *c = '_';
+
+    snprintf(backend->writer, sizeof(backend->writer), "%s-%d", hostname, getpid());
+}
+
+// list this writer in the pool and check in (see pool.h), again every
+// POOL_WRITER_REFRESH seconds in case a concurrent update unlisted it
+static int backend_join(backend_t *backend) {
+    time_t now = time(NULL);
+
+    if(!backend->writer[0])
+        backend_writer(backend);
+
+    if(backend->joined + POOL_WRITER_REFRESH > now)
+        return 1;
+
+    // synchronous commands, nothing must be in flight
+    backend_flush(backend);
+
+    // a connection lost meanwhile is retried once, on a new one
+    for(int attempt = 0; attempt < 2; attempt++) {
+        if(!backend->kntxt && !backend_reconnect(backend))
+            return 0;
+
+        if(pool_join(backend->kntxt, backend->writer)) {
+            backend->joined = now;
+            return 1;
+        }
+
+        backend_disconnect(backend);
+    }
+
+    return 0;
+}
+
+// queue a report and append it to the writer queue of its size class
+// (see pool.h), entry and tail are pipelined right after the report.
+// the report is saved even if indexing fails, it is never dropped here
+int backend_push(backend_t *backend, uint64_t size, char *key, void *payload, size_t length, void *userdata) {
+    char entry[POOL_KEY_MAX], item[32], value[32];
+
+    if(!backend_join(backend))
+        fprintf(stderr, "[-] zdb: could not list writer %s, next attempt on next report\n", backend->writer);
+
+    backend_class_t *class = backend_class(backend, size);
+
+    if(!backend_set(backend, key, payload, length, userdata))
+        return 0;
+
+    if(!class) {
+        fprintf(stderr, "[-] zdb: report %s saved but not indexed\n", key);
+        return 1;
+    }
+
+    sprintf(item, "%lu", class->tail);
+    pool_key(entry, size, backend->writer, item);
+    backend_queue(backend, entry, strdup(key), strlen(key), NULL, 0);
+
+    class->tail += 1;
+
+    pool_key(entry, size, backend->writer, "tail");
+    sprintf(value, "%lu", class->tail);
+    backend_queue(backend, entry, strdup(value), strlen(value), NULL, 0);
+
+    return 1;
+}
+
+// wait for every pending command, returns 0 if any of them failed
+int backend_flush(backend_t *backend) {
+    int success = 1;
+
+    while(backend->inflight)
+        if(!backend_reply(backend))
+            success = 0;
+
+    return success;
+}
+
+void backend_close(backend_t *backend) {
+    backend_flush(backend);
+
+    // stays listed while consumers still have its reports to pop
+    if(backend->joined && backend->kntxt)
+        pool_leave(backend->kntxt, backend->writer);
+
+    backend->joined = 0;
+    backend_disconnect(backend);
+
+    free(backend->pending);
+    backend->pending = NULL;
+}
@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "crc64.h"
+#include "storage.h"
+
+//
+// checkpoint index
+//
+// the chain value is recorded every 'interval' index in a file
+// next to the report, which makes a killed generation resumable
+// and any index derivable later by walking at most interval steps
+//
+// file layout (native endian):
+//   header        (checkpoint_header_t)
+//   offsets       (header.length * uint64_t)
+//   results       (header.length * uint64_t, rewritten on each checkpoint)
+//   values        (uint64_t, appended while walking, index 0 is seed)
+//
+// results are always written before the value of a checkpoint, so
+// every result before the last recorded value is final
+//
+#define CHECKPOINT_MAGIC  "CHAINCK2"
+
+typedef struct checkpoint_header_t {
+    char magic[8];
+    uint64_t seed;
+    uint64_t size;
+    uint64_t interval;
+    uint64_t length;
+    uint64_t key;
+    uint64_t subsets;
+
+} checkpoint_header_t;
+
+static off_t checkpoint_results_offset(size_t length) {
+    return sizeof(checkpoint_header_t) + (length * sizeof(uint64_t));
+}
+
+static off_t checkpoint_values_offset(size_t length) {
+    return checkpoint_results_offset(length) + (length * sizeof(uint64_t));
+}
+
+checkpoint_t *checkpoint_create(capacity_t *capacity, char *dirname, uint64_t interval) {
+    checkpoint_t *checkpoint;
+    char filename[512];
+
+    if(!(checkpoint = calloc(sizeof(checkpoint_t), 1)))
+        return NULL;
+
+    snprintf(filename, sizeof(filename), "%s/storage-%lu-%016lx.checkpoint", dirname, capacity->size, capacity->seed);
+
+    checkpoint->filename = strdup(filename);
+    checkpoint->interval = interval;
+    checkpoint->length = capacity->length;
+
+    if((checkpoint->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror(filename);
+        checkpoint_free(checkpoint);
+        return NULL;
+    }
+
+    checkpoint_header_t header = {
+        .seed = capacity->seed,
+        .size = capacity->size,
+        .interval = interval,
+        .length = capacity->length,
+        .key = capacity->key,
+        .subsets = capacity->subsets,
+    };
+
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+
+    size_t offsize = capacity->length * sizeof(uint64_t);
+
+    if(write(checkpoint->fd, &header, sizeof(header)) != sizeof(header))
+        goto failed;
+
+    if(write(checkpoint->fd, capacity->offsets, offsize) != (ssize_t) offsize)
+        goto failed;
+
+    // index 0 is the seed itself
+    if(!checkpoint_append(checkpoint, capacity->results, capacity->seed))
+        goto failed;
+
+    return checkpoint;
+
+failed:
+    perror(filename);
+    checkpoint_free(checkpoint);
+    return NULL;
+}
+
+// load an existing checkpoint file and rebuild the capacity
+// (seed, size, key and offsets) it was created for
+checkpoint_t *checkpoint_open(capacity_t *capacity, char *filename) {
+    checkpoint_header_t header;
+    checkpoint_t *checkpoint;
+    struct stat sb;
+
+    // allocated below, released on failure
+    capacity->offsets = NULL;
+    capacity->results = NULL;
+
+    if(!(checkpoint = calloc(sizeof(checkpoint_t), 1)))
+        return NULL;
+
+    checkpoint->filename = strdup(filename);
+
+    if((checkpoint->fd = open(filename, O_RDWR)) < 0) {
+        perror(filename);
+        goto failed;
+    }
+
+    if(read(checkpoint->fd, &header, sizeof(header)) != sizeof(header) || memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic))) {
+        fprintf(stderr, "[-] %s: not a checkpoint file\n", filename);
+        goto failed;
+    }
+
+    // interval divides every index lookup (checkpoint_derive)
+    if(header.interval == 0) {
+        fprintf(stderr, "[-] %s: invalid checkpoint interval\n", filename);
+        goto failed;
+    }
+
+    if(fstat(checkpoint->fd, &sb) < 0 || sb.st_size < checkpoint_values_offset(header.length) + (off_t) sizeof(uint64_t)) {
+        fprintf(stderr, "[-] %s: truncated checkpoint file\n", filename);
+        goto failed;
+    }
+
+    capacity->seed = header.seed;
+    capacity->size = header.size;
+    capacity->length = header.length;
+    capacity->key = header.key;
+    capacity->subsets = header.subsets;
+    capacity->offsets = calloc(sizeof(uint64_t), capacity->length);
+    capacity->results = calloc(sizeof(uint64_t), capacity->length);
+
+    size_t offsize = capacity->length * sizeof(uint64_t);
+
+    if(!capacity->offsets || !capacity->results) {
+        perror("calloc");
+        goto failed;
+    }
+
+    if(read(checkpoint->fd, capacity->offsets, offsize) != (ssize_t) offsize) {
+        perror(filename);
+        goto failed;
+    }
+
+    if(read(checkpoint->fd, capacity->results, offsize) != (ssize_t) offsize) {
+        perror(filename);
+        goto failed;
+    }
+
+    // a partially written trailing value (crash during append) is ignored
+    checkpoint->interval = header.interval;
+    checkpoint->length = header.length;
+    checkpoint->count = (sb.st_size - checkpoint_values_offset(header.length)) / sizeof(uint64_t);
+
+    size_t valsize = checkpoint->count * sizeof(uint64_t);
+
+    if(!(checkpoint->values = malloc(valsize))) {
+        perror("malloc");
+        goto failed;
+    }
+
+    if(read(checkpoint->fd, checkpoint->values, valsize) != (ssize_t) valsize) {
+        perror(filename);
+        goto failed;
+    }
+
+    if(checkpoint->values[0] != capacity->seed) {
+        fprintf(stderr, "[-] %s: checkpoint does not match seed\n", filename);
+        goto failed;
+    }
+
+    capacity->checkpoint = checkpoint;
+
+    return checkpoint;
+
+failed:
+    free(capacity->offsets);
+    free(capacity->results);
+    capacity->offsets = NULL;
+    capacity->results = NULL;
+
+    checkpoint_free(checkpoint);
+    return NULL;
+}
+
+// drop every value after 'count', used to align lanes on resume
+int checkpoint_truncate(checkpoint_t *checkpoint, size_t count) {
+    off_t length = checkpoint_values_offset(checkpoint->length) + (count * sizeof(uint64_t));
+
+    if(ftruncate(checkpoint->fd, length) < 0) {
+        perror(checkpoint->filename);
+        return 0;
+    }
+
+    checkpoint->count = count;
+
+    return 1;
+}
+
+int checkpoint_append(checkpoint_t *checkpoint, uint64_t *results, uint64_t value) {
+    size_t ressize = checkpoint->length * sizeof(uint64_t);
+
+    if(pwrite(checkpoint->fd, results, ressize, checkpoint_results_offset(checkpoint->length)) != (ssize_t) ressize) {
+        perror(checkpoint->filename);
+        return 0;
+    }
+
+    off_t offset = checkpoint_values_offset(checkpoint->length) + (checkpoint->count * sizeof(uint64_t));
+
+    if(pwrite(checkpoint->fd, &value, sizeof(value), offset) != sizeof(value)) {
+        perror(checkpoint->filename);
+        return 0;
+    }
+
+    // value need to reach the disk to be worth anything after a crash
+    fdatasync(checkpoint->fd);
+
+    if(!(checkpoint->values = realloc(checkpoint->values, (checkpoint->count + 1) * sizeof(uint64_t))))
+        return 0;
+
+    checkpoint->values[checkpoint->count] = value;
+    checkpoint->count += 1;
+
+    return 1;
+}
+
+// value of the chain at any index, walking from the nearest
+// recorded checkpoint (at most interval - 1 steps inside the
+// walked range)
+uint64_t checkpoint_derive(checkpoint_t *checkpoint, uint64_t index) {
+    size_t slot = index / checkpoint->interval;
+
+    if(slot >= checkpoint->count)
+        slot = checkpoint->count - 1;
+
+    uint64_t value = checkpoint->values[slot];
+
+    for(uint64_t i = slot * checkpoint->interval; i < index; i++)
+        value = crc64_u64(value);
+
+    return value;
+}
+
+void checkpoint_free(checkpoint_t *checkpoint) {
+    if(checkpoint->fd >= 0)
+        close(checkpoint->fd);
+
+    free(checkpoint->filename);
+    free(checkpoint->values);
+    free(checkpoint);
+}
@@ -0,0 +1,693 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <hiredis.h>
+#include "crc64.h"
+#include "storage.h"
+#include "pool.h"
+
+//
+// pool filler daemon
+//
+// keeps every size class of the pool at a target depth: a planner
+// hands jobs (one walk, up to CRC64_LANES seeds, every size class
+// in deficit up to the walked size) to worker threads pinned on
+// each allowed cpu, while a single saver thread pushes finished
+// reports to zdb so workers never wait on i/o
+//
+typedef struct pool_class_t {
+    size_t size;
+    size_t target;
+    size_t depth;     // reports available in the pool
+    size_t pending;   // reports being generated or saved
+
+} pool_class_t;
+
+typedef struct save_t {
+    char *key;
+    void *payload;
+    size_t length;
+    size_t class;
+    char *checkpoint;
+    struct save_t *next;
+
+} save_t;
+
+typedef struct daemon_t {
+    pthread_mutex_t lock;
+    pthread_cond_t updated;
+    pthread_cond_t saving;
+
+    backend_t *backend;
+    backend_t scanner;
+    backend_t writer;
+    pool_class_t classes[CAPACITY_MAX_SIZES];
+    size_t classcount;
+
+    // measured chain walk speed of one worker (steps per second)
+    double throughput;
+
+    size_t interval;
+    char *checkpoints;
+
+    save_t *head;
+    save_t *tail;
+    size_t failed;    // saves queued again since last round
+
+    struct job_t *resumed;   // walks left by a previous run
+
+} daemon_t;
+
+// seconds between two rounds when saves failed
+#define DAEMON_SAVE_RETRY  5
+
+typedef struct worker_t {
+    daemon_t *daemon;
+    pthread_t thread;
+    size_t id;
+    int cpu;
+    int node;
+
+} worker_t;
+
+typedef struct job_t {
+    capacity_t capacities[CAPACITY_MAX];
+    size_t classes[CAPACITY_MAX];
+    size_t count;
+    size_t lanes;
+    size_t longest;
+
+    int resumed;
+    size_t position;
+    struct job_t *next;
+
+} job_t;
+
+// first chain throughput guess, refined after each job
+#define DAEMON_THROUGHPUT_DEFAULT  (150 * 1000 * 1000.0)
+
+static double time_spent(struct timeval *timer) {
+    return (((size_t) timer->tv_sec * 1000000) + timer->tv_usec) / 1000000.0;
+}
+
+// numa node of a cpu, from sysfs topology (0 if unknown)
+static int cpu_node(int cpu) {
+    char path[128];
+    struct dirent *entry;
+    DIR *dir;
+    int node = 0;
+
+    sprintf(path, "/sys/devices/system/cpu/cpu%d", cpu);
+
+    if(!(dir = opendir(path)))
+        return 0;
+
+    while((entry = readdir(dir))) {
+        if(strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+
+    closedir(dir);
+
+    return node;
+}
+
+// parse 'size:depth,size:depth,...' list, sorted by size. any
+// invalid entry fails the whole list (0 returned)
+static size_t daemon_targets(daemon_t *daemon, char *input) {
+    char *copy = strdup(input);
+    char *saveptr = NULL;
+    char *end;
+
+    for(char *item = strtok_r(copy, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        char *depth = strchr(item, ':');
+        pool_class_t *class = &daemon->classes[daemon->classcount];
+
+        if(daemon->classcount == CAPACITY_MAX_SIZES) {
+            fprintf(stderr, "[-] too many size classes (maximum %d)\n", CAPACITY_MAX_SIZES);
+            goto failed;
+        }
+
+        if(!depth) {
+            fprintf(stderr, "[-] malformed target: %s (expected size:depth)\n", item);
+            goto failed;
+        }
+
+        *depth = '\0';
+
+        if(!human_readable_parse(item, &class->size) || class->size < S_GB) {
+            fprintf(stderr, "[-] invalid target size: %s (minimum 1 GB)\n", item);
+            goto failed;
+        }
+
+        class->target = strtoul(depth + 1, &end, 10);
+
+        if(depth[1] == '\0' || *end != '\0' || class->target == 0) {
+            fprintf(stderr, "[-] invalid target depth: %s\n", depth + 1);
+            goto failed;
+        }
+
+        daemon->classcount += 1;
+
+        for(size_t i = daemon->classcount - 1; i > 0 && daemon->classes[i].size < daemon->classes[i - 1].size; i--) {
+            pool_class_t swap = daemon->classes[i];
+            daemon->classes[i] = daemon->classes[i - 1];
+            daemon->classes[i - 1] = swap;
+        }
+    }
+
+    free(copy);
+
+    return daemon->classcount;
+
+failed:
+    free(copy);
+    daemon->classcount = 0;
+
+    return 0;
+}
+
+// count reports per size class currently in the pool, from
+// the size class queues counters (see pool.h)
+static int daemon_depth(daemon_t *daemon, size_t *depths) {
+    backend_t *backend = &daemon->scanner;
+
+    if(!backend->kntxt && !backend_connect(backend))
+        return 0;
+
+    for(size_t c = 0; c < daemon->classcount; c++) {
+        uint64_t depth;
+
+        if(!pool_depth(backend->kntxt, daemon->classes[c].size, &depth)) {
+            // connection lost, next refresh reconnects
+            fprintf(stderr, "[-] zdb: %s\n", backend->kntxt->errstr);
+            backend_disconnect(backend);
+            return 0;
+        }
+
+        depths[c] = depth;
+    }
+
+    return 1;
+}
+
+// estimated walk time of a size class, lock must be held
+static double daemon_estimate(daemon_t *daemon, size_t size) {
+    return (size / sizeof(uint64_t)) / daemon->throughput;
+}
+
+// pick the next job, lock must be held. a walk up to a class size
+// fills that class and rides along every smaller class in deficit
+// on the same lanes: the walk covering the most relative deficit per
+// estimated second wins (cheapest one on ties)
+static int daemon_plan(daemon_t *daemon, job_t *job) {
+    double best = 0, covered = 0;
+    size_t picked = SIZE_MAX;
+    size_t missing[CAPACITY_MAX_SIZES];
+
+    for(size_t c = 0; c < daemon->classcount; c++) {
+        pool_class_t *class = &daemon->classes[c];
+        size_t available = class->depth + class->pending;
+
+        missing[c] = available < class->target ? class->target - available : 0;
+
+        if(!missing[c])
+            continue;
+
+        // classes are sorted by size, previous ones ride along
+        covered += (missing[c] < CRC64_LANES ? missing[c] : CRC64_LANES) / (double) class->target;
+        double rate = covered / daemon_estimate(daemon, class->size);
+
+        if(rate > best) {
+            best = rate;
+            picked = c;
+        }
+    }
+
+    if(picked == SIZE_MAX)
+        return 0;
+
+    memset(job, 0, sizeof(job_t));
+
+    job->lanes = missing[picked] < CRC64_LANES ? missing[picked] : CRC64_LANES;
+    job->longest = daemon->classes[picked].size;
+
+    for(size_t l = 0; l < job->lanes; l++) {
+        uint64_t seed = rand64();
+
+        for(size_t c = 0; c <= picked; c++) {
+            if(l >= missing[c])
+                continue;
+
+            capacity_t *capacity = &job->capacities[job->count];
+
+            *capacity = (capacity_t) {.seed = seed, .size = daemon->classes[c].size};
+            capacity_prepare(capacity);
+
+            job->classes[job->count] = c;
+            job->count += 1;
+
+            daemon->classes[c].pending += 1;
+        }
+    }
+
+    return 1;
+}
+
+// queue a job rebuilt from checkpoint files, lanes restart from
+// the last checkpoint common to all of them (see capacity_resume)
+static int daemon_resumed(daemon_t *daemon, job_t *job) {
+    size_t slot = SIZE_MAX;
+
+    for(size_t c = 0; c < job->count; c++)
+        if(job->capacities[c].checkpoint->count < slot)
+            slot = job->capacities[c].checkpoint->count;
+
+    for(size_t c = 0; c < job->count; c++) {
+        capacity_t *capacity = &job->capacities[c];
+
+        if(capacity->checkpoint->count > slot && !checkpoint_truncate(capacity->checkpoint, slot)) {
+            for(size_t i = 0; i < job->count; i++)
+                capacity_free(&job->capacities[i]);
+
+            free(job);
+            return 0;
+        }
+
+        if(capacity->size > job->longest)
+            job->longest = capacity->size;
+
+        daemon->classes[job->classes[c]].pending += 1;
+    }
+
+    job->resumed = 1;
+    job->position = (slot - 1) * job->capacities[0].checkpoint->interval;
+    job->next = daemon->resumed;
+    daemon->resumed = job;
+
+    return 1;
+}
+
+static int daemon_seed_compare(const void *a, const void *b) {
+    const capacity_t *ca = a, *cb = b;
+    return (ca->seed > cb->seed) - (ca->seed < cb->seed);
+}
+
+// pick up the walks a previous run left in the checkpoint directory
+// (killed before their reports were saved). reports of the same seed
+// share a lane, up to CRC64_LANES seeds of the same interval share a
+// job. returns the amount of reports resumed
+static size_t daemon_resume(daemon_t *daemon) {
+    capacity_t *capacities = NULL;
+    size_t count = 0, resumed = 0;
+    struct dirent *entry;
+    char filename[512];
+    job_t *job = NULL;
+    DIR *dir;
+
+    if(!(dir = opendir(daemon->checkpoints))) {
+        perror(daemon->checkpoints);
+        return 0;
+    }
+
+    while((entry = readdir(dir))) {
+        size_t length = strlen(entry->d_name);
+
+        if(strncmp(entry->d_name, "storage-", 8) || length < 11 || strcmp(entry->d_name + length - 11, ".checkpoint"))
+            continue;
+
+        if(!(capacities = realloc(capacities, (count + 1) * sizeof(capacity_t)))) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+
+        capacity_t *capacity = &capacities[count];
+        *capacity = (capacity_t) {0};
+
+        snprintf(filename, sizeof(filename), "%s/%s", daemon->checkpoints, entry->d_name);
+
+        if(!checkpoint_open(capacity, filename)) {
+            capacity_free(capacity);
+            continue;
+        }
+
+        count += 1;
+    }
+
+    closedir(dir);
+
+    qsort(capacities, count, sizeof(capacity_t), daemon_seed_compare);
+
+    for(size_t i = 0; i < count; i++) {
+        capacity_t *capacity = &capacities[i];
+        size_t class;
+
+        for(class = 0; class < daemon->classcount; class++)
+            if(daemon->classes[class].size == capacity->size)
+                break;
+
+        if(class == daemon->classcount) {
+            fprintf(stderr, "[-] %s: %.0f GB is not a target size, not resumed\n", capacity->checkpoint->filename, GB(capacity->size));
+            capacity_free(capacity);
+            continue;
+        }
+
+        int lane = job && job->count && job->capacities[job->count - 1].seed == capacity->seed;
+
+        // current job is full, or can't share the walk
+        if(job && ((!lane && job->lanes == CRC64_LANES) || job->count == CAPACITY_MAX ||
+                   job->capacities[0].checkpoint->interval != capacity->checkpoint->interval)) {
+            resumed += daemon_resumed(daemon, job) ? job->count : 0;
+            job = NULL;
+            lane = 0;
+        }
+
+        if(!job && !(job = calloc(sizeof(job_t), 1))) {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+
+        printf("[+] daemon: resuming seed 0x%016lx (%.0f GB, %lu checkpoints)\n",
+                capacity->seed, GB(capacity->size), capacity->checkpoint->count);
+
+        job->capacities[job->count] = *capacity;
+        job->classes[job->count] = class;
+        job->count += 1;
+        job->lanes += lane ? 0 : 1;
+    }
+
+    if(job)
+        resumed += daemon_resumed(daemon, job) ? job->count : 0;
+
+    free(capacities);
+
+    return resumed;
+}
+
+static void daemon_enqueue(daemon_t *daemon, char *key, void *payload, size_t length, size_t class, checkpoint_t *checkpoint) {
+    save_t *save = calloc(sizeof(save_t), 1);
+
+    save->key = strdup(key);
+    save->payload = payload;
+    save->length = length;
+    save->class = class;
+    save->checkpoint = checkpoint ? strdup(checkpoint->filename) : NULL;
+
+    pthread_mutex_lock(&daemon->lock);
+
+    if(daemon->tail)
+        daemon->tail->next = save;
+    else
+        daemon->head = save;
+
+    daemon->tail = save;
+
+    pthread_cond_signal(&daemon->saving);
+    pthread_mutex_unlock(&daemon->lock);
+}
+
+// called by the writer backend once a report is committed (or not).
+// a walked report is never dropped: a failed save is queued again,
+// the walk is only over (and its checkpoint removed) once committed
+static void daemon_saved(backend_t *backend, void *userdata, int success) {
+    daemon_t *daemon = backend->owner;
+    save_t *save = userdata;
+    pool_class_t *class = &daemon->classes[save->class];
+
+    if(!success) {
+        fprintf(stderr, "[-] report %s not saved, retrying\n", save->key);
+
+        pthread_mutex_lock(&daemon->lock);
+
+        save->next = NULL;
+
+        if(daemon->tail)
+            daemon->tail->next = save;
+        else
+            daemon->head = save;
+
+        daemon->tail = save;
+        daemon->failed += 1;
+
+        pthread_mutex_unlock(&daemon->lock);
+        return;
+    }
+
+    if(save->checkpoint && unlink(save->checkpoint) < 0)
+        perror(save->checkpoint);
+
+    free(save->checkpoint);
+    free(save->payload);
+    free(save->key);
+    free(save);
+
+    pthread_mutex_lock(&daemon->lock);
+
+    class->pending -= 1;
+    class->depth += 1;
+
+    pthread_cond_broadcast(&daemon->updated);
+    pthread_mutex_unlock(&daemon->lock);
+}
+
+static void *daemon_saver(void *args) {
+    daemon_t *daemon = args;
+
+    while(1) {
+        pthread_mutex_lock(&daemon->lock);
+
+        while(!daemon->head)
+            pthread_cond_wait(&daemon->saving, &daemon->lock);
+
+        // take the whole queue, pipelined in one go
+        save_t *save = daemon->head;
+        daemon->head = NULL;
+        daemon->tail = NULL;
+
+        size_t failed = daemon->failed;
+        daemon->failed = 0;
+
+        pthread_mutex_unlock(&daemon->lock);
+
+        // failed saves came back in the queue, don't hammer zdb
+        if(failed)
+            sleep(DAEMON_SAVE_RETRY);
+
+        // the save itself is released (or queued again) by daemon_saved,
+        // which can be called before backend_push returns. the backend
+        // gets its own copy of the payload, the save keeps the original
+        while(save) {
+            save_t *next = save->next;
+            char key[128];
+            void *payload;
+
+            snprintf(key, sizeof(key), "%s", save->key);
+
+            if(!(payload = malloc(save->length))) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+
+            memcpy(payload, save->payload, save->length);
+
+            size_t size = daemon->classes[save->class].size;
+            backend_push(&daemon->writer, size, key, payload, save->length, save);
+
+            save = next;
+        }
+
+        backend_flush(&daemon->writer);
+    }
+
+    return NULL;
+}
+
+static void *daemon_worker(void *args) {
+    worker_t *worker = args;
+    daemon_t *daemon = worker->daemon;
+    struct timeval time_begin, time_end;
+    cpu_set_t cpuset;
+    job_t *job;
+
+    // pinned, so buffers allocated here stay on the local numa node
+    CPU_ZERO(&cpuset);
+    CPU_SET(worker->cpu, &cpuset);
+
+    if(pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset))
+        fprintf(stderr, "[-] worker %lu: could not pin to cpu %d\n", worker->id, worker->cpu);
+
+    if(!(job = malloc(sizeof(job_t))))
+        return NULL;
+
+    while(1) {
+        pthread_mutex_lock(&daemon->lock);
+
+        // walks left by a previous run go first
+        if(daemon->resumed) {
+            job_t *resumed = daemon->resumed;
+            daemon->resumed = resumed->next;
+
+            memcpy(job, resumed, sizeof(job_t));
+            free(resumed);
+
+        } else {
+            while(!daemon_plan(daemon, job))
+                pthread_cond_wait(&daemon->updated, &daemon->lock);
+        }
+
+        double estimated = daemon_estimate(daemon, job->longest);
+
+        pthread_mutex_unlock(&daemon->lock);
+
+        printf("[+] worker %lu (cpu %d, node %d): %lu reports, %lu lanes up to %.0f GB, estimated %.0f seconds\n",
+                worker->id, worker->cpu, worker->node, job->count, job->lanes, GB(job->longest), estimated);
+
+        for(size_t c = 0; c < job->count && !job->resumed; c++) {
+            capacity_t *capacity = &job->capacities[c];
+
+            if(daemon->interval && !(capacity->checkpoint = checkpoint_create(capacity, daemon->checkpoints, daemon->interval)))
+                fprintf(stderr, "[-] worker %lu: checkpoint disabled for this job\n", worker->id);
+        }
+
+        gettimeofday(&time_begin, NULL);
+        capacity_generate(job->capacities, job->count, job->position);
+        gettimeofday(&time_end, NULL);
+
+        double timed = time_spent(&time_end) - time_spent(&time_begin);
+
+        pthread_mutex_lock(&daemon->lock);
+        daemon->throughput = (daemon->throughput * 0.7) + (((job->longest / sizeof(uint64_t)) / timed) * 0.3);
+        pthread_mutex_unlock(&daemon->lock);
+
+        printf("[+] worker %lu: job done in %.1f seconds\n", worker->id, timed);
+
+        for(size_t c = 0; c < job->count; c++) {
+            capacity_t *capacity = &job->capacities[c];
+            char keyname[128];
+            size_t length;
+
+            sprintf(keyname, "storage-%lu-%016lx", capacity->size, capacity->seed);
+
+            void *payload = capacity_serialize(capacity, &length);
+            daemon_enqueue(daemon, keyname, payload, length, job->classes[c], capacity->checkpoint);
+
+            capacity_free(capacity);
+        }
+    }
+
+    return NULL;
+}
+
+int daemon_run(backend_t *backend, char *targets, size_t workers, size_t interval, char *checkpoints, size_t refresh) {
+    daemon_t daemon = {
+        .backend = backend,
+        .throughput = DAEMON_THROUGHPUT_DEFAULT,
+        .interval = interval,
+        .checkpoints = checkpoints,
+    };
+
+    size_t depths[CAPACITY_MAX_SIZES];
+    cpu_set_t allowed;
+    pthread_t saver;
+
+    if(!daemon_targets(&daemon, targets))
+        return 1;
+
+    // one persistent connection for scans, one for pipelined saves
+    daemon.scanner = *backend;
+    daemon.writer = *backend;
+    daemon.writer.completed = daemon_saved;
+    daemon.writer.owner = &daemon;
+
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+        perror("sched_getaffinity");
+        return 1;
+    }
+
+    if(workers == 0)
+        workers = CPU_COUNT(&allowed);
+
+    pthread_mutex_init(&daemon.lock, NULL);
+    pthread_cond_init(&daemon.updated, NULL);
+    pthread_cond_init(&daemon.saving, NULL);
+
+    // long running, output usually goes to a log
+    capacity_progress = 0;
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    printf("[+] daemon: %lu workers, pool refresh every %lu seconds\n", workers, refresh);
+
+    for(size_t c = 0; c < daemon.classcount; c++)
+        printf("[+] daemon: target %.0f GB: %lu reports\n", GB(daemon.classes[c].size), daemon.classes[c].target);
+
+    if(!daemon_depth(&daemon, depths))
+        return 1;
+
+    for(size_t c = 0; c < daemon.classcount; c++)
+        daemon.classes[c].depth = depths[c];
+
+    // checkpoints are only written (and so resumed) with an interval
+    if(daemon.interval) {
+        size_t resumed = daemon_resume(&daemon);
+        printf("[+] daemon: %lu reports resumed from %s\n", resumed, daemon.checkpoints);
+    }
+
+    if(pthread_create(&saver, NULL, daemon_saver, &daemon)) {
+        perror("pthread_create");
+        return 1;
+    }
+
+    worker_t *pool = calloc(sizeof(worker_t), workers);
+    int cpu = -1;
+
+    for(size_t w = 0; w < workers; w++) {
+        // next allowed cpu, wrapping if more workers than cpus
+        do {
+            cpu = (cpu + 1) % CPU_SETSIZE;
+        } while(!CPU_ISSET(cpu, &allowed));
+
+        pool[w] = (worker_t) {
+            .daemon = &daemon,
+            .id = w,
+            .cpu = cpu,
+            .node = cpu_node(cpu),
+        };
+
+        if(pthread_create(&pool[w].thread, NULL, daemon_worker, &pool[w])) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    while(1) {
+        sleep(refresh);
+
+        // pool is consumed from outside, depth needs to be refreshed
+        if(!daemon_depth(&daemon, depths))
+            continue;
+
+        pthread_mutex_lock(&daemon.lock);
+
+        for(size_t c = 0; c < daemon.classcount; c++) {
+            pool_class_t *class = &daemon.classes[c];
+            class->depth = depths[c];
+
+            printf("[+] daemon: pool %.0f GB: %lu / %lu (%lu pending, %.0f seconds per walk)\n",
+                    GB(class->size), class->depth, class->target, class->pending, daemon_estimate(&daemon, class->size));
+        }
+
+        pthread_cond_broadcast(&daemon.updated);
+        pthread_mutex_unlock(&daemon.lock);
+    }
+
+    return 0;
+}
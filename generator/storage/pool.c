@@ -0,0 +1,421 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <hiredis.h>
+#include "pool.h"
+
+// how many entries a pop tries before reading counters again
+#define POOL_CLAIM_ATTEMPTS  8
+
+static uint64_t reply_u64(redisReply *reply) {
+    if(!reply || reply->type != REDIS_REPLY_STRING)
+        return 0;
+
+    return strtoull(reply->str, NULL, 10);
+}
+
+static int pool_set(redisContext *kntxt, const char *key, const char *value) {
+    redisReply *reply;
+
+    if(!(reply = redisCommand(kntxt, "SET %s %s", key, value)))
+        return 0;
+
+    int success = reply->type != REDIS_REPLY_ERROR;
+    freeReplyObject(reply);
+
+    return success;
+}
+
+// key of a writer queue item: 'head', 'tail' or an entry index
+void pool_key(char *key, uint64_t size, const char *writer, const char *item) {
+    snprintf(key, POOL_KEY_MAX, "pool-%lu-%s-%s", size, writer, item);
+}
+
+// sorted list of size classes indexed, returns amount of classes
+size_t pool_classes(redisContext *kntxt, uint64_t *sizes, size_t max) {
+    redisReply *reply;
+    size_t count = 0;
+
+    if(!(reply = redisCommand(kntxt, "GET %s", POOL_CLASSES_KEY)))
+        return 0;
+
+    if(reply->type == REDIS_REPLY_STRING) {
+        char *cursor = reply->str;
+
+        while(count < max && *cursor) {
+            sizes[count++] = strtoull(cursor, &cursor, 10);
+
+            if(*cursor == ',')
+                cursor++;
+        }
+    }
+
+    freeReplyObject(reply);
+
+    return count;
+}
+
+// list of writers ids, returns amount of writers
+size_t pool_writers(redisContext *kntxt, char writers[][POOL_WRITER_MAX], size_t max) {
+    redisReply *reply;
+    size_t count = 0;
+
+    if(!(reply = redisCommand(kntxt, "GET %s", POOL_WRITERS_KEY)))
+        return 0;
+
+    if(reply->type == REDIS_REPLY_STRING) {
+        char *cursor = reply->str;
+
+        while(count < max && *cursor) {
+            size_t length = strcspn(cursor, ",");
+
+            if(length && length < POOL_WRITER_MAX) {
+                memcpy(writers[count], cursor, length);
+                writers[count++][length] = '\0';
+            }
+
+            cursor += length;
+
+            if(*cursor == ',')
+                cursor++;
+        }
+    }
+
+    freeReplyObject(reply);
+
+    return count;
+}
+
+static int pool_writers_save(redisContext *kntxt, char writers[][POOL_WRITER_MAX], size_t count) {
+    char value[POOL_WRITERS_MAX * POOL_WRITER_MAX] = "";
+    char *cursor = value;
+
+    for(size_t i = 0; i < count; i++)
+        cursor += sprintf(cursor, i ? ",%s" : "%s", writers[i]);
+
+    return pool_set(kntxt, POOL_WRITERS_KEY, value);
+}
+
+// read head and tail of a writer queue in a single round-trip
+int pool_counters(redisContext *kntxt, uint64_t size, const char *writer, uint64_t *head, uint64_t *tail) {
+    redisReply *reply;
+    char key[POOL_KEY_MAX];
+
+    pool_key(key, size, writer, "head");
+    redisAppendCommand(kntxt, "GET %s", key);
+
+    pool_key(key, size, writer, "tail");
+    redisAppendCommand(kntxt, "GET %s", key);
+
+    if(redisGetReply(kntxt, (void **) &reply) != REDIS_OK)
+        return 0;
+
+    *head = reply_u64(reply);
+    freeReplyObject(reply);
+
+    if(redisGetReply(kntxt, (void **) &reply) != REDIS_OK)
+        return 0;
+
+    *tail = reply_u64(reply);
+    freeReplyObject(reply);
+
+    return 1;
+}
+
+// reports available in a size class, every writer included
+int pool_depth(redisContext *kntxt, uint64_t size, uint64_t *depth) {
+    char writers[POOL_WRITERS_MAX][POOL_WRITER_MAX];
+    size_t count = pool_writers(kntxt, writers, POOL_WRITERS_MAX);
+
+    *depth = 0;
+
+    for(size_t w = 0; w < count; w++) {
+        uint64_t head, tail;
+
+        if(!pool_counters(kntxt, size, writers[w], &head, &tail))
+            return 0;
+
+        *depth += tail > head ? tail - head : 0;
+    }
+
+    return 1;
+}
+
+// generator side: list 'writer' if missing and check in, called
+// again every POOL_WRITER_REFRESH seconds
+int pool_join(redisContext *kntxt, const char *writer) {
+    char writers[POOL_WRITERS_MAX][POOL_WRITER_MAX];
+    char key[POOL_KEY_MAX], value[32];
+    size_t count = pool_writers(kntxt, writers, POOL_WRITERS_MAX);
+    size_t index = 0;
+
+    if(strlen(writer) >= POOL_WRITER_MAX || strchr(writer, ','))
+        return 0;
+
+    while(index < count && strcmp(writers[index], writer) != 0)
+        index++;
+
+    if(index == count) {
+        if(count == POOL_WRITERS_MAX)
+            return 0;
+
+        strcpy(writers[count], writer);
+
+        if(!pool_writers_save(kntxt, writers, count + 1))
+            return 0;
+    }
+
+    snprintf(key, sizeof(key), "pool-writer-%s", writer);
+    sprintf(value, "%ld", time(NULL));
+
+    return pool_set(kntxt, key, value);
+}
+
+// generator side: make sure 'size' is listed in the classes
+// and fetch the current tail of the writer queue
+int pool_register(redisContext *kntxt, uint64_t size, const char *writer, uint64_t *tail) {
+    uint64_t sizes[POOL_CLASSES_MAX], head;
+    size_t count = pool_classes(kntxt, sizes, POOL_CLASSES_MAX);
+    size_t index = 0;
+
+    while(index < count && sizes[index] < size)
+        index++;
+
+    if(index == count || sizes[index] != size) {
+        char value[POOL_CLASSES_MAX * 21] = "";
+        char *cursor = value;
+
+        if(count == POOL_CLASSES_MAX)
+            return 0;
+
+        memmove(sizes + index + 1, sizes + index, (count - index) * sizeof(uint64_t));
+        sizes[index] = size;
+
+        for(size_t i = 0; i <= count; i++)
+            cursor += sprintf(cursor, i ? ",%lu" : "%lu", sizes[i]);
+
+        if(!pool_set(kntxt, POOL_CLASSES_KEY, value))
+            return 0;
+    }
+
+    return pool_counters(kntxt, size, writer, &head, tail);
+}
+
+// every queue of a writer consumed, -1 on connection error
+static int pool_drained(redisContext *kntxt, const char *writer, uint64_t *sizes, size_t count) {
+    for(size_t c = 0; c < count; c++) {
+        uint64_t head, tail;
+
+        if(!pool_counters(kntxt, sizes[c], writer, &head, &tail))
+            return -1;
+
+        if(head < tail)
+            return 0;
+    }
+
+    return 1;
+}
+
+// unlist a writer and drop its counters and check-in
+static int pool_forget(redisContext *kntxt, const char *writer, uint64_t *sizes, size_t count) {
+    char writers[POOL_WRITERS_MAX][POOL_WRITER_MAX];
+    char key[POOL_KEY_MAX];
+    size_t listed = pool_writers(kntxt, writers, POOL_WRITERS_MAX);
+    size_t kept = 0;
+
+    for(size_t w = 0; w < listed; w++)
+        if(strcmp(writers[w], writer) != 0)
+            memmove(writers[kept++], writers[w], POOL_WRITER_MAX);
+
+    if(kept != listed && !pool_writers_save(kntxt, writers, kept))
+        return 0;
+
+    for(size_t c = 0; c < count; c++) {
+        pool_key(key, sizes[c], writer, "head");
+        freeReplyObject(redisCommand(kntxt, "DEL %s", key));
+
+        pool_key(key, sizes[c], writer, "tail");
+        freeReplyObject(redisCommand(kntxt, "DEL %s", key));
+    }
+
+    snprintf(key, sizeof(key), "pool-writer-%s", writer);
+    freeReplyObject(redisCommand(kntxt, "DEL %s", key));
+
+    return 1;
+}
+
+// generator side: leave the list when nothing is left in the writer
+// queues, returns 0 if the writer stays listed
+int pool_leave(redisContext *kntxt, const char *writer) {
+    uint64_t sizes[POOL_CLASSES_MAX];
+    size_t count = pool_classes(kntxt, sizes, POOL_CLASSES_MAX);
+
+    if(pool_drained(kntxt, writer, sizes, count) != 1)
+        return 0;
+
+    return pool_forget(kntxt, writer, sizes, count);
+}
+
+// consumer side: forget writers not checked in for 'stale' seconds
+// whose queues are drained, returns amount of writers pruned
+size_t pool_prune(redisContext *kntxt, time_t stale) {
+    char writers[POOL_WRITERS_MAX][POOL_WRITER_MAX];
+    uint64_t sizes[POOL_CLASSES_MAX];
+    size_t count = pool_classes(kntxt, sizes, POOL_CLASSES_MAX);
+    size_t listed = pool_writers(kntxt, writers, POOL_WRITERS_MAX);
+    size_t pruned = 0;
+    time_t now = time(NULL);
+
+    for(size_t w = 0; w < listed; w++) {
+        char key[POOL_KEY_MAX];
+        redisReply *reply;
+
+        snprintf(key, sizeof(key), "pool-writer-%s", writers[w]);
+
+        if(!(reply = redisCommand(kntxt, "GET %s", key)))
+            return pruned;
+
+        time_t seen = (time_t) reply_u64(reply);
+        freeReplyObject(reply);
+
+        if(seen + stale > now || pool_drained(kntxt, writers[w], sizes, count) != 1)
+            continue;
+
+        if(pool_forget(kntxt, writers[w], sizes, count))
+            pruned += 1;
+    }
+
+    return pruned;
+}
+
+// fetch and delete the report of entry 'index', returns 1 if this
+// consumer got it, 0 if the entry or the report is already gone
+// and -1 on connection error
+static int pool_claim(redisContext *kntxt, uint64_t size, const char *writer, uint64_t index, pool_report_t *report) {
+    redisReply *reply, *deleted;
+    char entry[POOL_KEY_MAX], item[32];
+
+    sprintf(item, "%lu", index);
+    pool_key(entry, size, writer, item);
+
+    if(!(reply = redisCommand(kntxt, "GET %s", entry)))
+        return -1;
+
+    if(reply->type != REDIS_REPLY_STRING || reply->len >= POOL_KEY_MAX) {
+        freeReplyObject(reply);
+        return 0;
+    }
+
+    memcpy(report->key, reply->str, reply->len);
+    report->key[reply->len] = '\0';
+    freeReplyObject(reply);
+
+    // fetch and delete in one round-trip, the delete decides
+    // who owns the report when consumers race on the same entry
+    redisAppendCommand(kntxt, "GET %s", report->key);
+    redisAppendCommand(kntxt, "DEL %s", report->key);
+    redisAppendCommand(kntxt, "DEL %s", entry);
+
+    if(redisGetReply(kntxt, (void **) &reply) != REDIS_OK)
+        return -1;
+
+    if(redisGetReply(kntxt, (void **) &deleted) != REDIS_OK) {
+        freeReplyObject(reply);
+        return -1;
+    }
+
+    int claimed = reply->type == REDIS_REPLY_STRING && deleted->type != REDIS_REPLY_ERROR;
+
+    if(deleted->type == REDIS_REPLY_INTEGER && deleted->integer == 0)
+        claimed = 0;
+
+    if(claimed) {
+        report->size = size;
+        report->length = reply->len;
+
+        if(!(report->payload = malloc(reply->len)))
+            claimed = -1;
+        else
+            memcpy(report->payload, reply->str, reply->len);
+    }
+
+    freeReplyObject(reply);
+    freeReplyObject(deleted);
+
+    // entry removal reply, not relevant
+    if(redisGetReply(kntxt, (void **) &reply) != REDIS_OK)
+        return -1;
+
+    freeReplyObject(reply);
+
+    return claimed;
+}
+
+// pop a report from one writer queue, same return values as pool_claim
+static int pool_pop_queue(redisContext *kntxt, uint64_t size, const char *writer, pool_report_t *report) {
+    uint64_t head, tail;
+
+    if(!pool_counters(kntxt, size, writer, &head, &tail))
+        return -1;
+
+    while(head < tail) {
+        uint64_t until = head + POOL_CLAIM_ATTEMPTS < tail ? head + POOL_CLAIM_ATTEMPTS : tail;
+        int claimed = 0;
+
+        for(; head < until && !claimed; head++)
+            if((claimed = pool_claim(kntxt, size, writer, head, report)) < 0)
+                return -1;
+
+        char key[POOL_KEY_MAX], value[32];
+        pool_key(key, size, writer, "head");
+        sprintf(value, "%lu", head);
+
+        pool_set(kntxt, key, value);
+
+        if(claimed)
+            return 1;
+
+        // other consumers may be ahead
+        if(!pool_counters(kntxt, size, writer, &head, &tail))
+            return -1;
+
+        head = head > until ? head : until;
+    }
+
+    return 0;
+}
+
+// pop a report from the smallest class able to hold 'size', any
+// writer, returns 0 if the pool has nothing large enough
+int pool_pop(redisContext *kntxt, uint64_t size, pool_report_t *report) {
+    char writers[POOL_WRITERS_MAX][POOL_WRITER_MAX];
+    uint64_t sizes[POOL_CLASSES_MAX];
+    size_t count = pool_classes(kntxt, sizes, POOL_CLASSES_MAX);
+    size_t listed = pool_writers(kntxt, writers, POOL_WRITERS_MAX);
+
+    memset(report, 0, sizeof(pool_report_t));
+
+    for(size_t c = 0; c < count; c++) {
+        if(sizes[c] < size)
+            continue;
+
+        for(size_t w = 0; w < listed; w++) {
+            int popped = pool_pop_queue(kntxt, sizes[c], writers[w], report);
+
+            if(popped < 0)
+                return 0;
+
+            if(popped)
+                return 1;
+        }
+    }
+
+    return 0;
+}
+
+void pool_report_free(pool_report_t *report) {
+    free(report->payload);
+    report->payload = NULL;
+}
@@ -0,0 +1,69 @@
+#ifndef POOL_H
+    #define POOL_H
+
+    #include <stdint.h>
+    #include <stddef.h>
+    #include <time.h>
+    #include <hiredis.h>
+
+    //
+    // size class index of the reports pool
+    //
+    // reports are still saved as 'storage-<size>-<seed>', each generator
+    // (a writer) additionally keeps its own queue per size class:
+    //
+    //   pool-classes            comma separated sorted list of sizes
+    //   pool-writers            comma separated list of writer ids
+    //   pool-writer-<id>        last check-in of the writer (unix time)
+    //   pool-<size>-<id>-tail   next entry index, written by that writer only
+    //   pool-<size>-<id>-head   first entry not consumed, written by consumers
+    //   pool-<size>-<id>-<n>    report key name of entry n
+    //
+    // zdb has no atomic counter, a tail is only safe with a single writer,
+    // hence one queue per writer: any amount of generators can fill the
+    // same pool at the same time. both lists are read-modify-write, a
+    // writer lost by a concurrent update is listed again on its next
+    // check-in (every POOL_WRITER_REFRESH seconds), its reports wait in
+    // its queue meanwhile, nothing is lost
+    //
+    // consumers claim a report by deleting it, entries pointing to an
+    // already deleted report are skipped, so concurrent consumers never
+    // get the same report. a pop costs a constant amount of round-trips
+    // per writer whatever the pool depth
+    //
+    // a writer leaves the list when it closes with its queues drained,
+    // one killed with reports left is pruned by consumers once its
+    // queues are drained and it didn't check in for POOL_WRITER_STALE
+    //
+    #define POOL_CLASSES_KEY  "pool-classes"
+    #define POOL_CLASSES_MAX  64
+    #define POOL_KEY_MAX      128
+
+    #define POOL_WRITERS_KEY     "pool-writers"
+    #define POOL_WRITERS_MAX     64
+    #define POOL_WRITER_MAX      48
+    #define POOL_WRITER_REFRESH  60     // seconds
+    #define POOL_WRITER_STALE    3600   // seconds
+
+    typedef struct pool_report_t {
+        uint64_t size;
+        char key[POOL_KEY_MAX];
+        char *payload;
+        size_t length;
+
+    } pool_report_t;
+
+    void pool_key(char *key, uint64_t size, const char *writer, const char *item);
+    size_t pool_classes(redisContext *kntxt, uint64_t *sizes, size_t max);
+    size_t pool_writers(redisContext *kntxt, char writers[][POOL_WRITER_MAX], size_t max);
+    int pool_counters(redisContext *kntxt, uint64_t size, const char *writer, uint64_t *head, uint64_t *tail);
+    int pool_depth(redisContext *kntxt, uint64_t size, uint64_t *depth);
+
+    int pool_join(redisContext *kntxt, const char *writer);
+    int pool_register(redisContext *kntxt, uint64_t size, const char *writer, uint64_t *tail);
+    int pool_leave(redisContext *kntxt, const char *writer);
+    size_t pool_prune(redisContext *kntxt, time_t stale);
+
+    int pool_pop(redisContext *kntxt, uint64_t size, pool_report_t *report);
+    void pool_report_free(pool_report_t *report);
+#endif
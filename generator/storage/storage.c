@@ -4,28 +4,45 @@
 #include <sys/time.h>
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
 #include <jansson.h>
-#include <hiredis.h>
+#include <getopt.h>
+#include <sys/random.h>
+#include "crc64.h"
+#include "offsets.h"
+#include "report.h"
 #include "storage.h"
 
-typedef struct capacity_t {
-    uint64_t seed;
-    uint64_t size;
-    uint64_t *offsets;
-    uint64_t *results;
-    size_t length;
+static struct option long_options[] = {
+    {"size",    required_argument, 0, 's'},
+    {"reports", required_argument, 0, 'r'},
+    {"checkpoint",     required_argument, 0, 'c'},
+    {"checkpoint-dir", required_argument, 0, 'C'},
+    {"resume",  required_argument, 0, 'R'},
+    {"derive",  required_argument, 0, 'D'},
+    {"daemon",  required_argument, 0, 'd'},
+    {"workers", required_argument, 0, 'w'},
+    {"refresh", required_argument, 0, 'f'},
+    {"json",    no_argument,       0, 'j'},
+    {"oversample", required_argument, 0, 'o'},
+    {"host",      required_argument, 0, 'H'},
+    {"port",      required_argument, 0, 'P'},
+    {"namespace", required_argument, 0, 'N'},
+    {"password",  required_argument, 0, 'W'},
+    {"help",    no_argument,       0, 'h'},
+    {0, 0, 0, 0}
+};
 
-} capacity_t;
+static char *human_readable_suffix = "kMGT";
 
-typedef struct backend_t {
-    char *host;
-    int port;
-    char *namespace;
-    char *password;
+// live progress line, disabled when running multiple workers
+int capacity_progress = 1;
 
-} backend_t;
+// legacy json reports instead of binary ones
+int capacity_json = 0;
 
-static char *human_readable_suffix = "kMGT";
+// challenges held by each report
+size_t capacity_subsets = 1;
 
 size_t *human_readable_parse(char *input, size_t *target) {
     char *endp = input;
@@ -48,6 +65,41 @@ size_t *human_readable_parse(char *input, size_t *target) {
     return target;
 }
 
+// comma separated list of sizes, sorted ascending, returns the
+// amount of sizes parsed or 0 on error
+size_t sizes_parse(char *input, size_t *sizes) {
+    char *copy = strdup(input);
+    char *saveptr = NULL;
+    size_t count = 0;
+
+    for(char *item = strtok_r(copy, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        if(count == CAPACITY_MAX_SIZES) {
+            fprintf(stderr, "[-] too many sizes (maximum %d)\n", CAPACITY_MAX_SIZES);
+            free(copy);
+            return 0;
+        }
+
+        if(!human_readable_parse(item, &sizes[count])) {
+            fprintf(stderr, "[-] malformed size: %s\n", item);
+            free(copy);
+            return 0;
+        }
+
+        // insertion sort, only a few entries
+        for(size_t i = count; i > 0 && sizes[i] < sizes[i - 1]; i--) {
+            size_t swap = sizes[i];
+            sizes[i] = sizes[i - 1];
+            sizes[i - 1] = swap;
+        }
+
+        count += 1;
+    }
+
+    free(copy);
+
+    return count;
+}
+
 static double time_spent(struct timeval *timer) {
     return (((size_t) timer->tv_sec * 1000000) + timer->tv_usec) / 1000000.0;
 }
@@ -60,26 +112,6 @@ static double speed(size_t size, double timed) {
     return (size / timed) / (1024 * 1024);
 }
 
-static int u64cmp(const void *a1, const void *a2) {
-    uint64_t xa1 = *(const uint64_t *) a1;
-    uint64_t xa2 = *(const uint64_t *) a2;
-    return xa1 - xa2;
-}
-
-void offsets_generate(uint64_t *dst, size_t size, uint64_t from, uint64_t to) {
-    uint64_t limit = to - from;
-
-    for(size_t i = 0; i < size; i++) {
-        dst[i] = (rand64() % limit) + from;
-    }
-
-    qsort(dst, size, sizeof(uint64_t), u64cmp);
-}
-
-uint64_t crcxx(uint64_t source) {
-    return crc64((uint8_t *) &source, sizeof(source));
-}
-
 char *capacity_dumps(capacity_t *capacity) {
     char key[32], convert[32];
 
@@ -99,166 +131,319 @@ char *capacity_dumps(capacity_t *capacity) {
     json_object_set_new(root, "results", results);
     json_object_set_new(root, "size", json_integer(capacity->size));
 
-    return json_dumps(root, JSON_SORT_KEYS | JSON_COMPACT);
+    char *json = json_dumps(root, JSON_SORT_KEYS | JSON_COMPACT);
+    json_decref(root);
+
+    return json;
 }
 
-int capacity_save(backend_t *backend, char *key, char *json) {
-    redisContext *kntxt = redisConnect(backend->host, backend->port);
-    redisReply *reply;
+// binary report (see report.h), single allocation, offsets
+// are not stored since they can be derived
+uint8_t *capacity_encode(capacity_t *capacity, size_t *length) {
+    uint8_t *buffer;
 
-    if(!kntxt) {
-        perror("zdb");
-        return 0;
-    }
+    if(!(buffer = malloc(report_encoded_max(capacity->length))))
+        return NULL;
 
-    if(kntxt->err) {
-        fprintf(stderr, "[-] zdb: %s\n", kntxt->errstr);
-        return 0;
-    }
+    report_t header = {
+        .seed = capacity->seed,
+        .size = capacity->size,
+        .count = capacity->length,
+        .key = capacity->key,
+        .subsets = capacity->subsets,
+    };
 
-    if(!(reply = redisCommand(kntxt, "SELECT %s", backend->namespace))) {
-        fprintf(stderr, "[-] zdb: could not execute command\n");
-        return 0;
-    }
+    *length = report_encode(buffer, &header, NULL, capacity->results);
 
-    if(strcmp(reply->str, "OK") != 0) {
-        printf("[-] warning: %s\n", reply->str);
+    return buffer;
+}
+
+// report payload in the configured format
+void *capacity_serialize(capacity_t *capacity, size_t *length) {
+    if(capacity_json) {
+        char *json = capacity_dumps(capacity);
+        *length = strlen(json);
+        return json;
     }
 
-    freeReplyObject(reply);
+    return capacity_encode(capacity, length);
+}
 
-    if(!(reply = redisCommand(kntxt, "SET %s %s", key, json))) {
-        fprintf(stderr, "[-] zdb: could not execute command\n");
-        return 0;
-    }
+// offsets key comes from the kernel, not from the seeds generator:
+// the node knows its seed, it must not be able to guess the key
+uint64_t capacity_key() {
+    uint64_t key;
 
-    if(strcmp(reply->str, key) != 0) {
-        printf("[-] could not commit report: %s\n", reply->str);
-        freeReplyObject(reply);
-        return 0;
+    if(getrandom(&key, sizeof(key), 0) != sizeof(key)) {
+        perror("getrandom");
+        exit(EXIT_FAILURE);
     }
 
-    printf("[+] capacity report saved\n");
-    freeReplyObject(reply);
+    return key;
+}
+
+// offsets to compute for capacity size, derived from a new random
+// key (see offsets.h), oversampled reports hold more datapoints
+// which are split into disjoint challenges later
+//
+// note: offsets are not bytes offsets but crc index
+void capacity_prepare(capacity_t *capacity) {
+    capacity->key = capacity_key();
+    capacity->subsets = capacity_subsets;
+    capacity->length = offsets_count(capacity->size) * capacity->subsets;
+
+    capacity->offsets = calloc(sizeof(uint64_t), capacity->length);
+    capacity->results = calloc(sizeof(uint64_t), capacity->length);
 
-    return 1;
+    offsets_generate(capacity->offsets, capacity->key, capacity->size, capacity->length);
 }
 
-int main(int argc, char *argv[]) {
-    capacity_t capacity = {
-        .size = 1 << 30,
-    };
+void capacity_free(capacity_t *capacity) {
+    free(capacity->offsets);
+    free(capacity->results);
 
-    printf(COLOR_CYAN "[+] initializing storage-proof generator\n" COLOR_RESET);
+    if(capacity->checkpoint)
+        checkpoint_free(capacity->checkpoint);
+}
 
-    if(argc > 1) {
-        human_readable_parse(argv[1], &capacity.size);
+// walk up to CRC64_LANES chains in lockstep, each capacity records
+// its own results at its own (sorted) offsets. capacities sharing
+// the same seed share the same lane, which gives reports for any
+// amount of sizes from a single walk up to the largest one
+//
+// when resuming, lanes starts from their checkpoint at 'position'
+// and results before it were restored from the checkpoints
+//
+// returns the amount of bytes of chain walked
+size_t capacity_generate(capacity_t *capacities, size_t count, size_t position) {
+    uint64_t lanes[CRC64_LANES] = {0};
+    size_t lane[CAPACITY_MAX] = {0};
+    size_t cursor[CAPACITY_MAX] = {0};
+    size_t used = 0;
+    size_t computed = 0;
+    size_t total = 0;
+    size_t begin = position;
+
+    // all lanes share the same checkpoint interval
+    uint64_t interval = capacities[0].checkpoint ? capacities[0].checkpoint->interval : 0;
+
+    struct timeval time_begin, time_end;
+
+    for(size_t c = 0; c < count; c++) {
+        capacity_t *capacity = &capacities[c];
+
+        for(lane[c] = 0; lane[c] < used; lane[c]++)
+            if(capacities[lane[c]].seed == capacity->seed)
+                break;
+
+        if(lane[c] == used) {
+            lanes[used] = capacity->checkpoint ? checkpoint_derive(capacity->checkpoint, position) : capacity->seed;
+            lane[c] = used++;
+        }
+
+        total += capacity->length;
+
+        while(cursor[c] < capacity->length && capacity->offsets[cursor[c]] < position) {
+            cursor[c] += 1;
+            computed += 1;
+        }
     }
 
-    if(capacity.size < (1 << 30)) {
-        fprintf(stderr, "[-] please do not use size smaller than 1 GB\n");
-        return 1;
+    if(capacity_progress) {
+        printf("[+] computing: initializing...");
+        fflush(stdout);
     }
 
-    // amount of crc to compute
-    size_t values = capacity.size / sizeof(uint64_t);
+    while(1) {
+        uint64_t next = UINT64_MAX;
 
-    printf("[+] generating dataset size: " COLOR_GREEN "%.0f GB" COLOR_RESET " (%lu bytes)\n", GB(capacity.size), capacity.size);
-    printf("[+] generating crc length: %lu\n", values);
+        // next offset requested by any capacity
+        for(size_t c = 0; c < count; c++)
+            if(cursor[c] < capacities[c].length && capacities[c].offsets[cursor[c]] < next)
+                next = capacities[c].offsets[cursor[c]];
+
+        if(next == UINT64_MAX)
+            break;
+
+        // stop on checkpoint boundary
+        if(interval && (position / interval + 1) * interval < next)
+            next = (position / interval + 1) * interval;
+
+        gettimeofday(&time_begin, NULL);
+
+        // a single chain is faster without lanes overhead
+        if(used == 1) {
+            for(size_t i = position; i < next; i++)
+                lanes[0] = crc64_u64(lanes[0]);
+
+        } else {
+            crc64_x8(lanes, next - position);
+        }
+
+        gettimeofday(&time_end, NULL);
+
+        size_t length = (next - position) * sizeof(uint64_t) * used;
+        size_t previous = position;
+        position = next;
+
+        for(size_t c = 0; c < count; c++) {
+            capacity_t *capacity = &capacities[c];
+
+            while(cursor[c] < capacity->length && capacity->offsets[cursor[c]] == position) {
+                capacity->results[cursor[c]] = lanes[lane[c]];
+                cursor[c] += 1;
+                computed += 1;
+            }
+        }
+
+        // smaller capacities keep being checkpointed until the end
+        // of the walk, which persists their last results as well. an
+        // offset at the starting position takes no step, that boundary
+        // is already checkpointed (by checkpoint_create or the
+        // interrupted run)
+        if(interval && position > previous && position % interval == 0) {
+            for(size_t c = 0; c < count; c++)
+                if(!checkpoint_append(capacities[c].checkpoint, capacities[c].results, lanes[lane[c]]))
+                    exit(EXIT_FAILURE);
+        }
+
+        if(!capacity_progress)
+            continue;
+
+        double timed = time_spent(&time_end) - time_spent(&time_begin);
+        double cspeed = speed(length, timed);
+        double progress = (computed / (double) total) * 100;
+
+        printf("\r[+] computing: %.2f %% [%.0f MB/s]\033[0K", progress, cspeed);
+        fflush(stdout);
+    }
+
+    return (position - begin) * sizeof(uint64_t) * used;
+}
+
+// seconds between two attempts to save reports
+#define CAPACITY_SAVE_RETRY  5
+
+// a report stays with the caller until zdb committed it
+static void capacity_saved(backend_t *backend, void *userdata, int success) {
+    (void) backend;
+
+    if(success)
+        printf("[+] capacity report saved\n");
+
+    *((int *) userdata) = success;
+}
+
+// generate, save and release a batch of capacities. a walked report
+// is never dropped: saves are retried until every report is committed
+void capacity_process(backend_t *backend, capacity_t *capacities, size_t count, size_t position) {
+    struct timeval time_begin, time_end;
+    char keynames[CAPACITY_MAX][128];
+    void *payloads[CAPACITY_MAX];
+    size_t lengths[CAPACITY_MAX];
+    int saved[CAPACITY_MAX];
 
-    // time statistics
-    struct timeval time_begin, time_end, time_total_begin;
     gettimeofday(&time_begin, NULL);
-    gettimeofday(&time_total_begin, NULL);
+    size_t walked = capacity_generate(capacities, count, position);
+    gettimeofday(&time_end, NULL);
 
-    // randomize
-    uint64_t time_seed = time64(&time_begin);
-    printf("[+] generated time seed: %lu\n", time_seed);
-    srand64(time_seed);
+    // grand total speed summary
+    double timed = time_spent(&time_end) - time_spent(&time_begin);
+    double cspeed = speed(walked, timed);
 
-    // generate seed
-    capacity.seed = rand64();
-    // capacity.seed = 0x0f6f8ca19f2c59c2; // FIXME
-    uint64_t seed = capacity.seed; // variable seed
-    printf("[+] generated storage seed: " COLOR_YELLOW "0x%016lx" COLOR_RESET "\n", seed);
+    printf("\r[+] data generated in %.1f seconds [%.2f MB/s]\033[0K\n", timed, cspeed);
 
-    // amount of datapoint to compute
-    // we request 256 datapoints per 100 GB
-    size_t size_range = (capacity.size / (20 * S_GB)) + 1;
+    for(size_t l = 0; l < count; l++) {
+        payloads[l] = capacity_serialize(&capacities[l], &lengths[l]);
+        saved[l] = 0;
 
-    capacity.length = 256 * size_range;
+        printf("[+] capacity result length: %lu bytes\n", lengths[l]);
+
+        sprintf(keynames[l], "storage-%lu-%016lx", capacities[l].size, capacities[l].seed);
+        capacity_free(&capacities[l]);
+    }
 
-    // segments to divide full length (to maximize unifority)
-    size_t offsets_segments = 32 * size_range;
+    backend->completed = capacity_saved;
 
-    // datapoint per segments
-    size_t offsets_segsize = capacity.length / offsets_segments;
+    for(size_t unsaved = count; unsaved; ) {
+        for(size_t l = 0; l < count; l++) {
+            void *payload;
 
-    // generate list of offsets
-    capacity.offsets = calloc(sizeof(uint64_t), capacity.length);
-    capacity.results = calloc(sizeof(uint64_t), capacity.length);
+            if(saved[l])
+                continue;
 
-    printf("[+] offsets to compute: %lu (%lu segments)\n", capacity.length, offsets_segments);
+            // the backend releases its own copy
+            if(!(payload = malloc(lengths[l]))) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
 
-    // compute 64 offsets for each quarter
-    // to maximize chance to have offset spread all over
-    // the disk, we randomize offsets for each 1/8 of
-    // the disk
-    //
-    // note: offsets are not bytes offsets but crc index
+            memcpy(payload, payloads[l], lengths[l]);
 
-    size_t index_from = 0;
-    size_t index_to = values / offsets_segments;
-    size_t segment = values / offsets_segments;
+            printf("[+] saving capacity report: %s\n", keynames[l]);
+            backend_push(backend, capacities[l].size, keynames[l], payload, lengths[l], &saved[l]);
+        }
 
-    for(size_t i = 0; i < offsets_segments; i++) {
-        offsets_generate(capacity.offsets + (i * offsets_segsize), offsets_segsize, index_from, index_to);
-        index_from = index_to;
-        index_to += segment;
+        backend_flush(backend);
+
+        unsaved = 0;
+
+        for(size_t l = 0; l < count; l++)
+            unsaved += !saved[l];
+
+        if(unsaved) {
+            fprintf(stderr, "[-] %lu reports not saved, retrying in %d seconds\n", unsaved, CAPACITY_SAVE_RETRY);
+            sleep(CAPACITY_SAVE_RETRY);
+        }
     }
 
-    size_t source = 0;
+    for(size_t l = 0; l < count; l++)
+        free(payloads[l]);
+}
 
-    printf(COLOR_GREEN "[+] starting generating sequence" COLOR_RESET "\n");
-    printf("[+] computing: initializing...");
-    fflush(stdout);
+// continue a killed generation from its checkpoint files, lanes
+// are restarted from the last checkpoint common to all of them
+int capacity_resume(backend_t *backend, char **files, size_t count) {
+    capacity_t capacities[CAPACITY_MAX];
+    size_t slot = SIZE_MAX;
 
-    for(size_t offset = 0; offset < capacity.length; offset++) {
-        gettimeofday(&time_begin, NULL);
+    for(size_t c = 0; c < count; c++) {
+        capacities[c] = (capacity_t) {0};
 
-        for(size_t i = source; i < capacity.offsets[offset]; i++)
-            seed = crcxx(seed);
+        if(!checkpoint_open(&capacities[c], files[c]))
+            return 1;
 
-        gettimeofday(&time_end, NULL);
+        checkpoint_t *checkpoint = capacities[c].checkpoint;
 
-        size_t length = (capacity.offsets[offset] - source) * sizeof(uint64_t);
-        double timed = time_spent(&time_end) - time_spent(&time_begin);
-        double cspeed = speed(length, timed);
-        double progress = (offset / (double) capacity.length) * 100;
+        if(checkpoint->interval != capacities[0].checkpoint->interval) {
+            fprintf(stderr, "[-] %s: interval differs from other reports\n", files[c]);
+            return 1;
+        }
 
-        printf("\r[+] computing: %.2f %% [%.0f MB/s]\033[0K", progress, cspeed);
-        fflush(stdout);
+        if(checkpoint->count < slot)
+            slot = checkpoint->count;
 
-        source = capacity.offsets[offset];
-        capacity.results[offset] = seed;
+        printf("[+] resuming storage seed: " COLOR_YELLOW "0x%016lx" COLOR_RESET " (%.0f GB, %lu checkpoints)\n",
+                capacities[c].seed, GB(capacities[c].size), checkpoint->count);
     }
 
-    // grand total speed summary
-    gettimeofday(&time_end, NULL);
-    double timed = time_spent(&time_end) - time_spent(&time_total_begin);
-    double cspeed = speed(capacity.size, timed);
+    for(size_t c = 0; c < count; c++)
+        if(capacities[c].checkpoint->count > slot)
+            if(!checkpoint_truncate(capacities[c].checkpoint, slot))
+                return 1;
 
-    printf("\r[+] data generated in %.1f seconds [%.2f MB/s]\n", timed, cspeed);
+    size_t position = (slot - 1) * capacities[0].checkpoint->interval;
 
-    char *json = capacity_dumps(&capacity);
+    printf("[+] resuming from index %lu\n", position);
 
-    // puts(json);
-    printf("[+] capacity result length: %lu bytes\n", strlen(json));
+    capacity_process(backend, capacities, count, position);
+    backend_close(backend);
 
-    char keyname[128];
-    sprintf(keyname, "storage-%lu-%016lx", capacity.size, capacity.seed);
+    return 0;
+}
 
-    printf("[+] saving capacity report: %s\n", keyname);
+int main(int argc, char *argv[]) {
+    int option_index = 0;
 
     backend_t backend = {
         .host = "127.0.0.1",
@@ -266,8 +451,221 @@ int main(int argc, char *argv[]) {
         .namespace = "storage-pool",
         .password = NULL,
     };
+    size_t sizes[CAPACITY_MAX_SIZES] = {1 << 30};
+    size_t sizecount = 1;
+    size_t reports = 1;
+    size_t interval = 0;
+    char *checkpoints = ".";
+    char *resumes[CAPACITY_MAX];
+    size_t resuming = 0;
+    char *derive = NULL;
+    char *targets = NULL;
+    size_t workers = 0;
+    size_t refresh = 30;
+
+    printf(COLOR_CYAN "[+] initializing storage-proof generator\n" COLOR_RESET);
+
+    while(1) {
+        int i = getopt_long_only(argc, argv, "", long_options, &option_index);
+
+        if(i == -1)
+            break;
+
+        switch(i) {
+            case 's':
+                if(!(sizecount = sizes_parse(optarg, sizes)))
+                    return 1;
+                break;
+
+            case 'r':
+                reports = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'c':
+                if(!human_readable_parse(optarg, &interval)) {
+                    fprintf(stderr, "[-] malformed checkpoint interval: %s\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'C':
+                checkpoints = optarg;
+                break;
+
+            case 'R':
+                if(resuming == CAPACITY_MAX) {
+                    fprintf(stderr, "[-] cannot resume more than %d reports at once\n", CAPACITY_MAX);
+                    return 1;
+                }
+
+                resumes[resuming++] = optarg;
+                break;
+
+            case 'D':
+                derive = optarg;
+                break;
+
+            case 'd':
+                targets = optarg;
+                break;
+
+            case 'w':
+                workers = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'f':
+                refresh = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'j':
+                capacity_json = 1;
+                break;
+
+            case 'o':
+                capacity_subsets = strtoul(optarg, NULL, 10);
+
+                if(capacity_subsets < 1 || capacity_subsets > OFFSETS_SUBSETS_MAX) {
+                    fprintf(stderr, "[-] oversample factor needs to be between 1 and %d\n", OFFSETS_SUBSETS_MAX);
+                    return 1;
+                }
+                break;
+
+            case 'H':
+                backend.host = optarg;
+                break;
+
+            case 'P':
+                backend.port = atoi(optarg);
+                break;
+
+            case 'N':
+                backend.namespace = optarg;
+                break;
+
+            case 'W':
+                backend.password = optarg;
+                break;
+
+            case 'h':
+                printf("usage: %s [--size SIZE[,SIZE...]] [--reports COUNT] [--checkpoint INTERVAL] [--checkpoint-dir DIR] [--json] [--oversample COUNT]\n", argv[0]);
+                printf("       %s --resume CHECKPOINT [--resume CHECKPOINT ...]\n", argv[0]);
+                printf("       %s --derive CHECKPOINT INDEX [INDEX ...]\n", argv[0]);
+                printf("       %s --daemon SIZE:DEPTH[,SIZE:DEPTH...] [--workers COUNT] [--refresh SECONDS]\n", argv[0]);
+                printf("zdb: [--host HOST] [--port PORT] [--namespace NAME] [--password SECRET]\n");
+                return 1;
+
+            case '?':
+            default:
+               exit(EXIT_FAILURE);
+        }
+    }
+
+    // json reports are keyed by offset, subsets can't be rebuilt from them
+    if(capacity_json && capacity_subsets > 1) {
+        fprintf(stderr, "[-] oversampled reports need the binary format\n");
+        return 1;
+    }
+
+    // expected values for new offsets, from an existing checkpoint
+    if(derive) {
+        capacity_t capacity = {0};
+
+        if(!checkpoint_open(&capacity, derive))
+            return 1;
+
+        printf("[+] checkpoint seed: " COLOR_YELLOW "0x%016lx" COLOR_RESET ", interval %lu, %lu values\n",
+                capacity.seed, capacity.checkpoint->interval, capacity.checkpoint->count);
+
+        for(int i = optind; i < argc; i++) {
+            uint64_t index = strtoull(argv[i], NULL, 10);
+            printf("%lu %016lx\n", index, checkpoint_derive(capacity.checkpoint, index));
+        }
+
+        capacity_free(&capacity);
+
+        return 0;
+    }
+
+    if(resuming)
+        return capacity_resume(&backend, resumes, resuming);
+
+    if(targets) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        srand64(time64(&now));
+
+        printf("[+] crc64 implementation: %s\n", crc64_impl->name);
+
+        return daemon_run(&backend, targets, workers, interval, checkpoints, refresh);
+    }
+
+    // legacy positional size argument
+    if(optind < argc) {
+        if(!(sizecount = sizes_parse(argv[optind], sizes)))
+            return 1;
+    }
+
+    for(size_t i = 0; i < sizecount; i++) {
+        if(sizes[i] < (1 << 30)) {
+            fprintf(stderr, "[-] please do not use size smaller than 1 GB\n");
+            return 1;
+        }
+    }
+
+    if(reports == 0) {
+        fprintf(stderr, "[-] at least one report is needed\n");
+        return 1;
+    }
+
+    for(size_t i = 0; i < sizecount; i++)
+        printf("[+] generating dataset size: " COLOR_GREEN "%.0f GB" COLOR_RESET " (%lu bytes)\n", GB(sizes[i]), sizes[i]);
+
+    printf("[+] generating crc length: %lu\n", sizes[sizecount - 1] / sizeof(uint64_t));
+    printf("[+] generating reports: %lu (%d lanes)\n", reports, CRC64_LANES);
+
+    if(capacity_subsets > 1)
+        printf("[+] oversampling: %lu challenges per report\n", capacity_subsets);
+    printf("[+] crc64 implementation: %s\n", crc64_impl->name);
+
+    if(interval)
+        printf("[+] checkpoint interval: %lu (%s)\n", interval, checkpoints);
+
+    // time statistics
+    struct timeval time_begin;
+    gettimeofday(&time_begin, NULL);
+
+    // randomize
+    uint64_t time_seed = time64(&time_begin);
+    printf("[+] generated time seed: %lu\n", time_seed);
+    srand64(time_seed);
+
+    for(size_t done = 0; done < reports; done += CRC64_LANES) {
+        capacity_t capacities[CAPACITY_MAX];
+        size_t lanes = reports - done < CRC64_LANES ? reports - done : CRC64_LANES;
+        size_t count = 0;
+
+        for(size_t l = 0; l < lanes; l++) {
+            // one seed per lane, one report per size on that lane
+            uint64_t seed = rand64();
+
+            printf("[+] generated storage seed: " COLOR_YELLOW "0x%016lx" COLOR_RESET "\n", seed);
+
+            for(size_t i = 0; i < sizecount; i++, count++) {
+                capacities[count] = (capacity_t) {.seed = seed, .size = sizes[i]};
+                capacity_prepare(&capacities[count]);
+
+                if(interval && !(capacities[count].checkpoint = checkpoint_create(&capacities[count], checkpoints, interval)))
+                    return 1;
+            }
+        }
+
+        printf("[+] offsets to compute: %lu reports\n", count);
+        printf(COLOR_GREEN "[+] starting generating sequence" COLOR_RESET "\n");
+
+        capacity_process(&backend, capacities, count, 0);
+    }
 
-    capacity_save(&backend, keyname, json);
+    backend_close(&backend);
 
     return 0;
 }
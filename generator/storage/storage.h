@@ -1,11 +1,110 @@
 #ifndef STORAGE_H
     #define STORAGE_H
 
-    uint64_t crc64(const uint8_t *data, size_t length);
+    // sizes produced from a single walk, per lane
+    #define CAPACITY_MAX_SIZES  8
+    #define CAPACITY_MAX        (CRC64_LANES * CAPACITY_MAX_SIZES)
+
+    typedef struct checkpoint_t {
+        int fd;
+        char *filename;
+        uint64_t interval;
+        uint64_t length;
+        uint64_t *values;
+        size_t count;
+
+    } checkpoint_t;
+
+    typedef struct capacity_t {
+        uint64_t seed;
+        uint64_t size;
+        uint64_t key;
+        size_t subsets;
+        uint64_t *offsets;
+        uint64_t *results;
+        size_t length;
+
+        checkpoint_t *checkpoint;
+
+    } capacity_t;
+
+    typedef struct backend_pending_t {
+        char *key;
+        void *payload;
+        size_t length;
+        void *userdata;
+        int notify;
+
+    } backend_pending_t;
+
+    // size class queue tail, see pool.h
+    typedef struct backend_class_t {
+        uint64_t size;
+        uint64_t tail;
+
+    } backend_class_t;
+
+    typedef struct backend_t {
+        char *host;
+        int port;
+        char *namespace;
+        char *password;
+
+        struct redisContext *kntxt;
+
+        // ring of commands sent, waiting for their reply
+        backend_pending_t *pending;
+        size_t window;
+        size_t head;
+        size_t inflight;
+
+        // size classes indexed by this backend
+        backend_class_t classes[CAPACITY_MAX_SIZES];
+        size_t classcount;
+
+        // pool writer id (see pool.h) and last check-in
+        char writer[48];
+        time_t joined;
+
+        void (*completed)(struct backend_t *backend, void *userdata, int success);
+        void *owner;
+
+    } backend_t;
+
+    extern int capacity_progress;
+    extern int capacity_json;
+    extern size_t capacity_subsets;
+
+    size_t *human_readable_parse(char *input, size_t *target);
+    size_t sizes_parse(char *input, size_t *sizes);
+
+    uint64_t capacity_key();
+    void capacity_prepare(capacity_t *capacity);
+    void capacity_free(capacity_t *capacity);
+    size_t capacity_generate(capacity_t *capacities, size_t count, size_t position);
+    char *capacity_dumps(capacity_t *capacity);
+    uint8_t *capacity_encode(capacity_t *capacity, size_t *length);
+    void *capacity_serialize(capacity_t *capacity, size_t *length);
+
+    int backend_connect(backend_t *backend);
+    void backend_disconnect(backend_t *backend);
+    int backend_set(backend_t *backend, char *key, void *payload, size_t length, void *userdata);
+    int backend_push(backend_t *backend, uint64_t size, char *key, void *payload, size_t length, void *userdata);
+    int backend_flush(backend_t *backend);
+    void backend_close(backend_t *backend);
+
+    int daemon_run(backend_t *backend, char *targets, size_t workers, size_t interval, char *checkpoints, size_t refresh);
 
     void srand64(uint64_t seed);
     uint64_t rand64();
 
+    checkpoint_t *checkpoint_create(capacity_t *capacity, char *dirname, uint64_t interval);
+    checkpoint_t *checkpoint_open(capacity_t *capacity, char *filename);
+    int checkpoint_truncate(checkpoint_t *checkpoint, size_t count);
+    int checkpoint_append(checkpoint_t *checkpoint, uint64_t *results, uint64_t value);
+    uint64_t checkpoint_derive(checkpoint_t *checkpoint, uint64_t index);
+    void checkpoint_free(checkpoint_t *checkpoint);
+
     #define MB(x)   (x / (1024 * 1024.0))
     #define GB(x)   (x / (1024 * 1024 * 1024.0))
 
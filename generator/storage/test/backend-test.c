@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <hiredis.h>
+#include "crc64.h"
+#include "storage.h"
+
+//
+// zdb backend test, against test/zdb.py
+//
+// the stand-in requires a password and drops the connection when its
+// 100th command arrives: with AUTH and SELECT first, that's a SET in
+// the middle of the first in-flight window. more sets than the window
+// holds are queued, so replies are read while sets are still being
+// pipelined. every key needs to be there afterwards, including the
+// dropped one, which only exists if pending commands were replayed
+//
+#define TEST_PASSWORD  "secret"
+#define TEST_KEYS      300   // several windows (BACKEND_WINDOW is 64)
+#define TEST_DROPPED   97    // key of the dropped command (after AUTH and SELECT)
+
+static int failures = 0;
+
+#define check(condition, ...) do { \
+    if(!(condition)) { \
+        fprintf(stderr, "[-] " __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+        failures += 1; \
+    } \
+} while(0)
+
+static void completed(backend_t *backend, void *userdata, int success) {
+    (void) backend;
+    *((int *) userdata) = success;
+}
+
+// read a key back on a connection of its own
+static char *fetch(backend_t *backend, const char *key) {
+    redisReply *reply;
+    char *value = NULL;
+
+    if(!(reply = redisCommand(backend->kntxt, "GET %s", key)))
+        return NULL;
+
+    if(reply->type == REDIS_REPLY_STRING)
+        value = strndup(reply->str, reply->len);
+
+    freeReplyObject(reply);
+
+    return value;
+}
+
+int main(int argc, char *argv[]) {
+    int saved[TEST_KEYS];
+    char key[64], expected[64];
+
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s PORT\n", argv[0]);
+        return 1;
+    }
+
+    backend_t backend = {
+        .host = "127.0.0.1",
+        .port = atoi(argv[1]),
+        .namespace = "backend-test",
+        .password = TEST_PASSWORD,
+        .completed = completed,
+    };
+
+    for(size_t i = 0; i < TEST_KEYS; i++) {
+        saved[i] = -1;
+
+        sprintf(key, "key-%lu", i);
+        sprintf(expected, "value-%lu", i);
+
+        check(backend_set(&backend, key, strdup(expected), strlen(expected), &saved[i]), "%s not queued", key);
+    }
+
+    check(backend_flush(&backend), "flush reported a failure");
+
+    for(size_t i = 0; i < TEST_KEYS; i++)
+        check(saved[i] == 1, "key-%lu completed with %d", i, saved[i]);
+
+    // wrong password, single attempt
+    backend_t denied = {.host = backend.host, .port = backend.port, .namespace = backend.namespace};
+    denied.password = "wrong";
+    check(!backend_connect(&denied), "connected with a wrong password");
+
+    // read back through a fresh connection
+    backend_t reader = denied;
+    reader.password = TEST_PASSWORD;
+
+    check(backend_connect(&reader), "could not connect with the right password");
+
+    for(size_t i = 0; reader.kntxt && i < TEST_KEYS; i++) {
+        sprintf(key, "key-%lu", i);
+        sprintf(expected, "value-%lu", i);
+
+        char *value = fetch(&reader, key);
+
+        check(value && strcmp(value, expected) == 0, "%s: %s, expected %s%s", key, value ? value : "missing", expected,
+                i == TEST_DROPPED ? " (dropped command, not replayed)" : "");
+
+        free(value);
+    }
+
+    backend_disconnect(&reader);
+    backend_close(&backend);
+
+    if(failures) {
+        fprintf(stderr, "[-] backend: %d failures\n", failures);
+        return 1;
+    }
+
+    printf("[+] backend: %d pipelined sets, replayed after a dropped connection\n", TEST_KEYS);
+
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "offsets.h"
+
+//
+// challenge offsets golden vectors test
+//
+// offsets_generate and offsets_subsets need to reproduce every vector
+// of common/offsets.vectors, the server sampler is checked against
+// the same file (server/test_offsets.py)
+//
+static int failures = 0;
+
+#define check(condition, ...) do { \
+    if(!(condition)) { \
+        fprintf(stderr, "[-] " __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+        failures += 1; \
+    } \
+} while(0)
+
+// skip '#' comment lines, then expect 'keyword'
+static int vectors_keyword(FILE *fp, const char *keyword) {
+    char word[16];
+    int c;
+
+    while((c = fgetc(fp)) == '#' || c == '\n')
+        if(c == '#')
+            while((c = fgetc(fp)) != '\n' && c != EOF);
+
+    if(c == EOF)
+        return 0;
+
+    ungetc(c, fp);
+
+    return fscanf(fp, "%15s", word) == 1 && strcmp(word, keyword) == 0;
+}
+
+static int vectors_check(FILE *fp, size_t *count) {
+    uint64_t key, size, value;
+    size_t length, subsets;
+    unsigned int id;
+
+    if(!vectors_keyword(fp, "vector"))
+        return 0;
+
+    if(fscanf(fp, "%lx %lu %lu %lu", &key, &size, &length, &subsets) != 4) {
+        fprintf(stderr, "[-] malformed vector\n");
+        failures += 1;
+        return 0;
+    }
+
+    uint64_t *offsets = calloc(sizeof(uint64_t), length);
+    uint16_t *ids = calloc(sizeof(uint16_t), length);
+    size_t mismatch = 0;
+
+    offsets_generate(offsets, key, size, length);
+    offsets_subsets(ids, key, size, length, subsets);
+
+    check(vectors_keyword(fp, "offsets"), "vector 0x%016lx: offsets expected", key);
+
+    for(size_t i = 0; i < length; i++)
+        if(fscanf(fp, "%lu", &value) != 1 || value != offsets[i])
+            mismatch += 1;
+
+    check(mismatch == 0, "vector 0x%016lx: %lu / %lu offsets differ", key, mismatch, length);
+    mismatch = 0;
+
+    check(vectors_keyword(fp, "subsets"), "vector 0x%016lx: subsets expected", key);
+
+    for(size_t i = 0; i < length; i++)
+        if(fscanf(fp, "%u", &id) != 1 || id != ids[i])
+            mismatch += 1;
+
+    check(mismatch == 0, "vector 0x%016lx: %lu / %lu subsets differ", key, mismatch, length);
+
+    free(offsets);
+    free(ids);
+
+    *count += 1;
+
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    size_t count = 0;
+    FILE *fp;
+
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s VECTORS\n", argv[0]);
+        return 1;
+    }
+
+    if(!(fp = fopen(argv[1], "r"))) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    while(vectors_check(fp, &count));
+
+    fclose(fp);
+
+    check(count > 0, "no vector found in %s", argv[1]);
+
+    if(failures) {
+        fprintf(stderr, "[-] offsets: %d failures\n", failures);
+        return 1;
+    }
+
+    printf("[+] offsets: %lu golden vectors reproduced\n", count);
+
+    return 0;
+}
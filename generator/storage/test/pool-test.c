@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <hiredis.h>
+#include "crc64.h"
+#include "storage.h"
+#include "pool.h"
+
+//
+// reports pool test, against test/zdb.py
+//
+// two writers push reports in the 2 GB and 4 GB classes, an empty
+// 16 GB class is registered too. pops need to return the best-fit
+// report of any writer, nothing when no class is large enough or the
+// only large enough class is empty, and writers leave the pool once
+// their queues are drained
+//
+#define GB2  (2 * S_GB)
+#define GB4  (4 * S_GB)
+#define GB10 (10 * S_GB)
+#define GB16 (16 * S_GB)
+
+static int failures = 0;
+
+#define check(condition, ...) do { \
+    if(!(condition)) { \
+        fprintf(stderr, "[-] " __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+        failures += 1; \
+    } \
+} while(0)
+
+static void push(backend_t *backend, uint64_t size, const char *name) {
+    char key[64];
+
+    sprintf(key, "storage-%lu-%s", size, name);
+    check(backend_push(backend, size, key, strdup(name), strlen(name), NULL), "%s not pushed", key);
+}
+
+// pop and check which report (payload) came out, NULL if none expected
+static void pop(redisContext *kntxt, uint64_t size, uint64_t expsize, const char *expected) {
+    pool_report_t report;
+    int popped = pool_pop(kntxt, size, &report);
+
+    if(!expected) {
+        check(!popped, "pop %lu: got %s, expected nothing", size, popped ? report.key : "");
+
+    } else {
+        check(popped, "pop %lu: nothing, expected %s", size, expected);
+        check(!popped || report.size == expsize, "pop %lu: class %lu, expected %lu", size, report.size, expsize);
+        check(!popped || (report.length == strlen(expected) && memcmp(report.payload, expected, report.length) == 0),
+                "pop %lu: wrong report %s", size, report.key);
+    }
+
+    pool_report_free(&report);
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t depth, tail;
+
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s PORT\n", argv[0]);
+        return 1;
+    }
+
+    backend_t first = {
+        .host = "127.0.0.1",
+        .port = atoi(argv[1]),
+        .namespace = "pool-test",
+        .writer = "first",
+    };
+
+    backend_t second = first;
+    strcpy(second.writer, "second");
+
+    push(&first, GB4, "a");
+    push(&second, GB2, "b");
+    push(&first, GB2, "c");
+    push(&second, GB4, "d");
+
+    check(backend_flush(&first) && backend_flush(&second), "reports not saved");
+
+    redisContext *kntxt = first.kntxt;
+
+    // empty class, registered without any report
+    check(pool_register(kntxt, GB16, "first", &tail) && tail == 0, "could not register an empty class");
+
+    char writers[POOL_WRITERS_MAX][POOL_WRITER_MAX];
+    check(pool_writers(kntxt, writers, POOL_WRITERS_MAX) == 2, "both writers need to be listed");
+
+    check(pool_depth(kntxt, GB2, &depth) && depth == 2, "2 GB class depth: %lu, expected 2", depth);
+    check(pool_depth(kntxt, GB16, &depth) && depth == 0, "16 GB class depth: %lu, expected 0", depth);
+
+    // only the empty class is large enough
+    pop(kntxt, GB10, 0, NULL);
+
+    // best fit: smallest class first, every writer of it
+    pop(kntxt, S_GB, GB2, "c");
+    pop(kntxt, S_GB, GB2, "b");
+    pop(kntxt, S_GB, GB4, "a");
+    pop(kntxt, GB4, GB4, "d");
+    pop(kntxt, S_GB, 0, NULL);
+
+    // queues drained, writers leave on close
+    backend_close(&first);
+    backend_close(&second);
+
+    backend_t reader = {.host = first.host, .port = first.port, .namespace = first.namespace};
+    check(backend_connect(&reader), "could not connect");
+    check(pool_writers(reader.kntxt, writers, POOL_WRITERS_MAX) == 0, "drained writers still listed");
+    backend_disconnect(&reader);
+
+    if(failures) {
+        fprintf(stderr, "[-] pool: %d failures\n", failures);
+        return 1;
+    }
+
+    printf("[+] pool: best-fit pops over two writers, empty class skipped\n");
+
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "report.h"
+#include "offsets.h"
+
+//
+// binary report round-trip test
+//
+// explicit and derived reports are encoded, decoded and iterated back
+// to the same (offset, result) pairs. truncated reports and counts
+// crafted to wrap around once multiplied need to be rejected, either
+// by report_decode or by the iterator stopping early
+//
+#define TEST_COUNT  300
+
+static int failures = 0;
+
+#define check(condition, ...) do { \
+    if(!(condition)) { \
+        fprintf(stderr, "[-] " __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+        failures += 1; \
+    } \
+} while(0)
+
+static void le64_patch(uint8_t *dst, uint64_t value) {
+    for(int i = 0; i < 8; i++)
+        dst[i] = value >> (i * 8);
+}
+
+// amount of pairs matching 'offsets' and 'results' until the iterator stops
+static size_t iterate(const report_t *report, const uint64_t *offsets, const uint64_t *results) {
+    report_iter_t iter;
+    uint64_t offset, result;
+    size_t matched = 0;
+
+    report_iter_init(report, &iter);
+
+    while(report_iter_next(report, &iter, &offset, &result)) {
+        if(offset != offsets[matched] || result != results[matched])
+            break;
+
+        matched += 1;
+    }
+
+    return matched;
+}
+
+static void test_explicit(uint64_t *offsets, uint64_t *results, uint8_t *buffer) {
+    report_t header = {.seed = 0x1122334455667788, .size = 1UL << 40, .count = TEST_COUNT, .key = 0x99, .subsets = 4};
+    report_t report;
+
+    // small and large gaps, varints from 1 to 8 bytes
+    for(size_t i = 0; i < TEST_COUNT; i++)
+        offsets[i] = (i ? offsets[i - 1] : 0) + ((i % 3 == 0) ? i : (1UL << (i % 50)));
+
+    size_t length = report_encode(buffer, &header, offsets, results);
+
+    check(length > REPORT_HEADER, "explicit: not encoded");
+    check(report_decode(&report, buffer, length), "explicit: not decoded");
+    check(report.seed == header.seed && report.size == header.size && report.key == header.key, "explicit: header mismatch");
+    check(report.count == TEST_COUNT && report.subsets == 4 && !(report.flags & REPORT_DERIVED), "explicit: header mismatch");
+    check(iterate(&report, offsets, results) == TEST_COUNT, "explicit: pairs mismatch");
+
+    // last varint cut: decoded, but iteration stops before the end
+    if(report_decode(&report, buffer, length - 1))
+        check(iterate(&report, offsets, results) < TEST_COUNT, "explicit: truncated offsets iterated");
+
+    check(!report_decode(&report, buffer, REPORT_HEADER - 1), "explicit: truncated header accepted");
+
+    // each offset takes at least one byte after its result
+    le64_patch(buffer + 24, (length - REPORT_HEADER) / (sizeof(uint64_t) + 1) + 1);
+    check(!report_decode(&report, buffer, length), "explicit: count larger than the report accepted");
+
+    le64_patch(buffer + 24, UINT64_MAX);
+    check(!report_decode(&report, buffer, length), "explicit: overflowing count accepted");
+
+    // unsorted offsets can't be delta encoded
+    offsets[10] = 0;
+    check(report_encode(buffer, &header, offsets, results) == 0, "explicit: unsorted offsets encoded");
+}
+
+static void test_derived(uint64_t *offsets, uint64_t *results, uint8_t *buffer) {
+    report_t header = {.seed = 0x0123456789abcdef, .size = 16UL << 30, .count = TEST_COUNT, .key = 0xfedcba9876543210};
+    report_t report;
+
+    offsets_generate(offsets, header.key, header.size, header.count);
+
+    size_t length = report_encode(buffer, &header, NULL, results);
+
+    check(length == REPORT_HEADER + (TEST_COUNT * sizeof(uint64_t)), "derived: unexpected length %lu", length);
+    check(report_decode(&report, buffer, length), "derived: not decoded");
+    check((report.flags & REPORT_DERIVED) && report.key == header.key && report.subsets == 1, "derived: header mismatch");
+    check(iterate(&report, offsets, results) == TEST_COUNT, "derived: pairs mismatch");
+
+    check(!report_decode(&report, buffer, length - 1), "derived: truncated results accepted");
+
+    // 2^61 + count, times 8, wraps around to the real results length
+    le64_patch(buffer + 24, (1UL << 61) + TEST_COUNT);
+    check(!report_decode(&report, buffer, length), "derived: wrapping count accepted");
+
+    // version 1 derived offsets came from the seed
+    le64_patch(buffer + 24, TEST_COUNT);
+    buffer[4] = 1;
+    check(!report_decode(&report, buffer, length - (REPORT_HEADER - REPORT_HEADER_V1)), "derived: version 1 accepted");
+}
+
+int main(void) {
+    uint64_t *offsets = malloc(TEST_COUNT * sizeof(uint64_t));
+    uint64_t *results = malloc(TEST_COUNT * sizeof(uint64_t));
+    uint8_t *buffer = malloc(report_encoded_max(TEST_COUNT));
+
+    for(size_t i = 0; i < TEST_COUNT; i++)
+        results[i] = 0x5eed000000000000 | i;
+
+    test_explicit(offsets, results, buffer);
+    test_derived(offsets, results, buffer);
+
+    free(offsets);
+    free(results);
+    free(buffer);
+
+    if(failures) {
+        fprintf(stderr, "[-] report: %d failures\n", failures);
+        return 1;
+    }
+
+    printf("[+] report: explicit and derived round-trips, malformed reports rejected\n");
+
+    return 0;
+}
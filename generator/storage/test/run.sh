@@ -0,0 +1,65 @@
+#!/bin/sh
+#
+# generator tests
+#
+# each test binary gets a fresh zdb stand-in (see zdb.py), its port
+# as only argument
+#
+# usage: test/run.sh
+#
+set -e
+
+TESTDIR=$(dirname "$0")
+WORKDIR=$(mktemp -d)
+ZDB=
+
+cleanup() {
+    [ -n "$ZDB" ] && kill $ZDB 2>/dev/null
+    rm -rf "$WORKDIR"
+}
+
+trap cleanup EXIT
+
+# start a stand-in, sets PORT
+zdb_start() {
+    python3 "$TESTDIR/zdb.py" "$@" > "$WORKDIR/port" &
+    ZDB=$!
+
+    for i in $(seq 50); do
+        [ -s "$WORKDIR/port" ] && break
+        sleep 0.1
+    done
+
+    PORT=$(cat "$WORKDIR/port")
+}
+
+zdb_stop() {
+    kill $ZDB
+    wait $ZDB 2>/dev/null || true
+    ZDB=
+}
+
+# run 'test' against a stand-in started with the remaining arguments
+zdb_test() {
+    test=$1
+    shift
+
+    zdb_start "$@"
+    echo "[+] $test"
+    "$TESTDIR/$test" "$PORT"
+    zdb_stop
+}
+
+# tests without any backend
+echo "[+] report-test"
+"$TESTDIR/report-test"
+
+echo "[+] offsets-test"
+"$TESTDIR/offsets-test" "$TESTDIR/../../../common/offsets.vectors"
+
+# password and dropped command are the ones backend-test.c expects
+zdb_test backend-test --password secret --drop-after 100
+
+zdb_test pool-test
+
+echo "[+] all tests passed"
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+#
+# zdb stand-in
+#
+# minimal RESP server behaving like 0-db for the commands the generator
+# uses (AUTH, SELECT, GET, SET, DEL, PING), one key space per namespace.
+# it prints the port it listens on, then serves until killed
+#
+#   --port N          port to listen on, 0 picks a free one
+#   --password PASS   require AUTH before anything else
+#   --drop-after N    close the first connection when its N-th command
+#                     arrives (the command is not executed), to test
+#                     reconnection and replay
+#
+import argparse
+import socketserver
+import threading
+
+parser = argparse.ArgumentParser()
+parser.add_argument("--port", type=int, default=0)
+parser.add_argument("--password")
+parser.add_argument("--drop-after", type=int, default=0)
+options = parser.parse_args()
+
+namespaces = {}
+lock = threading.Lock()
+commands = {"count": 0, "drop": options.drop_after}
+
+def bulk(value):
+    if value is None:
+        return b"$-1\r\n"
+
+    return b"$%d\r\n%s\r\n" % (len(value), value)
+
+class Handler(socketserver.StreamRequestHandler):
+    def command(self):
+        line = self.rfile.readline()
+        if not line.startswith(b"*"):
+            return None
+
+        args = []
+
+        for _ in range(int(line[1:])):
+            length = int(self.rfile.readline()[1:])
+            args.append(self.rfile.read(length))
+            self.rfile.readline()
+
+        return args
+
+    def handle(self):
+        namespace = "default"
+        authenticated = options.password is None
+
+        while True:
+            args = self.command()
+            if not args:
+                return
+
+            name = args[0].decode().upper()
+
+            with lock:
+                commands["count"] += 1
+
+                if commands["drop"] and commands["count"] == commands["drop"]:
+                    commands["drop"] = 0
+                    return
+
+                db = namespaces.setdefault(namespace, {})
+
+                if name == "AUTH":
+                    authenticated = args[1].decode() == options.password
+                    reply = b"+OK\r\n" if authenticated else b"-Access denied\r\n"
+
+                elif not authenticated:
+                    reply = b"-Authentication required\r\n"
+
+                elif name == "SELECT":
+                    namespace = args[1].decode()
+                    reply = b"+OK\r\n"
+
+                elif name == "PING":
+                    reply = b"+PONG\r\n"
+
+                elif name == "SET":
+                    db[args[1]] = args[2]
+                    reply = bulk(args[1])
+
+                elif name == "GET":
+                    reply = bulk(db.get(args[1]))
+
+                elif name == "DEL":
+                    reply = b"+OK\r\n" if db.pop(args[1], None) is not None else b"-Key not found\r\n"
+
+                else:
+                    reply = b"-Unknown command\r\n"
+
+            self.wfile.write(reply)
+
+class Server(socketserver.ThreadingTCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+server = Server(("127.0.0.1", options.port), Handler)
+print(server.server_address[1], flush=True)
+server.serve_forever()
@@ -1,43 +1,381 @@
 import sqlite3
+import struct
+import time
 import redis
 import json
 from flask import Flask, request, abort, make_response, jsonify
+from werkzeug.serving import WSGIRequestHandler
 from config import config
+from offsets import offsets_generate, offsets_subsets
 
 app = Flask(__name__, static_url_path='/static')
 
-db = redis.Redis(host=config['zdb-host'], port=config['zdb-port'])
-print(db.info())
+# keep-alive, agents reuse their connection
+WSGIRequestHandler.protocol_version = "HTTP/1.1"
+
+class NamespaceConnection(redis.Connection):
+    """
+    zdb namespace is a connection state, each pooled connection
+    selects its namespace as soon as it's (re)connected
+    """
+    def __init__(self, namespace, **kwargs):
+        super().__init__(**kwargs)
+        self.namespace = namespace
+
+    def on_connect(self):
+        super().on_connect()
+        self.send_command("SELECT", self.namespace)
+        self.read_response()
+
+def namespace(name):
+    """
+    Client bound to one namespace, safe to share between threads
+    """
+    pool = redis.ConnectionPool(connection_class=NamespaceConnection, namespace=name,
+                                host=config['zdb-host'], port=config['zdb-port'])
+
+    return redis.Redis(connection_pool=pool)
+
+# reports pool (generators) and challenges issued to nodes
+pooldb = namespace("storage-pool")
+requestdb = namespace("storage-pool-request")
+print(pooldb.info())
+
+REPORT_DERIVED = 0x01
+
+def report_header(raw):
+    """
+    Binary report header as a dict, None for legacy json
+    """
+    if raw[:4] != b"CAPR":
+        return None
+
+    version = raw[4]
+    flags = raw[5]
+    if version not in (1, 2) or flags & ~REPORT_DERIVED:
+        raise ValueError(f"unsupported report version {version} (flags {flags})")
+
+    # version 1 derived offsets from the seed, which the node receives
+    # to build its disk: it could compute the challenge without the data
+    if version == 1 and flags & REPORT_DERIVED:
+        raise ValueError("version 1 derived report, offsets are predictable")
+
+    seed, size, count = struct.unpack_from("<QQQ", raw, 8)
+    header = {"flags": flags, "seed": seed, "size": size, "count": count,
+              "key": seed, "subsets": 1, "length": 32}
+
+    if version >= 2:
+        header["subsets"] = struct.unpack_from("<H", raw, 6)[0]
+        header["key"] = struct.unpack_from("<Q", raw, 32)[0]
+        header["length"] = 40
+
+    return header
+
+def report_offsets(raw, cursor, count):
+    offsets = []
+    offset = 0
+
+    for _ in range(count):
+        delta = 0
+        shift = 0
+
+        while True:
+            byte = raw[cursor]
+            cursor += 1
+            delta |= (byte & 0x7f) << shift
+            shift += 7
+
+            if not byte & 0x80:
+                break
+
+        offset += delta
+        offsets.append(offset)
+
+    return offsets
+
+def report_load(raw, subset=None):
+    """
+    Decode a capacity report, binary (see common/report.h) or legacy json,
+    into the legacy dict layout: {"seed", "size", "results": {offset: hex}},
+    limited to one challenge of an oversampled report when subset is set
+    """
+    header = report_header(raw)
+    if header is None:
+        return json.loads(raw.decode("utf-8"))
+
+    count = header["count"]
+    results = struct.unpack_from(f"<{count}Q", raw, header["length"])
+
+    if header["flags"] & REPORT_DERIVED:
+        offsets = offsets_generate(header["key"], header["size"], count)
+
+    else:
+        offsets = report_offsets(raw, header["length"] + (count * 8), count)
+
+    pairs = zip(offsets, results)
+
+    if subset is not None and header["subsets"] > 1:
+        ids = offsets_subsets(header["key"], header["size"], count, header["subsets"])
+        pairs = [pair for pair, id in zip(pairs, ids) if id == subset]
+
+    return {
+        "seed": f"{header['seed']:016x}",
+        "size": header["size"],
+        "results": {str(o): f"{r:016x}" for o, r in pairs},
+    }
+
+CHALLENGE_MIME = "application/x-capacity-challenge"
+CHALLENGE_DERIVED = 0x01
+RESPONSE_MIME = "application/x-capacity-response"
+RESPONSE_LATENCIES = 0x01
+
+def varint(value):
+    encoded = bytearray()
+
+    while value >= 0x80:
+        encoded.append((value & 0x7f) | 0x80)
+        value >>= 7
+
+    encoded.append(value)
+    return bytes(encoded)
+
+def challenge_encode(offsets=None, derived=None):
+    """
+    Binary challenge, see client/storage-check/storage.h: derived is a
+    (key, size, count) tuple, offsets must be sorted otherwise
+    """
+    if derived is not None:
+        key, size, count = derived
+        return b"CAPC" + struct.pack("<BBHQQQ", 1, CHALLENGE_DERIVED, 0, count, key, size)
+
+    encoded = [b"CAPC", struct.pack("<BBHQQQ", 1, 0, 0, len(offsets), 0, 0)]
+    previous = 0
+
+    for offset in offsets:
+        encoded.append(varint(offset - previous))
+        previous = offset
+
+    return b"".join(encoded)
+
+def challenge_binary():
+    """
+    Binary challenges are only sent to clients asking for them
+    """
+    return CHALLENGE_MIME in request.headers.get("Accept", "")
+
+def challenge_response(encoded):
+    response = make_response(encoded)
+    response.headers["Content-Type"] = CHALLENGE_MIME
+    return response
+
+def challenge_order(raw, subset):
+    """
+    Offsets of a challenge, in the order a binary challenge sends them
+    (and a binary response answers them)
+    """
+    header = report_header(raw)
+
+    if header is not None and header["subsets"] == 1 and header["flags"] & REPORT_DERIVED:
+        return offsets_generate(header["key"], header["size"], header["count"])
+
+    return sorted(int(offset) for offset in report_load(raw, subset)["results"])
+
+def response_decode(raw, offsets):
+    """
+    Binary response into the json layout: {offset: hex value, "timing": ...,
+    "consistency": ...}, values come in the challenge order
+    """
+    if raw[:4] != b"CAPV" or raw[4] != 1:
+        raise ValueError("unsupported response")
+
+    flags = raw[5]
+    count = struct.unpack_from("<Q", raw, 8)[0]
+
+    if count != len(offsets):
+        raise ValueError(f"response holds {count} values, {len(offsets)} expected")
+
+    values = struct.unpack_from(f"<{count}Q", raw, 16)
+    cursor = 16 + (count * 8)
+
+    # per datapoint latencies are not kept
+    if flags & RESPONSE_LATENCIES:
+        cursor += count * 4
+
+    response = json.loads(raw[cursor:].decode("utf-8")) if cursor < len(raw) else {}
+    response.update({str(o): f"{v:016x}" for o, v in zip(offsets, values)})
+
+    return response
+
+def challenge_assign(nodeid, target, payload):
+    """
+    Attach a report to a disk, its challenges start from the first one
+    """
+    requestdb.execute_command("SET", f"node-{nodeid}-disk-{target}", payload)
+    requestdb.execute_command("SET", f"node-{nodeid}-disk-{target}-pending", "1")
+
+    for suffix in ("subset", "subset-open"):
+        try:
+            requestdb.execute_command("DEL", f"node-{nodeid}-disk-{target}-{suffix}")
+        except Exception:
+            pass
+
+def challenge_done(nodeid, target):
+    try:
+        requestdb.execute_command("DEL", f"node-{nodeid}-disk-{target}-pending")
+    except Exception:
+        pass
+
+def challenge_subset(nodeid, target):
+    """
+    Challenge currently issued from the report of a disk
+    """
+    current = requestdb.get(f"node-{nodeid}-disk-{target}-subset")
+    return int(current) if current is not None else None
+
+def challenge_open(nodeid, target):
+    """
+    Issued challenge still waiting for its response, it is served
+    again (not the next one) until a response consumed it
+    """
+    return requestdb.get(f"node-{nodeid}-disk-{target}-subset-open") is not None
+
+def challenge_consumed(nodeid, target):
+    try:
+        requestdb.execute_command("DEL", f"node-{nodeid}-disk-{target}-subset-open")
+    except Exception:
+        pass
 
 @app.route('/proof/verify/<nodeid>/<target>', methods=['POST'])
 def proof_verify(nodeid, target):
     print(f"Verifying node {nodeid} target {target}")
-    db.execute_command("SELECT storage-pool-request")
 
-    challenge = db.get(f"node-{nodeid}-disk-{target}")
-    payload = json.loads(challenge.decode("utf-8"))
+    challenge = requestdb.get(f"node-{nodeid}-disk-{target}")
+    header = report_header(challenge)
+    subset = challenge_subset(nodeid, target)
+
+    # each challenge of an oversampled report is verified once
+    if header is not None and header["subsets"] > 1 and not challenge_open(nodeid, target):
+        return make_response("No challenge waiting for a response, request one first\n", 409)
+
+    payload = report_load(challenge, subset)
     length = len(payload["results"])
-    verify = request.json
+
+    if request.content_type == RESPONSE_MIME:
+        try:
+            verify = response_decode(request.get_data(), challenge_order(challenge, subset))
+
+        except (ValueError, struct.error) as error:
+            return make_response(f"Malformed response: {error}\n", 400)
+
+    else:
+        verify = request.json
 
     print("Comparing client response with internal data")
 
     valid = 0
 
     for entry in payload["results"]:
-        if payload["results"][entry] == verify[entry]:
+        if payload["results"][entry] == verify.get(entry):
             valid += 1
 
     print(f"Confirmed values: {valid} / {length}")
 
-    return jsonify({"valid": valid, "length": length})
+    # read latency evidence, datapoints details are not kept
+    timing = verify.get("timing")
+    profile = None
+
+    if isinstance(timing, dict):
+        profile = timing.get("profile")
+        summary = {k: v for k, v in timing.items() if k != "datapoints"}
+        print(f"Read latency: p50 {summary.get('p50')} us, p99 {summary.get('p99')} us, profile {profile}")
+        requestdb.set(f"node-{nodeid}-disk-{target}-timing", json.dumps(summary))
+
+    # local chain of the blocks around datapoints, checked client side
+    consistency = verify.get("consistency")
+    inconsistent = None
+
+    if isinstance(consistency, dict):
+        inconsistent = len(consistency.get("inconsistent", []))
+        print(f"Local chain: {inconsistent} inconsistent / {consistency.get('blocks')} blocks")
+        requestdb.set(f"node-{nodeid}-disk-{target}-consistency", json.dumps(consistency))
+
+    challenge_consumed(nodeid, target)
+    challenge_done(nodeid, target)
+
+    return jsonify({"valid": valid, "length": length, "profile": profile, "inconsistent": inconsistent})
+
+PENDING_WAIT_MAX = 60
+
+@app.route('/proof/pending/<nodeid>')
+def proof_pending(nodeid):
+    """
+    Targets (of the comma separated 'targets') with a challenge waiting,
+    the request is held up to 'wait' seconds until there is one
+    """
+    targets = [x for x in request.args.get("targets", "").split(",") if x]
+    until = time.time() + min(int(request.args.get("wait", 0)), PENDING_WAIT_MAX)
+
+    while True:
+        pending = [x for x in targets if requestdb.get(f"node-{nodeid}-disk-{x}-pending") is not None]
+
+        if pending or time.time() >= until:
+            return jsonify(pending)
+
+        time.sleep(0.5)
 
 @app.route('/proof/challenge/<nodeid>/<target>')
 def proof_challenge(nodeid, target):
     print(f"Challenging node {nodeid} target {target}")
-    db.execute_command("SELECT storage-pool-request")
 
-    request = db.get(f"node-{nodeid}-disk-{target}")
-    payload = json.loads(request.decode("utf-8"))
+    request = requestdb.get(f"node-{nodeid}-disk-{target}")
+
+    try:
+        header = report_header(request)
+
+    except (ValueError, IndexError, struct.error) as error:
+        challenge_done(nodeid, target)
+        return make_response(f"Report can't be used ({error}), request a new one\n", 410)
+
+    # oversampled report: each challenge uses the next subset, offsets
+    # are sent explicitly since the key would reveal every subset. the
+    # subset only advances once the previous one was answered, a client
+    # asking again (retry, lost reply) gets the same challenge
+    if header is not None and header["subsets"] > 1:
+        current = challenge_subset(nodeid, target)
+
+        if current is not None and challenge_open(nodeid, target):
+            subset = current
+
+        else:
+            subset = 0 if current is None else current + 1
+
+            if subset >= header["subsets"]:
+                challenge_done(nodeid, target)
+                return make_response("Every challenge of this report was used, request a new one\n", 410)
+
+            requestdb.set(f"node-{nodeid}-disk-{target}-subset", subset)
+            requestdb.set(f"node-{nodeid}-disk-{target}-subset-open", "1")
+
+        print(f"Using challenge {subset + 1} / {header['subsets']}")
+
+        payload = report_load(request, subset)
+
+        if challenge_binary():
+            return challenge_response(challenge_encode(sorted(int(x) for x in payload["results"])))
+
+        return jsonify(list(payload["results"].keys()))
+
+    # derived offsets: client regenerates them from the key
+    if header is not None and header["flags"] & REPORT_DERIVED:
+        if challenge_binary():
+            return challenge_response(challenge_encode(derived=(header["key"], header["size"], header["count"])))
+
+        return jsonify({"key": f"{header['key']:016x}", "size": header["size"], "count": header["count"]})
+
+    payload = report_load(request)
+
+    if challenge_binary():
+        return challenge_response(challenge_encode(sorted(int(x) for x in payload["results"])))
 
     offsets = list(payload["results"].keys())
     return jsonify(offsets)
@@ -54,14 +392,167 @@ def picksize(scan, size):
 
     return None, None
 
+POOL_CLAIM_ATTEMPTS = 8
+
+def pool_claim(pool, key):
+    """
+    Fetch and delete a report, the delete decides who owns it
+    when requests race on the same entry
+    """
+    pipe = pool.pipeline(transaction=False)
+    pipe.get(key)
+    pipe.delete(key)
+    payload, deleted = pipe.execute(raise_on_error=False)
+
+    if payload is None or isinstance(deleted, Exception) or deleted == 0:
+        return None
+
+    return payload
+
+POOL_WRITER_STALE = 3600
+POOL_PRUNE_INTERVAL = 600
+pool_pruned = 0
+
+def pool_list(pool, key):
+    value = pool.get(key)
+    if not value:
+        return []
+
+    return [x for x in value.decode("utf-8").split(",") if x]
+
+def pool_counters(pool, size, writer):
+    pipe = pool.pipeline(transaction=False)
+    pipe.get(f"pool-{size}-{writer}-head")
+    pipe.get(f"pool-{size}-{writer}-tail")
+
+    return [int(x or 0) for x in pipe.execute()]
+
+def pool_pop_queue(pool, size, writer):
+    """
+    Pop a report from the queue of one writer, returns (key, payload)
+    """
+    head, tail = pool_counters(pool, size, writer)
+
+    while head < tail:
+        until = min(head + POOL_CLAIM_ATTEMPTS, tail)
+        key, payload = None, None
+
+        while head < until and payload is None:
+            entry = f"pool-{size}-{writer}-{head}"
+            head += 1
+
+            key = pool.get(entry)
+            if key is None:
+                continue
+
+            key = key.decode("utf-8")
+            payload = pool_claim(pool, key)
+
+            if payload is not None and not pool_usable(key, payload):
+                payload = None
+
+            try:
+                pool.delete(entry)
+            except Exception:
+                pass
+
+        pool.set(f"pool-{size}-{writer}-head", head)
+
+        if payload is not None:
+            return key, payload
+
+        # other requests may be ahead
+        head, tail = pool_counters(pool, size, writer)
+        head = max(head, until)
+
+    return None, None
+
+def pool_prune(pool, sizes, writers):
+    """
+    Forget writers not checked in for POOL_WRITER_STALE seconds
+    whose queues are drained (a generator killed with reports left)
+    """
+    now = time.time()
+    stale = []
+
+    for writer in writers:
+        seen = int(pool.get(f"pool-writer-{writer}") or 0)
+
+        if seen + POOL_WRITER_STALE > now:
+            continue
+
+        if all(head >= tail for head, tail in (pool_counters(pool, size, writer) for size in sizes)):
+            stale.append(writer)
+
+    if not stale:
+        return
+
+    listed = pool_list(pool, "pool-writers")
+    pool.set("pool-writers", ",".join(x for x in listed if x not in stale))
+
+    for writer in stale:
+        print(f"Pruning pool writer {writer}")
+
+        for key in [f"pool-writer-{writer}"] + [f"pool-{size}-{writer}-{x}" for size in sizes for x in ("head", "tail")]:
+            try:
+                pool.delete(key)
+            except Exception:
+                pass
+
+def pool_pop(pool, size):
+    """
+    Pop a report from the smallest size class able to hold size,
+    from any writer queue, see generator/storage/pool.h, returns
+    (key, payload)
+    """
+    global pool_pruned
+
+    sizes = sorted(int(x) for x in pool_list(pool, "pool-classes"))
+    writers = pool_list(pool, "pool-writers")
+
+    if time.time() > pool_pruned + POOL_PRUNE_INTERVAL:
+        pool_pruned = time.time()
+        pool_prune(pool, sizes, writers)
+
+    for entrysize in sizes:
+        if entrysize < size:
+            continue
+
+        for writer in writers:
+            key, payload = pool_pop_queue(pool, entrysize, writer)
+
+            if payload is not None:
+                print(f"Requested size {size} fits in {entrysize} (writer {writer})")
+                return key, payload
+
+    return None, None
+
+def pool_usable(key, payload):
+    """
+    Reports a challenge can be built from, others are dropped
+    """
+    try:
+        report_header(payload)
+
+    except (ValueError, IndexError, struct.error) as error:
+        print(f"Dropping report {key}: {error}")
+        return False
+
+    return True
+
 @app.route('/proof/request/<nodeid>/<target>/<size>')
 def proof_request(nodeid, target, size):
     print("Looking into the pool for size %s" % size)
 
     size = int(size)
 
-    db.execute_command("SELECT storage-pool")
-    scan = db.execute_command("SCANX")
+    key, payload = pool_pop(pooldb, size)
+    if key is not None:
+        challenge_assign(nodeid, target, payload)
+        return jsonify({"seed": f"0x{key.split('-')[2]}"})
+
+    # pool not indexed (older generator), linear scan
+    scan = pooldb.execute_command("SCANX")
 
     while True:
         skey, key = picksize(scan[1], size)
@@ -69,7 +560,7 @@ def proof_request(nodeid, target, size):
             break
 
         try:
-            scan = db.execute_command("SCANX", scan[0])
+            scan = pooldb.execute_command("SCANX", scan[0])
 
         except Exception:
             return "Pool unavailable, please try again later\n"
@@ -77,14 +568,13 @@ def proof_request(nodeid, target, size):
     print(key)
     seed = skey[2]
 
-    payload = db.get(key)
+    payload = pooldb.get(key)
     try:
-        db.execute_command("DEL", key)
+        pooldb.execute_command("DEL", key)
     except Exception:
         pass
 
-    db.execute_command("SELECT storage-pool-request")
-    db.execute_command("SET", f"node-{nodeid}-disk-{target}", payload)
+    challenge_assign(nodeid, target, payload)
 
     return jsonify({"seed": f"0x{seed}"})
 
@@ -0,0 +1,82 @@
+"""
+Challenge offsets sampler, must stay identical to common/offsets.c
+(see common/offsets.vectors, checked by both sides)
+"""
+
+MASK64 = (1 << 64) - 1
+OFFSETS_PER_SEGMENT = 8
+OFFSETS_SUBSETS_DOMAIN = 0x7375627365747321
+
+def mix64(value):
+    value = ((value ^ (value >> 30)) * 0xbf58476d1ce4e5b9) & MASK64
+    value = ((value ^ (value >> 27)) * 0x94d049bb133111eb) & MASK64
+    return value ^ (value >> 31)
+
+class SegmentRandom:
+    def __init__(self, state):
+        self.state = state
+
+    def next64(self):
+        self.state = (self.state + 0x9e3779b97f4a7c15) & MASK64
+        return mix64(self.state)
+
+    def bounded(self, limit):
+        product = self.next64() * limit
+        if (product & MASK64) < limit:
+            threshold = (-limit & MASK64) % limit
+            while (product & MASK64) < threshold:
+                product = self.next64() * limit
+
+        return product >> 64
+
+def offsets_segments(count):
+    """
+    Yield (segment, segments, first datapoint, datapoints) for each segment
+    """
+    segments = max(count // OFFSETS_PER_SEGMENT, 1)
+
+    for segment in range(segments):
+        first = (count * segment) // segments
+        length = (count * (segment + 1)) // segments - first
+
+        yield segment, segments, first, length
+
+def offsets_state(key, size, count, segment):
+    return mix64(mix64(mix64(key ^ mix64(size)) ^ count) ^ segment)
+
+def offsets_generate(key, size, count):
+    """
+    Challenge offsets derived from (key, size, count), must stay
+    identical to common/offsets.c
+    """
+    values = size // 8
+    offsets = []
+
+    for segment, segments, first, length in offsets_segments(count):
+        start = (values * segment) // segments
+        limit = (values * (segment + 1)) // segments - start
+        random = SegmentRandom(offsets_state(key, size, count, segment))
+
+        drawn = [random.bounded(limit) if limit else 0 for _ in range(length)]
+        offsets += [start + value for value in sorted(drawn)]
+
+    return offsets
+
+def offsets_subsets(key, size, count, subsets):
+    """
+    Subset of each datapoint, see offsets_subsets in common/offsets.c
+    """
+    ids = [0] * count
+
+    for segment, _, first, length in offsets_segments(count):
+        random = SegmentRandom(offsets_state(key, size, count, segment) ^ OFFSETS_SUBSETS_DOMAIN)
+        rank = list(range(length))
+
+        for i in range(length, 1, -1):
+            j = random.bounded(i)
+            rank[i - 1], rank[j] = rank[j], rank[i - 1]
+
+        for i in range(length):
+            ids[first + rank[i]] = (first + i) % subsets
+
+    return ids
@@ -0,0 +1,37 @@
+"""
+Challenge offsets golden vectors, the generator sampler is checked
+against the same file (generator/storage/test/offsets-test.c)
+
+usage: python3 -m unittest test_offsets
+"""
+import os
+import unittest
+from offsets import offsets_generate, offsets_subsets
+
+VECTORS = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "common", "offsets.vectors")
+
+def vectors_load(filename):
+    """
+    Yield (key, size, count, subsets, offsets, ids) of each vector
+    """
+    with open(filename) as fp:
+        lines = [line.split() for line in fp if line.strip() and not line.startswith("#")]
+
+    for vector, offsets, ids in zip(lines[0::3], lines[1::3], lines[2::3]):
+        assert (vector[0], offsets[0], ids[0]) == ("vector", "offsets", "subsets")
+
+        key, size, count, subsets = int(vector[1], 16), int(vector[2]), int(vector[3]), int(vector[4])
+        yield key, size, count, subsets, [int(x) for x in offsets[1:]], [int(x) for x in ids[1:]]
+
+class OffsetsVectors(unittest.TestCase):
+    def test_vectors(self):
+        vectors = list(vectors_load(VECTORS))
+        self.assertTrue(vectors)
+
+        for key, size, count, subsets, offsets, ids in vectors:
+            with self.subTest(key=f"0x{key:016x}", size=size, count=count):
+                self.assertEqual(offsets_generate(key, size, count), offsets)
+                self.assertEqual(offsets_subsets(key, size, count, subsets), ids)
+
+if __name__ == "__main__":
+    unittest.main()